@@ -0,0 +1,144 @@
+#include "precomp.h"
+#include "audiobench.h"
+#include "audiodevice.h"
+#include "interleave.h"
+#include "chrono.h"
+#include "logger.h"
+
+#include <ctime>
+#include <vector>
+
+namespace {
+    const uint32_t CHANNELS = 8;
+    const uint32_t SAMPLE_RATE = 48000;
+    const uint32_t NB_SAMPLES = 1024;
+    const uint32_t NB_SECONDS = 10;
+
+    // decoder 7.1 order to ALSA order, output channel ch is read from input channel PERMUTATION[ch]
+    const uint32_t PERMUTATION[CHANNELS] = { 0, 1, 4, 5, 2, 3, 6, 7 };
+
+    uint32_t GetSampleSize(SampleFormat sf)
+    {
+        switch(sf)
+        {
+            case SF_FMT_U8:
+                return 1;
+            case SF_FMT_S16:
+                return 2;
+            case SF_FMT_S32:
+            case SF_FMT_FLOAT:
+                return 4;
+            case SF_FMT_DOUBLE:
+                return 8;
+            default:
+                return 0;
+        }
+    }
+
+    Result Benchmark(bool mmap)
+    {
+        audiodevice::SetMmap(mmap);
+
+        audiodevice::Device* device = nullptr;
+        Result result = audiodevice::Create(device);
+
+        uint32_t channels = CHANNELS;
+        uint32_t sampleRate = SAMPLE_RATE;
+        SampleFormat sampleFormat = SF_FMT_FLOAT;
+        if(result)
+        {
+            result = audiodevice::SetInputFormat(device, channels, sampleRate, sampleFormat);
+        }
+        if(result && channels != CHANNELS)
+        {
+            result = Result(false, "Audio device negotiated %d channels instead of %d", channels, CHANNELS);
+        }
+        if(result && mmap && !audiodevice::GetMmap(device))
+        {
+            result = Result(false, "Audio device has no mmap access");
+        }
+
+        const uint32_t sampleSize = GetSampleSize(sampleFormat);
+        interleave::Function function = interleave::GetFunction(sampleSize, channels, true);
+        if(result && !function)
+        {
+            result = Result(false, "No interleave kernel for sample size %d", sampleSize);
+        }
+        if(!result)
+        {
+            audiodevice::Destroy(device);
+            return result;
+        }
+
+        // decoded planes, the frame copy only exists on the copy path
+        const size_t planeSize = static_cast<size_t>(NB_SAMPLES) * sampleSize;
+        std::vector<std::vector<uint8_t>> planes(channels, std::vector<uint8_t>(planeSize));
+        std::vector<const uint8_t*> input(channels);
+        for(uint32_t ch = 0; ch < channels; ch++)
+        {
+            for(size_t i = 0; i < planeSize; i++)
+            {
+                planes[ch][i] = static_cast<uint8_t>(ch * 31 + i);
+            }
+        }
+        std::vector<uint8_t> frame(planeSize * channels);
+        std::atomic<bool> frameInUse = false;
+
+        const uint32_t iterations = NB_SECONDS * sampleRate / NB_SAMPLES;
+        const uint64_t startTimeUs = chrono::RealNow();
+        const std::clock_t startCpu = std::clock();
+
+        for(uint32_t i = 0; i < iterations && result; i++)
+        {
+            if(mmap)
+            {
+                result = audiodevice::Write(device, NB_SAMPLES, [&](uint8_t* output, uint32_t offset, uint32_t frames) {
+                    for(uint32_t ch = 0; ch < channels; ch++)
+                    {
+                        input[ch] = planes[ch].data() + static_cast<size_t>(offset) * sampleSize;
+                    }
+                    function(input.data(), PERMUTATION, channels, output, frames);
+                });
+            }
+            else
+            {
+                for(uint32_t ch = 0; ch < channels; ch++)
+                {
+                    input[ch] = planes[ch].data();
+                }
+                function(input.data(), PERMUTATION, channels, frame.data(), NB_SAMPLES);
+                result = audiodevice::WriteInterleaved(device, frame.data(), NB_SAMPLES, frameInUse);
+            }
+        }
+
+        const double cpuMs = 1000.0 * static_cast<double>(std::clock() - startCpu) / CLOCKS_PER_SEC;
+        const uint64_t elapsedUs = chrono::RealNow() - startTimeUs;
+
+        audiodevice::Flush(device);
+        audiodevice::Destroy(device);
+
+        if(!result)
+        {
+            return result;
+        }
+
+        const double audioSeconds = static_cast<double>(iterations) * NB_SAMPLES / sampleRate;
+        logger::Info("Audio %s path %d channels %d Hz %fs audio: cpu %f ms per second of audio, elapsed %f s",
+                     mmap ? "mmap" : "copy", channels, sampleRate, audioSeconds, cpuMs / audioSeconds, chrono::Seconds(elapsedUs));
+        return result;
+    }
+}
+
+namespace audiobench
+{
+    Result Run()
+    {
+        Result result = Benchmark(false);
+        if(result)
+        {
+            result = Benchmark(true);
+        }
+        audiodevice::SetMmap(false);
+        return result;
+    }
+}
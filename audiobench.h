@@ -0,0 +1,11 @@
+#pragma once
+
+#include "result.h"
+
+namespace audiobench
+{
+    // Write 8 channel audio remapped like a 7.1 stream to the audio device through the
+    // copy (interleave to a frame, then write) and mmap (interleave into the device buffer)
+    // paths and report the CPU time spent per second of audio.
+    Result Run();
+}
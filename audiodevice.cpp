@@ -2,12 +2,92 @@
 #include "precomp.h"
 #include "audiodevice.h"
 #include "logger.h"
+#include "chrono.h"
 
 #include <system_error>
+#include <assert.h>
+#include <algorithm>
 #include <thread>
+#include <memory>
+#include <cerrno>
+#include <cstring>
+
+#ifdef HAVE_ALSA
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
 
 namespace {
 
+    audiodevice::Backend backend = audiodevice::BACKEND_HARDWARE;
+    std::string wavPath = "grumpy.wav";
+
+    // hardware device buffering, 0 keeps the device default
+    uint32_t latencyUs = 0;
+    std::string pcmName;
+
+    // write through the device ring buffer mapping when the device allows it
+    bool mmapEnabled = false;
+
+    // upper bound of a single wait, state changes without notification are picked up on timeout
+    const uint32_t startWaitTimeMs = 100;
+    const int writePollTimeMs = 100;
+    const uint32_t sinkWaitTimeMs = 10;
+
+    // wav header
+    const uint16_t WAV_FORMAT_PCM = 1;
+    const uint16_t WAV_FORMAT_IEEE_FLOAT = 3;
+    const uint32_t WAV_HEADER_SIZE = 44;
+
+    uint32_t GetSampleBits(SampleFormat sf)
+    {
+        switch(sf)
+        {
+            case SF_FMT_U8:
+                return 8;
+            case SF_FMT_S16:
+                return 16;
+            case SF_FMT_S32:
+            case SF_FMT_FLOAT:
+                return 32;
+            case SF_FMT_DOUBLE:
+                return 64;
+            default:
+                return 0;
+        }
+    }
+
+    void WriteLE(std::ofstream& out, uint32_t value, uint32_t bytes)
+    {
+        for(uint32_t i = 0; i < bytes; i++)
+        {
+            out.put(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    }
+
+    // riff sizes are patched on close, a capture stopped early still has a header readable by most tools
+    void WriteWavHeader(std::ofstream& out, uint32_t channels, uint32_t sampleRate, SampleFormat sf, uint64_t dataBytes)
+    {
+        const uint32_t bits = GetSampleBits(sf);
+        const uint32_t blockAlign = channels * bits / 8;
+        const uint32_t dataSize = static_cast<uint32_t>(std::min<uint64_t>(dataBytes, UINT32_MAX - WAV_HEADER_SIZE));
+        const bool floatingPoint = sf == SF_FMT_FLOAT || sf == SF_FMT_DOUBLE;
+
+        out.write("RIFF", 4);
+        WriteLE(out, WAV_HEADER_SIZE - 8 + dataSize, 4);
+        out.write("WAVE", 4);
+        out.write("fmt ", 4);
+        WriteLE(out, 16, 4);
+        WriteLE(out, floatingPoint ? WAV_FORMAT_IEEE_FLOAT : WAV_FORMAT_PCM, 2);
+        WriteLE(out, channels, 2);
+        WriteLE(out, sampleRate, 4);
+        WriteLE(out, sampleRate * blockAlign, 4);
+        WriteLE(out, blockAlign, 2);
+        WriteLE(out, bits, 2);
+        out.write("data", 4);
+        WriteLE(out, dataSize, 4);
+    }
+
 #ifdef HAVE_ALSA
     snd_pcm_format_t SampleFormatToASound(SampleFormat sf)
     {
@@ -29,433 +109,1362 @@ namespace {
                 sndFormat =  littleEndian ? SND_PCM_FORMAT_S16_LE : SND_PCM_FORMAT_S16_BE;
                 break;
             case SF_FMT_S32:
-                sndFormat = littleEndian ? SND_PCM_FORMAT_S32_LE : SND_PCM_FORMAT_S32_BE;
+                sndFormat = littleEndian ? SND_PCM_FORMAT_S32_LE : SND_PCM_FORMAT_S32_BE;
+                break;
+            case SF_FMT_FLOAT:
+                sndFormat = littleEndian ? SND_PCM_FORMAT_FLOAT_LE : SND_PCM_FORMAT_FLOAT_BE;
+                break;
+            case SF_FMT_DOUBLE:
+                sndFormat = littleEndian ? SND_PCM_FORMAT_FLOAT64_LE : SND_PCM_FORMAT_FLOAT64_BE;
+                break;
+            default:
+                break;
+        }
+        return sndFormat;
+    }
+
+    // first card accepting a playback stream on its first pcm, the plug device when there is none
+    std::string FindHardwarePcm()
+    {
+        int card = -1;
+        while( snd_card_next(&card) == 0 && card >= 0 )
+        {
+            const std::string name = "hw:" + std::to_string(card) + ",0";
+
+            snd_pcm_t* handle = nullptr;
+            if( snd_pcm_open(&handle, name.c_str(), SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK) == 0 )
+            {
+                snd_pcm_close(handle);
+                return name;
+            }
+        }
+        return "default";
+    }
+
+    // probed before the plug device is opened, it would hold the hardware device
+    bool ProbeNativeFormats(const std::string& name, audiodevice::NativeFormats& native)
+    {
+        snd_pcm_t* handle = nullptr;
+        if( snd_pcm_open(&handle, name.c_str(), SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK) < 0 )
+        {
+            return false;
+        }
+
+        snd_pcm_hw_params_t* hwParams = nullptr;
+        if( snd_pcm_hw_params_malloc(&hwParams) < 0 )
+        {
+            snd_pcm_close(handle);
+            return false;
+        }
+
+        if( snd_pcm_hw_params_any(handle, hwParams) >= 0 )
+        {
+            const SampleFormat formats[] = { SF_FMT_S16, SF_FMT_S32, SF_FMT_FLOAT, SF_FMT_U8, SF_FMT_DOUBLE };
+            for(auto format : formats)
+            {
+                if( snd_pcm_hw_params_test_format(handle, hwParams, SampleFormatToASound(format)) == 0 )
+                {
+                    native.sampleFormats.push_back(format);
+                }
+            }
+
+            const uint32_t rates[] = { 8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000, 176400, 192000 };
+            for(auto rate : rates)
+            {
+                if( snd_pcm_hw_params_test_rate(handle, hwParams, rate, 0) == 0 )
+                {
+                    native.sampleRates.push_back(rate);
+                }
+            }
+
+            unsigned int maxChannels = 0;
+            snd_pcm_hw_params_get_channels_max(hwParams, &maxChannels);
+            native.maxChannels = maxChannels;
+            native.probed = !native.sampleFormats.empty() && !native.sampleRates.empty();
+        }
+
+        snd_pcm_hw_params_free(hwParams);
+        snd_pcm_close(handle);
+        return native.probed;
+    }
+
+    // native format closest to the requested one, kept when the hardware plays it
+    void NarrowToNativeFormat(const audiodevice::NativeFormats& native, uint32_t& channels, uint32_t& sampleRate, SampleFormat& sampleFormat)
+    {
+        if( std::find(native.sampleFormats.begin(), native.sampleFormats.end(), sampleFormat) == native.sampleFormats.end() )
+        {
+            sampleFormat = native.sampleFormats.front();
+        }
+
+        uint32_t nearestRate = native.sampleRates.front();
+        for(auto rate : native.sampleRates)
+        {
+            if( std::abs(static_cast<int64_t>(rate) - sampleRate) < std::abs(static_cast<int64_t>(nearestRate) - sampleRate) )
+            {
+                nearestRate = rate;
+            }
+        }
+        sampleRate = nearestRate;
+
+        if( native.maxChannels != 0 )
+        {
+            channels = std::min(channels, native.maxChannels);
+        }
+    }
+
+    void LogCapabilities(snd_pcm_t* handle, snd_pcm_hw_params_t* hwParams)
+    {
+        unsigned int minRate = 0, maxRate = 0, minChannels = 0, maxChannels = 0;
+        unsigned int minPeriodUs = 0, maxPeriodUs = 0, minBufferUs = 0, maxBufferUs = 0;
+
+        snd_pcm_hw_params_get_rate_min(hwParams, &minRate, nullptr);
+        snd_pcm_hw_params_get_rate_max(hwParams, &maxRate, nullptr);
+        snd_pcm_hw_params_get_channels_min(hwParams, &minChannels);
+        snd_pcm_hw_params_get_channels_max(hwParams, &maxChannels);
+        snd_pcm_hw_params_get_period_time_min(hwParams, &minPeriodUs, nullptr);
+        snd_pcm_hw_params_get_period_time_max(hwParams, &maxPeriodUs, nullptr);
+        snd_pcm_hw_params_get_buffer_time_min(hwParams, &minBufferUs, nullptr);
+        snd_pcm_hw_params_get_buffer_time_max(hwParams, &maxBufferUs, nullptr);
+
+        std::string formats;
+        const SampleFormat sampleFormats[] = { SF_FMT_U8, SF_FMT_S16, SF_FMT_S32, SF_FMT_FLOAT, SF_FMT_DOUBLE };
+        for(auto format : sampleFormats)
+        {
+            if( snd_pcm_hw_params_test_format(handle, hwParams, SampleFormatToASound(format)) == 0 )
+            {
+                formats += std::string(formats.empty() ? "" : " ") + snd_pcm_format_name(SampleFormatToASound(format));
+            }
+        }
+
+        logger::Info("Audio device %s rates %u-%u Hz channels %u-%u formats %s period %u-%u us buffer %u-%u us",
+                     snd_pcm_name(handle), minRate, maxRate, minChannels, maxChannels, formats.c_str(),
+                     minPeriodUs, maxPeriodUs, minBufferUs, maxBufferUs);
+    }
+
+#endif
+
+}
+
+namespace audiodevice
+{
+#ifdef WIN32
+    class Audio2VoiceCallback : public IXAudio2VoiceCallback
+    {
+    public:
+        Audio2VoiceCallback() {}
+        ~Audio2VoiceCallback() {}
+
+        //Called when the voice has just finished playing a contiguous audio stream.
+        void OnStreamEnd() { }
+        void OnVoiceProcessingPassEnd() { }
+        void OnVoiceProcessingPassStart(UINT32 SamplesRequired) { }
+        
+        void OnBufferEnd(void* pBufferContext) 
+        {
+            std::atomic<bool>* bufferInUse = reinterpret_cast<std::atomic<bool>*>(pBufferContext);
+            *bufferInUse = false;
+        }
+
+        void OnBufferStart(void* pBufferContext) {    }
+        void OnLoopEnd(void* pBufferContext) {    }
+        void OnVoiceError(void* pBufferContext, HRESULT Error) { }
+    };
+#endif
+
+    // platform device
+    namespace hardware
+    {
+#ifdef HAVE_ALSA
+        Result Open(Device* device)
+        {
+            Result result;
+
+            // low latency avoids the plug layer conversions unless a device was given
+            std::string name = pcmName;
+            if( name.empty() )
+            {
+                name = latencyUs != 0 ? FindHardwarePcm() : "default";
+            }
+
+            // the plug layer would convert any format, the hardware below it decides what the decoder outputs
+            const std::string hardwareName = name == "default" ? FindHardwarePcm()
+                                                               : name.compare(0, 7, "plughw:") == 0 ? name.substr(4) : "";
+            if( !hardwareName.empty() && hardwareName != "default" && ProbeNativeFormats(hardwareName, device->nativeFormats) )
+            {
+                logger::Info("Audio device %s native formats probed on %s", name.c_str(), hardwareName.c_str());
+            }
+
+            int err = snd_pcm_open(&device->playbackHandle, name.c_str(), SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot open audio device %s %s", name.c_str(), snd_strerror(err));
+                return result;
+            }
+            logger::Info("Audio device %s", name.c_str());
+
+            const int count = snd_pcm_poll_descriptors_count(device->playbackHandle);
+            if( count <= 0 )
+            {
+                result = Result(false, "Cannot get audio device poll descriptors count %s", snd_strerror(count));
+                return result;
+            }
+
+            device->pollDescriptors.resize(count + 1);
+            err = snd_pcm_poll_descriptors(device->playbackHandle, device->pollDescriptors.data(), count);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot get audio device poll descriptors %s", snd_strerror(err));
+                return result;
+            }
+
+            device->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if( device->wakeFd < 0 )
+            {
+                result = Result(false, "Cannot create audio device wake event %s", strerror(errno));
+                return result;
+            }
+            device->pollDescriptors[count] = { device->wakeFd, POLLIN, 0 };
+            return result;
+        }
+
+        // wake a writer sleeping in poll, the event stays set until cleared
+        void Interrupt(Device* device, bool interrupted)
+        {
+            if( device->wakeFd < 0 )
+            {
+                return;
+            }
+
+            uint64_t value = 1;
+            if( interrupted )
+            {
+                (void)write(device->wakeFd, &value, sizeof(value));
+            }
+            else
+            {
+                (void)read(device->wakeFd, &value, sizeof(value));
+            }
+        }
+
+        // sleep until the device has room for a write, an interrupt or timeout
+        Result WaitWritable(Device* device)
+        {
+            Result result;
+            if( device->interrupted )
+            {
+                return result;
+            }
+
+            std::vector<struct pollfd>& fds = device->pollDescriptors;
+            const int ready = poll(fds.data(), fds.size(), writePollTimeMs);
+            if( ready < 0 && errno != EINTR )
+            {
+                result = Result(false, "Audio device poll failed %s", strerror(errno));
+                return result;
+            }
+            if( ready <= 0 || fds.back().revents != 0 )
+            {
+                return result;
+            }
+
+            unsigned short revents = 0;
+            int err = snd_pcm_poll_descriptors_revents(device->playbackHandle, fds.data(), fds.size() - 1, &revents);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot get audio device poll events %s", snd_strerror(err));
+                return result;
+            }
+
+            // an xrun is reported by the next write
+            if( revents & POLLERR )
+            {
+                logger::Debug("Audio device poll error state %d", snd_pcm_state(device->playbackHandle));
+            }
+            return result;
+        }
+
+        void Close(Device* device)
+        {
+            snd_pcm_close(device->playbackHandle);
+            if( device->wakeFd >= 0 )
+            {
+                close(device->wakeFd);
+            }
+        }
+
+        // wake the writer every period, start once two periods are queued
+        Result SetSoftwareParams(Device* device, snd_pcm_uframes_t periodFrames, snd_pcm_uframes_t bufferFrames)
+        {
+            Result result;
+
+            snd_pcm_sw_params_t* swParams = nullptr;
+            int err = snd_pcm_sw_params_malloc(&swParams);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot allocate software parameter structure %s", snd_strerror(err));
+                return result;
+            }
+
+            err = snd_pcm_sw_params_current(device->playbackHandle, swParams);
+            if( err >= 0 )
+            {
+                err = snd_pcm_sw_params_set_avail_min(device->playbackHandle, swParams, periodFrames);
+            }
+            if( err >= 0 && periodFrames != 0 )
+            {
+                // a stream ending before the buffer fills must still reach the threshold
+                device->startFrames = std::min<snd_pcm_uframes_t>(2 * periodFrames, bufferFrames);
+                err = snd_pcm_sw_params_set_start_threshold(device->playbackHandle, swParams, device->startFrames);
+            }
+            if( err >= 0 )
+            {
+                err = snd_pcm_sw_params(device->playbackHandle, swParams);
+            }
+            snd_pcm_sw_params_free(swParams);
+
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot set software parameters %s", snd_strerror(err));
+                return result;
+            }
+            return result;
+        }
+
+        Result SetInputFormat(Device* device, uint32_t& channels, uint32_t& sampleRate, SampleFormat& sampleFormat)
+        {
+            Result result;
+
+            assert(device);
+            if(!device)
+            {
+                result = Result(false, "Invalid audiodevice");
+            }
+
+            snd_pcm_hw_params_t* hwParams = nullptr;
+            int err = snd_pcm_hw_params_malloc(&hwParams);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot allocate hardware parameter structure %s", snd_strerror(err));
+                return result;
+            }
+            std::unique_ptr<snd_pcm_hw_params_t, decltype(&snd_pcm_hw_params_free)> hwParamsOwner(hwParams, snd_pcm_hw_params_free);
+        
+            err = snd_pcm_hw_params_any(device->playbackHandle, hwParams);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot initialize parameter structure %s", snd_strerror(err));
+                return result;
+            }
+
+            if( latencyUs != 0 )
+            {
+                LogCapabilities(device->playbackHandle, hwParams);
+
+                // a native rate is chosen, the decoder resampler converts rather than alsa-lib
+                err = snd_pcm_hw_params_set_rate_resample(device->playbackHandle, hwParams, 0);
+                if( err < 0 )
+                {
+                    result = Result(false, "Cannot disable rate resampling %s", snd_strerror(err));
+                    return result;
+                }
+            }
+         
+            device->mmap = mmapEnabled && snd_pcm_hw_params_test_access(device->playbackHandle, hwParams, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+            if( mmapEnabled && !device->mmap )
+            {
+                logger::Warn("Audio device %s has no mmap access, using writes", snd_pcm_name(device->playbackHandle));
+            }
+
+            err = snd_pcm_hw_params_set_access(device->playbackHandle, hwParams, device->mmap ? SND_PCM_ACCESS_MMAP_INTERLEAVED : SND_PCM_ACCESS_RW_INTERLEAVED);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot set access type %s", snd_strerror(err));
+                return result;
+            }
+
+            if( device->nativeFormats.probed )
+            {
+                const uint32_t requestedChannels = channels;
+                const uint32_t requestedRate = sampleRate;
+                const SampleFormat requestedFormat = sampleFormat;
+
+                NarrowToNativeFormat(device->nativeFormats, channels, sampleRate, sampleFormat);
+                if( channels != requestedChannels || sampleRate != requestedRate || sampleFormat != requestedFormat )
+                {
+                    logger::Info("Audio device plays %d channels %d Hz sample format %d natively, requested %d channels %d Hz sample format %d",
+                                 channels, sampleRate, sampleFormat, requestedChannels, requestedRate, requestedFormat);
+                }
+            }
+
+            // use the requested format if the device supports it natively, otherwise the first supported one
+            if( snd_pcm_hw_params_test_format(device->playbackHandle, hwParams, SampleFormatToASound(sampleFormat)) < 0 )
+            {
+                const SampleFormat formats[] = { SF_FMT_S16, SF_FMT_S32, SF_FMT_FLOAT, SF_FMT_U8, SF_FMT_DOUBLE };
+                const SampleFormat requestedFormat = sampleFormat;
+
+                sampleFormat = SF_FMT_INVALID;
+                for(auto format : formats)
+                {
+                    if( snd_pcm_hw_params_test_format(device->playbackHandle, hwParams, SampleFormatToASound(format)) == 0 )
+                    {
+                        sampleFormat = format;
+                        break;
+                    }
+                }
+
+                if( sampleFormat == SF_FMT_INVALID )
+                {
+                    result = Result(false, "Cannot find a supported sample format");
+                    return result;
+                }
+                logger::Info("Audio device sample format %d not supported. Using %d", requestedFormat, sampleFormat);
+            }
+
+            err = snd_pcm_hw_params_set_format (device->playbackHandle, hwParams,SampleFormatToASound(sampleFormat));
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot set sample format %s", snd_strerror(err));
+                return result;
+            }
+
+            err = snd_pcm_hw_params_set_rate_near(device->playbackHandle, hwParams, &sampleRate, 0);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot set sample rate %s", snd_strerror(err));
+                return result;
+            }
+        
+            err = snd_pcm_hw_params_set_channels_near(device->playbackHandle, hwParams, &channels);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot set channel count %s", snd_strerror(err));
+                return result;
+            }
+
+            if( latencyUs != 0 )
+            {
+                unsigned int bufferTimeUs = latencyUs;
+                err = snd_pcm_hw_params_set_buffer_time_near(device->playbackHandle, hwParams, &bufferTimeUs, nullptr);
+                if( err < 0 )
+                {
+                    result = Result(false, "Cannot set buffer time %d us %s", latencyUs, snd_strerror(err));
+                    return result;
+                }
+
+                unsigned int periodTimeUs = bufferTimeUs / LOW_LATENCY_PERIODS;
+                err = snd_pcm_hw_params_set_period_time_near(device->playbackHandle, hwParams, &periodTimeUs, nullptr);
+                if( err < 0 )
+                {
+                    result = Result(false, "Cannot set period time %d us %s", periodTimeUs, snd_strerror(err));
+                    return result;
+                }
+            }
+
+            err = snd_pcm_hw_params(device->playbackHandle, hwParams);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot set parameters %s", snd_strerror(err));
+                return result;
+            }
+
+            snd_pcm_uframes_t periodFrames = 0;
+            snd_pcm_uframes_t bufferFrames = 0;
+            snd_pcm_hw_params_get_period_size(hwParams, &periodFrames, nullptr);
+            snd_pcm_hw_params_get_buffer_size(hwParams, &bufferFrames);
+
+            // alsa-lib default, the first write starts playback
+            device->startFrames = 1;
+            if( latencyUs != 0 )
+            {
+                result = SetSoftwareParams(device, periodFrames, bufferFrames);
+                if(!result)
+                {
+                    return result;
+                }
+            }
+
+            err = snd_pcm_prepare(device->playbackHandle);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot prepare audio interface for use %s", snd_strerror(err));
+                return result;
+            }
+
+            err = snd_pcm_hw_params_can_pause(hwParams);
+            if( err != 1 ) // can pause
+            {
+                result = Result(false, "Cannot prepare audio interface for use since it cannot pause.");
+                return result;
+            }
+
+            device->channels = channels;
+            device->sampleRate = sampleRate;
+            device->sampleFormat = sampleFormat;
+            device->periodFrames = periodFrames;
+            device->bufferFrames = bufferFrames;
+
+            logger::Info("Audio device format %d channels %d Hz sample format %d", channels, sampleRate, sampleFormat);
+            logger::Info("Audio device period %lu frames buffer %lu frames latency %f ms %s access", periodFrames, bufferFrames,
+                         chrono::Milliseconds(bufferFrames * 1000000.0 / sampleRate), device->mmap ? "mmap" : "write");
+
+            return result;
+
+        }
+
+        // a short stream may have played out and underrun before the wait
+        Result StartWhenReady(Device* device)
+        {
+            Result result;
+            while( snd_pcm_state(device->playbackHandle) == SND_PCM_STATE_PREPARED )
+            {
+                eventcount::Wait(&device->written, [device]() {
+                    return snd_pcm_state(device->playbackHandle) != SND_PCM_STATE_PREPARED;
+                }, startWaitTimeMs);
+            }
+            return result;
+        }
+
+        Result Start(Device* device)
+        {
+            Result result;
+            snd_pcm_t* handle = device->playbackHandle;
+
+            snd_pcm_sframes_t delay = 0;
+            if( snd_pcm_state(handle) != SND_PCM_STATE_PREPARED || snd_pcm_delay(handle, &delay) < 0 || delay <= 0 )
+            {
+                return result;
+            }
+
+            int err = snd_pcm_start(handle);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot start audio device %s", snd_strerror(err));
+                return result;
+            }
+            eventcount::Notify(&device->written);
+            return result;
+        }
+
+        // Fill the ring buffer mapping in place. Commits do not start the stream like writes
+        // do, it is started once the start threshold is queued.
+        Result WriteMmap(Device* device, uint32_t frames, const FillCallback& fill)
+        {
+            Result result;
+            snd_pcm_t* handle = device->playbackHandle;
+
+            uint32_t offset = 0;
+            while( offset < frames )
+            {
+                const snd_pcm_sframes_t avail = snd_pcm_avail_update(handle);
+                if( avail < 0 )
+                {
+                    snd_pcm_prepare(handle);
+                    result = Result(false, "Audio mmap avail failed %s", snd_strerror(avail));
+                    break;
+                }
+
+                if( avail == 0 )
+                {
+                    if( snd_pcm_state(handle) == SND_PCM_STATE_PREPARED )
+                    {
+                        snd_pcm_start(handle);
+                    }
+
+                    result = WaitWritable(device);
+                    if( !result || device->interrupted )
+                    {
+                        break;
+                    }
+                    continue;
+                }
+
+                const snd_pcm_channel_area_t* areas = nullptr;
+                snd_pcm_uframes_t areaOffset = 0;
+                snd_pcm_uframes_t contiguous = std::min<snd_pcm_uframes_t>(avail, frames - offset);
+
+                int err = snd_pcm_mmap_begin(handle, &areas, &areaOffset, &contiguous);
+                if( err < 0 )
+                {
+                    snd_pcm_prepare(handle);
+                    result = Result(false, "Audio mmap begin failed %s", snd_strerror(err));
+                    break;
+                }
+
+                // interleaved, all channels share the first area
+                uint8_t* output = static_cast<uint8_t*>(areas[0].addr) + (areas[0].first + areaOffset * areas[0].step) / 8;
+                fill(output, offset, static_cast<uint32_t>(contiguous));
+
+                const snd_pcm_sframes_t committed = snd_pcm_mmap_commit(handle, areaOffset, contiguous);
+                if( committed < 0 || static_cast<snd_pcm_uframes_t>(committed) != contiguous )
+                {
+                    snd_pcm_prepare(handle);
+                    result = Result(false, "Audio mmap commit failed %s", snd_strerror(committed < 0 ? committed : -EPIPE));
+                    break;
+                }
+                offset += static_cast<uint32_t>(committed);
+
+                if( snd_pcm_state(handle) == SND_PCM_STATE_PREPARED && device->bufferFrames - snd_pcm_avail_update(handle) >= device->startFrames )
+                {
+                    snd_pcm_start(handle);
+                }
+                eventcount::Notify(&device->written);
+            }
+            return result;
+        }
+
+        Result WriteInterleaved(Device* device, void* buf, uint32_t frames, std::atomic<bool>& bufferInUse)
+        {
+            Result result;
+
+            assert(device);
+            if(!device)
+            {
+                return Result(false, "Invalid audiodevice");
+            }
+
+            if( device->mmap )
+            {
+                const uint32_t frameBytes = static_cast<uint32_t>(snd_pcm_frames_to_bytes(device->playbackHandle, 1));
+                const uint8_t* samples = static_cast<const uint8_t*>(buf);
+
+                result = WriteMmap(device, frames, [samples, frameBytes](uint8_t* output, uint32_t offset, uint32_t count) {
+                    memcpy(output, samples + static_cast<size_t>(offset) * frameBytes, static_cast<size_t>(count) * frameBytes);
+                });
+                bufferInUse = false;
+                return result;
+            }
+
+            uint8_t* data = static_cast<uint8_t*>(buf);
+            while( frames > 0 )
+            {
+                snd_pcm_sframes_t written = snd_pcm_writei(device->playbackHandle, data, frames);
+                if( written == -EAGAIN )
+                {
+                    result = WaitWritable(device);
+                    if( !result || device->interrupted )
+                    {
+                        break;
+                    }
+                    continue;
+                }
+
+                if( written < 0 )
+                {
+                    snd_pcm_prepare(device->playbackHandle);
+                    result = Result(false, "Audio write failed %s", snd_strerror(written));
+                    break;
+                }
+
+                // a non blocking write takes what fits
+                data += snd_pcm_frames_to_bytes(device->playbackHandle, written);
+                frames -= static_cast<uint32_t>(written);
+                eventcount::Notify(&device->written);
+            }
+            bufferInUse = false;
+            return result;
+        }
+
+        // without a mapping the callback fills a scratch buffer then written
+        Result Write(Device* device, uint32_t frames, const FillCallback& fill)
+        {
+            if( device->mmap )
+            {
+                return WriteMmap(device, frames, fill);
+            }
+
+            device->scratch.resize(static_cast<size_t>(snd_pcm_frames_to_bytes(device->playbackHandle, frames)));
+            fill(device->scratch.data(), 0, frames);
+
+            std::atomic<bool> scratchInUse = false;
+            return hardware::WriteInterleaved(device, device->scratch.data(), frames, scratchInUse);
+        }
+
+        Result Flush(Device* device)
+        {
+            Result result;
+
+            assert(device);
+            if(!device)
+            {
+                result = Result(false, "Invalid audiodevice");
+            }
+
+            int err = snd_pcm_drop(device->playbackHandle);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot prepare audio interface for use %s", snd_strerror(err));
+                return result;
+            }
+
+            err = snd_pcm_prepare(device->playbackHandle);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot prepare audio interface for use %s", snd_strerror(err));
+                return result;
+            }
+            return result;
+        }
+
+        Result Pause(Device* device)
+        {
+            Result result;
+
+            assert(device);
+            if(!device)
+            {
+                result = Result(false, "Invalid audiodevice");
+            }
+
+            int err = snd_pcm_pause(device->playbackHandle,1);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot prepare audio interface for use %s", snd_strerror(err));
+                return result;
+            }
+            return result;
+        }
+
+        Result Resume(Device* device)
+        {
+            Result result;
+
+            assert(device);
+            if(!device)
+            {
+                result = Result(false, "Invalid audiodevice");
+            }
+
+            int err = snd_pcm_pause(device->playbackHandle,0);
+            if( err < 0 )
+            {
+                result = Result(false, "Cannot prepare audio interface for use %s", snd_strerror(err));
+                return result;
+            }
+            return result;
+        }
+
+
+        Result GetDelay(Device* device, uint64_t& frames)
+        {
+            snd_pcm_sframes_t delay = 0;
+            int err = snd_pcm_delay(device->playbackHandle, &delay);
+            if( err < 0 )
+            {
+                frames = 0;
+                return Result(false, "Cannot get audio delay %s", snd_strerror(err));
+            }
+
+            // negative after an underrun
+            frames = delay > 0 ? static_cast<uint64_t>(delay) : 0;
+            return Result(true);
+        }
+#endif
+
+#ifdef WIN32
+
+        Result Open(Device* device)
+        {
+            Result result;
+
+            HRESULT hr;
+            if (FAILED(hr = CoInitialize(nullptr)))
+            {
+                return Result(false, "CoInitialize failed. Error: %s", std::system_category().message(hr).c_str());
+            }
+
+            memset(&device->wfx, 0, sizeof(WAVEFORMATEX));
+
+            if (FAILED(hr = XAudio2Create(&device->xaudioHandle, 0, XAUDIO2_DEFAULT_PROCESSOR)))
+            {
+                return Result(false, "XAudio2Create failed. Error: %s", std::system_category().message(hr).c_str());
+            }
+
+            return result;
+        }
+
+        Result SetInputFormat(Device* device, uint32_t& channels, uint32_t& sampleRate, SampleFormat& sampleFormat)
+        {
+            Result result;
+
+            HRESULT hr;
+            if (FAILED(hr = device->xaudioHandle->CreateMasteringVoice(&device->masterVoice, channels, sampleRate, 0, 0, 0)))
+            {
+                return Result(false, "CreateMasteringVoice failed. Error: %s", std::system_category().message(hr).c_str());
+            }
+
+            WAVEFORMATEX& wfx = device->wfx;
+            wfx.nChannels = channels;
+            wfx.nSamplesPerSec = sampleRate;
+
+            switch (sampleFormat)
+            {
+            case SF_FMT_U8:
+                wfx.wBitsPerSample = 8;
+                wfx.wFormatTag = WAVE_FORMAT_PCM;
+                break;
+            case SF_FMT_S16:
+                wfx.wBitsPerSample = 16;
+                wfx.wFormatTag = WAVE_FORMAT_PCM;
+                break;
+            case SF_FMT_S32:
+                wfx.wBitsPerSample = 32;
+                wfx.wFormatTag = WAVE_FORMAT_PCM;
                 break;
             case SF_FMT_FLOAT:
-                sndFormat = littleEndian ? SND_PCM_FORMAT_FLOAT_LE : SND_PCM_FORMAT_FLOAT_BE;
+                wfx.wBitsPerSample = 32;
+                wfx.wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
                 break;
             case SF_FMT_DOUBLE:
-                sndFormat = littleEndian ? SND_PCM_FORMAT_FLOAT64_LE : SND_PCM_FORMAT_FLOAT64_BE;
-                break;
-            default:
+                wfx.wBitsPerSample = 64;        
+                wfx.wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
                 break;
-        }
-        return sndFormat;
-    }
+            case SF_FMT_INVALID:
+                return Result(false, "Invalid Sample Format.");
+            }
 
-#endif
+            wfx.nBlockAlign = wfx.nChannels * (wfx.wBitsPerSample / 8);
+            wfx.nAvgBytesPerSec = wfx.nSamplesPerSec * wfx.nBlockAlign;
+            wfx.cbSize = 0;
 
-}
+            device->voiceCallbacks = new Audio2VoiceCallback();
 
-namespace audiodevice
-{
-#ifdef HAVE_ALSA
-    Result Create(Device*& device)
-    {
-        Result result;
+            if (FAILED(hr = device->xaudioHandle->CreateSourceVoice(&device->sourceVoice, (WAVEFORMATEX*)&wfx, 0, 2.0f, device->voiceCallbacks)))
+            {
+                return Result(false, "CreateSourceVoice failed. Error: %s", std::system_category().message(hr).c_str());
+            }
 
-        device = new Device();
+            // XAudio2 source voices accept the requested format
+            device->channels = channels;
+            device->sampleRate = sampleRate;
+            device->sampleFormat = sampleFormat;
 
-        int err = snd_pcm_open(&device->playbackHandle, "default", SND_PCM_STREAM_PLAYBACK, 0);
-        if( err < 0 )
-        {
-            result = Result(false, "Cannot open audio device %s", snd_strerror(err));
             return result;
         }
-        return result;
-    }
 
-    void Destroy(Device*& device)
-    {
-        snd_pcm_close(device->playbackHandle);
-        delete device;
-        device = nullptr;
-    }
+        Result WriteInterleaved(Device* device, void* buf, uint32_t nbSamples, std::atomic<bool>& bufferInUse)
+        {
+            const uint32_t sleepTimeOnErrorMMS = 100;
+            Result result;
+        
+            const WAVEFORMATEX& wfx = device->wfx;
+            XAUDIO2_BUFFER buffer;
+            memset(&buffer, 0, sizeof(XAUDIO2_BUFFER));
+        
+            buffer.AudioBytes = nbSamples * wfx.nChannels * wfx.wBitsPerSample / 8;
+            buffer.pAudioData = reinterpret_cast<BYTE*>(buf);
+            buffer.pContext = &bufferInUse;
 
-    Result SetInputFormat(Device* device, uint32_t channels, uint32_t sampleRate, SampleFormat sampleFormat)
-    {
-        Result result;
+            bufferInUse = true;
 
-        assert(device);
-        if(!device)
-        {
-            result = Result(false, "Invalid audiodevice");
-        }
+            HRESULT hr;
+
+            do
+            {
+                if (FAILED(hr = device->sourceVoice->SubmitSourceBuffer(&buffer)) && hr != XAUDIO2_E_INVALID_CALL)
+                {
+                    return Result(false, "SubmitSourceBuffer failed. Error: %s", std::system_category().message(hr).c_str());
+                }
+
+                if (FAILED(hr))
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(sleepTimeOnErrorMMS));
+                }
+
+            } while (hr == XAUDIO2_E_INVALID_CALL);
+
+            device->framesWritten += nbSamples;
+            eventcount::Notify(&device->written);
 
-        snd_pcm_hw_params_t* hwParams = nullptr;
-        int err = snd_pcm_hw_params_malloc(&hwParams);
-        if( err < 0 )
-        {
-            result = Result(false, "Cannot allocate hardware parameter structure %s", snd_strerror(err));
-            return result;
-        }
-        
-        err = snd_pcm_hw_params_any(device->playbackHandle, hwParams);
-        if( err < 0 )
-        {
-            result = Result(false, "Cannot initialize parameter structure %s", snd_strerror(err));
-            return result;
-        }
-         
-        err = snd_pcm_hw_params_set_access(device->playbackHandle, hwParams, SND_PCM_ACCESS_RW_INTERLEAVED);
-        if( err < 0 )
-        {
-            result = Result(false, "Cannot set access type %s", snd_strerror(err));
             return result;
         }
 
-        err = snd_pcm_hw_params_set_format (device->playbackHandle, hwParams,SampleFormatToASound(sampleFormat));
-        if( err < 0 )
+        // submitted buffers are read asynchronously, a reused scratch buffer cannot be handed over
+        Result Write(Device* device, uint32_t frames, const FillCallback& fill)
         {
-            result = Result(false, "Cannot set sample format %s", snd_strerror(err));
-            return result;
+            return Result(false, "Audio device fill writes are not supported");
         }
 
-        err = snd_pcm_hw_params_set_rate_near(device->playbackHandle, hwParams, &sampleRate, 0);
-        if( err < 0 )
+        Result StartWhenReady(Device* device)
         {
-            result = Result(false, "Cannot set sample rate %s", snd_strerror(err));
-            return result;
-        }
+            const uint32_t REQUIRED_BUFFERS = 5;
+            Result result;
+
+            HRESULT hr;
+        
+            auto ready = [device]() {
+                XAUDIO2_VOICE_STATE state;
+                device->sourceVoice->GetState(&state, 0);
+                return state.BuffersQueued >= REQUIRED_BUFFERS;
+            };
+
+            while (!ready())
+            {
+                eventcount::Wait(&device->written, ready, startWaitTimeMs);
+            }
+    
+
+            if (FAILED(hr = device->sourceVoice->Start()))
+            {
+                return Result(false, "Start failed. Error: %s", std::system_category().message(hr).c_str());
+            }
         
-        err = snd_pcm_hw_params_set_channels(device->playbackHandle, hwParams, channels);
-        if( err < 0 )
-        {
-            result = Result(false, "Cannot set channel count %s", snd_strerror(err));
             return result;
         }
 
-        err = snd_pcm_hw_params(device->playbackHandle, hwParams);
-        if( err < 0 )
+        Result Pause(Device* device)
         {
-            result = Result(false, "Cannot set parameters %s", snd_strerror(err));
+            Result result;
+            HRESULT hr;
+            if (FAILED(hr = device->sourceVoice->Stop()))
+            {
+                return Result(false, "Stop failed. Error: %s", std::system_category().message(hr).c_str());
+            }
             return result;
         }
 
-        snd_pcm_hw_params_free(hwParams);
-
-        err = snd_pcm_prepare(device->playbackHandle);
-        if( err < 0 )
+        Result Resume(Device* device)
         {
-            result = Result(false, "Cannot prepare audio interface for use %s", snd_strerror(err));
+            Result result;
+            HRESULT hr;
+            if (FAILED(hr = device->sourceVoice->Start()))
+            {
+                return Result(false, "Start failed. Error: %s", std::system_category().message(hr).c_str());
+            }
             return result;
         }
 
-        err = snd_pcm_hw_params_can_pause(hwParams);
-        if( err != 1 ) // can pause
+        Result Flush(Device* device)
         {
-            result = Result(false, "Cannot prepare audio interface for use since it cannot pause.");
+            if (!device->sourceVoice)
+            {
+                return Result(false, "audiodevice::Drop Cannot drop sinnce audio is not configure yet.");
+            }
+
+            Result result;
+            HRESULT hr;
+            if (FAILED(hr = device->sourceVoice->FlushSourceBuffers()))
+            {
+                return Result(false, "FlushSourceBuffers failed. Error: %s", std::system_category().message(hr).c_str());
+            }
+
+            XAUDIO2_VOICE_STATE state;
+            device->sourceVoice->GetState(&state, 0);
+            device->samplesPlayedAtFlush = state.SamplesPlayed;
+            device->framesWritten = 0;
+
             return result;
         }
 
-        return result;
+        Result GetDelay(Device* device, uint64_t& frames)
+        {
+            frames = 0;
+            if (!device->sourceVoice)
+            {
+                return Result(false, "Audio is not configured yet.");
+            }
 
-    }
+            // samples played are counted since the voice was created
+            XAUDIO2_VOICE_STATE state;
+            device->sourceVoice->GetState(&state, 0);
+            const uint64_t played = state.SamplesPlayed - device->samplesPlayedAtFlush;
+            frames = device->framesWritten > played ? device->framesWritten - played : 0;
+            return Result(true);
+        }
 
-    Result StartWhenReady(Device* device)
-    {
-        Result result;
-        while( snd_pcm_state(device->playbackHandle) != SND_PCM_STATE_RUNNING )
+        void Close(Device* device)
         {
-            std::this_thread::yield();
+            device->xaudioHandle->Release();
+            delete device->voiceCallbacks;
         }
-        return result;
+#endif
     }
 
-    Result WriteInterleaved(Device* device, void* buf, uint32_t frames, std::atomic<bool>& bufferInUse)
-    {
-        Result result;
 
-        assert(device);
-        if(!device)
+    // null & wav sinks, a simulated device consuming samples at the sample rate
+    namespace sink
+    {
+        // lock held
+        uint64_t GetConsumedFrames(Device* device, uint64_t nowUs)
         {
-            return Result(false, "Invalid audiodevice");
+            uint64_t consumed = device->sinkConsumedFrames;
+            if( device->sinkStartTimeUs != 0 )
+            {
+                consumed += (nowUs - device->sinkStartTimeUs) * device->sampleRate / 1000000;
+            }
+            return std::min(consumed, device->sinkStats.framesWritten);
         }
-        bufferInUse = false;
 
-        snd_pcm_sframes_t written = snd_pcm_writei(device->playbackHandle, buf, frames);
-        if( written < 0 )
+        void CloseWav(Device* device)
         {
-            snd_pcm_prepare(device->playbackHandle);
-            result = Result(false, "Audio write failed %s", snd_strerror(written));
+            if( device->wavFile.is_open() )
+            {
+                device->wavFile.seekp(0);
+                WriteWavHeader(device->wavFile, device->channels, device->sampleRate, device->sampleFormat, device->wavDataBytes);
+                device->wavFile.close();
+                logger::Info("Wav sink wrote %lu bytes to %s", device->wavDataBytes, wavPath.c_str());
+            }
         }
-        return result;
-    }
 
-    Result Flush(Device* device)
-    {
-        Result result;
+        Result Open(Device* device)
+        {
+            logger::Info("Audio %s sink", device->backend == BACKEND_WAV ? "wav" : "null");
+            return Result(true);
+        }
 
-        assert(device);
-        if(!device)
+        void Close(Device* device)
         {
-            result = Result(false, "Invalid audiodevice");
+            CloseWav(device);
         }
 
-        int err = snd_pcm_drop(device->playbackHandle);
-        if( err < 0 )
+        // any format is accepted as is
+        Result SetInputFormat(Device* device, uint32_t& channels, uint32_t& sampleRate, SampleFormat& sampleFormat)
         {
-            result = Result(false, "Cannot prepare audio interface for use %s", snd_strerror(err));
-            return result;
+            if( GetSampleBits(sampleFormat) == 0 || channels == 0 || sampleRate == 0 )
+            {
+                return Result(false, "Invalid sink format %d channels %d Hz sample format %d", channels, sampleRate, sampleFormat);
+            }
+
+            std::scoped_lock<std::mutex> lock(device->sinkMutex);
+
+            CloseWav(device);
+
+            device->channels = channels;
+            device->sampleRate = sampleRate;
+            device->sampleFormat = sampleFormat;
+            device->frameBytes = channels * GetSampleBits(sampleFormat) / 8;
+
+            if( device->backend == BACKEND_WAV )
+            {
+                device->wavFile.open(wavPath, std::ios::binary | std::ios::trunc | std::ios::out);
+                if( !device->wavFile )
+                {
+                    return Result(false, "Cannot open wav file %s", wavPath.c_str());
+                }
+                device->wavDataBytes = 0;
+                WriteWavHeader(device->wavFile, channels, sampleRate, sampleFormat, 0);
+            }
+
+            logger::Info("Audio sink format %d channels %d Hz sample format %d", channels, sampleRate, sampleFormat);
+            return Result(true);
         }
 
-        err = snd_pcm_prepare(device->playbackHandle);
-        if( err < 0 )
+        Result StartWhenReady(Device* device)
         {
-            result = Result(false, "Cannot prepare audio interface for use %s", snd_strerror(err));
-            return result;
+            auto started = [device]() {
+                std::scoped_lock<std::mutex> lock(device->sinkMutex);
+                return device->sinkStartTimeUs != 0 || device->sinkPaused;
+            };
+
+            while( !started() )
+            {
+                eventcount::Wait(&device->written, started, startWaitTimeMs);
+            }
+            return Result(true);
         }
-        return result;
-    }
 
-    Result Pause(Device* device)
-    {
-        Result result;
+        // blocks while the simulated buffer is full, like a blocking pcm write
+        Result WriteInterleaved(Device* device, void* buf, uint32_t frames, std::atomic<bool>& bufferInUse)
+        {
+            const uint64_t bufferFrames = SINK_BUFFER_US * device->sampleRate / 1000000;
 
-        assert(device);
-        if(!device)
+            std::unique_lock<std::mutex> lock(device->sinkMutex);
+            const uint64_t flushes = device->sinkFlushes;
+            uint64_t nowUs = chrono::Now();
+
+            // drained while running, the device restarts on this write
+            if( device->sinkStartTimeUs != 0 && GetConsumedFrames(device, nowUs) == device->sinkStats.framesWritten )
+            {
+                device->sinkStats.underruns++;
+                device->sinkConsumedFrames = device->sinkStats.framesWritten;
+                device->sinkStartTimeUs = nowUs;
+            }
+
+            if( device->wavFile.is_open() )
+            {
+                const uint64_t bytes = static_cast<uint64_t>(frames) * device->frameBytes;
+                device->wavFile.write(reinterpret_cast<const char*>(buf), bytes);
+                device->wavDataBytes += bytes;
+            }
+            bufferInUse = false;
+
+            device->sinkStats.framesWritten += frames;
+            if( device->sinkStartTimeUs == 0 && !device->sinkPaused )
+            {
+                device->sinkStartTimeUs = nowUs;
+            }
+
+            // the start waiter takes the sink lock in its condition
+            lock.unlock();
+            eventcount::Notify(&device->written);
+            lock.lock();
+            nowUs = chrono::Now();
+
+            for(;;)
+            {
+                const uint64_t queued = device->sinkStats.framesWritten - GetConsumedFrames(device, nowUs);
+                if( queued <= bufferFrames || device->sinkFlushes != flushes || device->interrupted )
+                {
+                    break;
+                }
+
+                // nothing is consumed while paused, the interruption is checked every wait
+                const uint64_t waitUs = std::clamp<uint64_t>((queued - bufferFrames) * 1000000 / device->sampleRate, 1000, sinkWaitTimeMs * 1000);
+                lock.unlock();
+                chrono::Sleep(waitUs);
+                lock.lock();
+                nowUs = chrono::Now();
+            }
+            return Result(true);
+        }
+
+        Result Write(Device* device, uint32_t frames, const FillCallback& fill)
         {
-            result = Result(false, "Invalid audiodevice");
+            device->scratch.resize(static_cast<size_t>(frames) * device->frameBytes);
+            fill(device->scratch.data(), 0, frames);
+
+            std::atomic<bool> scratchInUse = false;
+            return sink::WriteInterleaved(device, device->scratch.data(), frames, scratchInUse);
         }
 
-        int err = snd_pcm_pause(device->playbackHandle,1);
-        if( err < 0 )
+        // queued samples are dropped
+        Result Flush(Device* device)
         {
-            result = Result(false, "Cannot prepare audio interface for use %s", snd_strerror(err));
-            return result;
+            std::scoped_lock<std::mutex> lock(device->sinkMutex);
+            device->sinkConsumedFrames = device->sinkStats.framesWritten;
+            device->sinkStartTimeUs = 0;
+            device->sinkPaused = false;
+            device->sinkFlushes++;
+            return Result(true);
         }
-        return result;
-    }
 
-    Result Resume(Device* device)
-    {
-        Result result;
+        Result GetDelay(Device* device, uint64_t& frames)
+        {
+            std::scoped_lock<std::mutex> lock(device->sinkMutex);
+            frames = device->sinkStats.framesWritten - GetConsumedFrames(device, chrono::Now());
+            return Result(true);
+        }
 
-        assert(device);
-        if(!device)
+        Result Pause(Device* device)
         {
-            result = Result(false, "Invalid audiodevice");
+            std::scoped_lock<std::mutex> lock(device->sinkMutex);
+            device->sinkConsumedFrames = GetConsumedFrames(device, chrono::Now());
+            device->sinkStartTimeUs = 0;
+            device->sinkPaused = true;
+            return Result(true);
         }
 
-        int err = snd_pcm_pause(device->playbackHandle,0);
-        if( err < 0 )
+        Result Resume(Device* device)
         {
-            result = Result(false, "Cannot prepare audio interface for use %s", snd_strerror(err));
-            return result;
+            std::scoped_lock<std::mutex> lock(device->sinkMutex);
+            device->sinkPaused = false;
+            if( device->sinkStats.framesWritten > device->sinkConsumedFrames )
+            {
+                device->sinkStartTimeUs = chrono::Now();
+            }
+            return Result(true);
         }
-        return result;
     }
 
-#endif
+    void SetBackend(Backend b)
+    {
+        backend = b;
+    }
 
-#ifdef WIN32
-    class Audio2VoiceCallback : public IXAudio2VoiceCallback
+    void SetWavPath(const std::string& path)
     {
-    public:
-        Audio2VoiceCallback() {}
-        ~Audio2VoiceCallback() {}
+        wavPath = path;
+    }
 
-        //Called when the voice has just finished playing a contiguous audio stream.
-        void OnStreamEnd() { }
-        void OnVoiceProcessingPassEnd() { }
-        void OnVoiceProcessingPassStart(UINT32 SamplesRequired) { }
-        
-        void OnBufferEnd(void* pBufferContext) 
-        {
-            std::atomic<bool>* bufferInUse = reinterpret_cast<std::atomic<bool>*>(pBufferContext);
-            *bufferInUse = false;
-        }
+    void SetMmap(bool enable)
+    {
+        mmapEnabled = enable;
+    }
 
-        void OnBufferStart(void* pBufferContext) {    }
-        void OnLoopEnd(void* pBufferContext) {    }
-        void OnVoiceError(void* pBufferContext, HRESULT Error) { }
-    };
+    bool GetMmap(Device* device)
+    {
+        return device && device->mmap;
+    }
 
-    Result Create(Device*& device)
+    void SetLatency(uint32_t latencyMs)
+    {
+        latencyUs = latencyMs * 1000;
+    }
+
+    void SetPcmName(const std::string& name)
     {
-        Result result;
+        pcmName = name;
+    }
 
-        HRESULT hr;
-        if (FAILED(hr = CoInitialize(nullptr)))
+    Backend GetBackendFromString(const std::string& name)
+    {
+        if( name == "default" )
         {
-            return Result(false, "CoInitialize failed. Error: %s", std::system_category().message(hr).c_str());
+            return BACKEND_HARDWARE;
         }
+        else if( name == "null" )
+        {
+            return BACKEND_NULL;
+        }
+        else if( name == "wav" )
+        {
+            return BACKEND_WAV;
+        }
+        return BACKEND_INVALID;
+    }
 
+    Result Create(Device*& device)
+    {
         device = new Device();
-        memset(device, 0, sizeof(Device));
+        device->backend = backend;
 
-        if (FAILED(hr = XAudio2Create(&device->xaudioHandle, 0, XAUDIO2_DEFAULT_PROCESSOR)))
+        if( device->backend == BACKEND_HARDWARE )
         {
-            return Result(false, "XAudio2Create failed. Error: %s", std::system_category().message(hr).c_str());
+            return hardware::Open(device);
         }
-
-        return result;
+        return sink::Open(device);
     }
 
-    Result SetInputFormat(Device* device, uint32_t channels, uint32_t sampleRate, SampleFormat sampleFormat)
+    void Destroy(Device*& device)
     {
-        Result result;
-
-        HRESULT hr;
-        if (FAILED(hr = device->xaudioHandle->CreateMasteringVoice(&device->masterVoice, channels, sampleRate, 0, 0, 0)))
+        if(!device)
         {
-            return Result(false, "CreateMasteringVoice failed. Error: %s", std::system_category().message(hr).c_str());
+            return;
         }
 
-        WAVEFORMATEX& wfx = device->wfx;
-        wfx.nChannels = channels;
-        wfx.nSamplesPerSec = sampleRate;
-
-        switch (sampleFormat)
+        if( device->backend == BACKEND_HARDWARE )
         {
-        case SF_FMT_U8:
-            wfx.wBitsPerSample = 8;
-            wfx.wFormatTag = WAVE_FORMAT_PCM;
-            break;
-        case SF_FMT_S16:
-            wfx.wBitsPerSample = 16;
-            wfx.wFormatTag = WAVE_FORMAT_PCM;
-            break;
-        case SF_FMT_S32:
-            wfx.wBitsPerSample = 32;
-            wfx.wFormatTag = WAVE_FORMAT_PCM;
-            break;
-        case SF_FMT_FLOAT:
-            wfx.wBitsPerSample = 32;
-            wfx.wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
-            break;
-        case SF_FMT_DOUBLE:
-            wfx.wBitsPerSample = 64;        
-            wfx.wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
-            break;
-        case SF_FMT_INVALID:
-            return Result(false, "Invalid Sample Format.");
+            hardware::Close(device);
         }
-
-        wfx.nBlockAlign = wfx.nChannels * (wfx.wBitsPerSample / 8);
-        wfx.nAvgBytesPerSec = wfx.nSamplesPerSec * wfx.nBlockAlign;
-        wfx.cbSize = 0;
-
-        device->voiceCallbacks = new Audio2VoiceCallback();
-
-        if (FAILED(hr = device->xaudioHandle->CreateSourceVoice(&device->sourceVoice, (WAVEFORMATEX*)&wfx, 0, 2.0f, device->voiceCallbacks)))
+        else
         {
-            return Result(false, "CreateSourceVoice failed. Error: %s", std::system_category().message(hr).c_str());
+            sink::Close(device);
         }
 
-        return result;
+        delete device;
+        device = nullptr;
     }
 
-    Result WriteInterleaved(Device* device, void* buf, uint32_t nbSamples, std::atomic<bool>& bufferInUse)
+    Result SetInputFormat(Device* device, uint32_t& channels, uint32_t& sampleRate, SampleFormat& sampleFormat)
     {
-        const uint32_t sleepTimeOnErrorMMS = 100;
-        Result result;
-        
-        const WAVEFORMATEX& wfx = device->wfx;
-        XAUDIO2_BUFFER buffer;
-        memset(&buffer, 0, sizeof(XAUDIO2_BUFFER));
-        
-        buffer.AudioBytes = nbSamples * wfx.nChannels * wfx.wBitsPerSample / 8;
-        buffer.pAudioData = reinterpret_cast<BYTE*>(buf);
-        buffer.pContext = &bufferInUse;
-
-        bufferInUse = true;
-
-        HRESULT hr;
-
-        do
+        assert(device);
+        if(!device)
         {
-            if (FAILED(hr = device->sourceVoice->SubmitSourceBuffer(&buffer)) && hr != XAUDIO2_E_INVALID_CALL)
-            {
-                return Result(false, "SubmitSourceBuffer failed. Error: %s", std::system_category().message(hr).c_str());
-            }
-
-            if (FAILED(hr))
-            {
-                std::this_thread::sleep_for(std::chrono::milliseconds(sleepTimeOnErrorMMS));
-            }
+            return Result(false, "Invalid audiodevice");
+        }
 
-        } while (hr == XAUDIO2_E_INVALID_CALL);
+        if( device->backend == BACKEND_HARDWARE )
+        {
+            return hardware::SetInputFormat(device, channels, sampleRate, sampleFormat);
+        }
+        return sink::SetInputFormat(device, channels, sampleRate, sampleFormat);
+    }
 
+    Result WriteInterleaved(Device* device, void* buf, uint32_t frames, std::atomic<bool>& bufferInUse)
+    {
+        if( device->backend == BACKEND_HARDWARE )
+        {
+            return hardware::WriteInterleaved(device, buf, frames, bufferInUse);
+        }
+        return sink::WriteInterleaved(device, buf, frames, bufferInUse);
+    }
 
-        return result;
+    Result Write(Device* device, uint32_t frames, const FillCallback& fill)
+    {
+        if( device->backend == BACKEND_HARDWARE )
+        {
+            return hardware::Write(device, frames, fill);
+        }
+        return sink::Write(device, frames, fill);
     }
 
     Result StartWhenReady(Device* device)
     {
-        const uint32_t REQUIRED_BUFFERS = 5;
-        Result result;
-
-        HRESULT hr;
-        
-        XAUDIO2_VOICE_STATE state;
-
-        do
+        if( device->backend == BACKEND_HARDWARE )
         {
-            device->sourceVoice->GetState(&state, 0);
-
-        } while (state.BuffersQueued < REQUIRED_BUFFERS);
-    
+            return hardware::StartWhenReady(device);
+        }
+        return sink::StartWhenReady(device);
+    }
 
-        if (FAILED(hr = device->sourceVoice->Start()))
+    Result Start(Device* device)
+    {
+#ifdef HAVE_ALSA
+        if( device->backend == BACKEND_HARDWARE )
         {
-            return Result(false, "Start failed. Error: %s", std::system_category().message(hr).c_str());
+            return hardware::Start(device);
         }
-        
-        return result;
+#endif
+        // sinks start on the first write, XAudio2 voices once buffers are queued
+        return Result(true);
     }
 
     Result Pause(Device* device)
     {
-        Result result;
-        HRESULT hr;
-        if (FAILED(hr = device->sourceVoice->Stop()))
+        if( device->backend == BACKEND_HARDWARE )
         {
-            return Result(false, "Stop failed. Error: %s", std::system_category().message(hr).c_str());
+            return hardware::Pause(device);
         }
-        return result;
+        return sink::Pause(device);
     }
 
     Result Resume(Device* device)
     {
-        Result result;
-        HRESULT hr;
-        if (FAILED(hr = device->sourceVoice->Start()))
+        if( device->backend == BACKEND_HARDWARE )
         {
-            return Result(false, "Start failed. Error: %s", std::system_category().message(hr).c_str());
+            return hardware::Resume(device);
         }
-        return result;
+        return sink::Resume(device);
     }
 
     Result Flush(Device* device)
     {
-        if (!device->sourceVoice)
+        if( device->backend == BACKEND_HARDWARE )
         {
-            return Result(false, "audiodevice::Drop Cannot drop sinnce audio is not configure yet.");
+            return hardware::Flush(device);
         }
+        return sink::Flush(device);
+    }
 
-        Result result;
-        HRESULT hr;
-        if (FAILED(hr = device->sourceVoice->FlushSourceBuffers()))
+    void Interrupt(Device* device, bool interrupted)
+    {
+        device->interrupted = interrupted;
+#ifdef HAVE_ALSA
+        if( device->backend == BACKEND_HARDWARE )
         {
-            return Result(false, "FlushSourceBuffers failed. Error: %s", std::system_category().message(hr).c_str());
+            hardware::Interrupt(device, interrupted);
         }
-
-        return result;
+#endif
     }
 
-    void Destroy(Device*& device)
+    Result GetDelay(Device* device, uint64_t& frames)
     {
-        if (device)
+        if( device->backend == BACKEND_HARDWARE )
         {
-            device->xaudioHandle->Release();
-            delete device->voiceCallbacks;
+            return hardware::GetDelay(device, frames);
+        }
+        return sink::GetDelay(device, frames);
+    }
 
-            delete device;
-            device = nullptr;
+    uint64_t GetLatency(Device* device)
+    {
+        if( device->backend != BACKEND_HARDWARE )
+        {
+            return SINK_BUFFER_US;
         }
+        return device->sampleRate != 0 ? device->bufferFrames * 1000000 / device->sampleRate : 0;
     }
-#endif
 
+    bool GetSinkStats(Device* device, SinkStats& stats)
+    {
+        if( !device || device->backend == BACKEND_HARDWARE )
+        {
+            return false;
+        }
+
+        std::scoped_lock<std::mutex> lock(device->sinkMutex);
+        stats = device->sinkStats;
+        stats.framesConsumed = sink::GetConsumedFrames(device, chrono::Now());
+        return true;
+    }
 }
 
@@ -10,8 +10,14 @@
 
 #include "result.h"
 #include "mediaformat.h"
+#include "eventcount.h"
 
+#include <mutex>
 #include <atomic>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <functional>
 
 
 namespace audiodevice
@@ -22,35 +28,150 @@ namespace audiodevice
 
     static const int64_t ENQUEUE_SAMPLES_US = 10000000;
 
+    // low latency buffer split, the writer wakes once per period
+    static const uint32_t LOW_LATENCY_PERIODS = 4;
+
+    // sink backends consume samples at the sample rate like a device with a buffer of this duration
+    static const uint64_t SINK_BUFFER_US = 250000;
+
+    enum Backend
+    {
+        BACKEND_HARDWARE,
+        BACKEND_NULL,
+        BACKEND_WAV,
+        BACKEND_INVALID
+    };
+
+    struct SinkStats
+    {
+        uint64_t framesWritten = 0;
+        uint64_t framesConsumed = 0;
+        uint32_t underruns = 0;
+    };
+
+    // what the hardware below a plug device plays without conversion
+    struct NativeFormats
+    {
+        bool probed = false;
+        std::vector<SampleFormat> sampleFormats;
+        std::vector<uint32_t> sampleRates;
+        uint32_t maxChannels = 0;
+    };
+
+    // write output frames [offset, offset + frames) of a source to output, interleaved in the device format
+    typedef std::function<void(uint8_t* output, uint32_t offset, uint32_t frames)> FillCallback;
+
     struct Device
     {
+        Backend backend = BACKEND_HARDWARE;
+
+        // sink backends, playback starts on the first write
+        std::mutex sinkMutex;
+        uint64_t sinkStartTimeUs = 0;
+        uint64_t sinkConsumedFrames = 0;
+        uint64_t sinkFlushes = 0;
+        bool sinkPaused = false;
+        SinkStats sinkStats;
+
+        // wav sink file, sizes are written on close
+        std::ofstream wavFile;
+        uint64_t wavDataBytes = 0;
+        uint32_t frameBytes = 0;
+
+        // notified after each write, a start waits on it instead of polling the device state
+        eventcount::EventCount written;
+
+        // a stopping writer must not wait for room, a paused device never makes any
+        std::atomic<bool> interrupted = false;
+
 #ifdef HAVE_ALSA
+        // non blocking handle, a full buffer is waited on with poll
         snd_pcm_t* playbackHandle = nullptr;
+        std::vector<struct pollfd> pollDescriptors;
+
+        // eventfd polled after the device descriptors, signaled by an interrupt
+        int wakeFd = -1;
+
+        // a plug device accepts any format, the negotiation is narrowed to the hardware formats
+        NativeFormats nativeFormats;
 #endif
 
+        // negotiated input format
+        uint32_t channels = 0;
+        uint32_t sampleRate = 0;
+        SampleFormat sampleFormat = SF_FMT_INVALID;
+
+        // negotiated hardware buffering
+        uint64_t periodFrames = 0;
+        uint64_t bufferFrames = 0;
+        uint64_t startFrames = 0;
+
+        // mmap access, frames are filled in the ring buffer
+        bool mmap = false;
+        std::vector<uint8_t> scratch;
+
 #ifdef WIN32
         IXAudio2* xaudioHandle = nullptr;
         IXAudio2MasteringVoice* masterVoice = nullptr;
         IXAudio2SourceVoice* sourceVoice = nullptr;
+        uint64_t framesWritten = 0;
+        uint64_t samplesPlayedAtFlush = 0;
         WAVEFORMATEX wfx;
         Audio2VoiceCallback* voiceCallbacks = nullptr;
 #endif
     };
 
+    // backend of the next created device, the wav sink writes to path
+    void    SetBackend(Backend);
+    void    SetWavPath(const std::string& path);
+
+    // ALSA buffer of latencyMs in explicit periods on a hw: device, 0 keeps the default device buffering.
+    // name overrides the pcm, e.g. hw:0,0 or plughw:0,0
+    void    SetLatency(uint32_t latencyMs);
+    void    SetPcmName(const std::string& name);
+
+    // ALSA mmap interleaved access when the device supports it
+    void    SetMmap(bool enable);
+    bool    GetMmap(Device* device);
+    Backend GetBackendFromString(const std::string&);
+
     Result Create(Device*& device);
     void   Destroy(Device*& device);
 
-    Result SetInputFormat(Device* device, uint32_t channels, uint32_t sampleRate, SampleFormat sampleFormat);
+    // Set the requested input format. channels, sampleRate and sampleFormat
+    // are updated to the format the device negotiated.
+    Result SetInputFormat(Device* device, uint32_t& channels, uint32_t& sampleRate, SampleFormat& sampleFormat);
 
+    // blocks until all frames are queued, sleeping while the device buffer is full
     Result WriteInterleaved(Device* device, void* buf, uint32_t frames, std::atomic<bool>& bufferInUse);
     
+    // Write frames produced by fill straight into the device ring buffer with mmap access,
+    // through a scratch buffer otherwise. Not supported by XAudio2.
+    Result Write(Device* device, uint32_t frames, const FillCallback& fill);
+
+    // blocks until the device started playing the frames written by another thread
     Result StartWhenReady(Device* device);
 
+    // start playing the frames written so far below the start threshold, at end of stream
+    Result Start(Device* device);
+
     Result Pause(Device* device);
     Result Resume(Device* device);
 
     Result Flush(Device* device);
 
+    // while interrupted, writes return without waiting for room and a blocked write returns at once
+    void   Interrupt(Device* device, bool interrupted);
+
+    // frames written and not played yet
+    Result GetDelay(Device* device, uint64_t& frames);
+
+    // duration of the negotiated device buffer
+    uint64_t GetLatency(Device* device);
+
+    // consumption stats of a sink backend, false for hardware devices
+    bool   GetSinkStats(Device* device, SinkStats& stats);
+
 }
 
 
@@ -0,0 +1,143 @@
+#include "precomp.h"
+#include "avsync.h"
+#include "logger.h"
+#include "chrono.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+    // lock held
+    bool GetAudioTimeLocked(avsync::Clock& clock, uint64_t nowUs, uint64_t& timeUs)
+    {
+        if( !clock.started || clock.sampleRate == 0 )
+        {
+            return false;
+        }
+
+        // the device keeps playing since the report, up to what was written
+        const uint64_t elapsedUs = nowUs > clock.reportTimeUs && !clock.paused ? nowUs - clock.reportTimeUs : 0;
+        timeUs = std::min(clock.playedTimeUs + elapsedUs, clock.endTimeUs);
+        return true;
+    }
+}
+
+namespace avsync
+{
+    void Reset(Clock& clock, uint32_t sampleRate)
+    {
+        std::scoped_lock<std::mutex> lock(clock.mutex);
+        clock.sampleRate = sampleRate;
+        clock.started = false;
+        clock.baseTimeUs = 0;
+        clock.endTimeUs = 0;
+        clock.playedTimeUs = 0;
+        clock.reportTimeUs = 0;
+        clock.writtenFrames = 0;
+        clock.playing = false;
+        clock.paused = false;
+    }
+
+    void Pause(Clock& clock, uint64_t nowUs)
+    {
+        std::scoped_lock<std::mutex> lock(clock.mutex);
+
+        uint64_t timeUs = 0;
+        if( GetAudioTimeLocked(clock, nowUs, timeUs) )
+        {
+            clock.playedTimeUs = timeUs;
+        }
+        clock.reportTimeUs = nowUs;
+        clock.paused = true;
+    }
+
+    void Resume(Clock& clock, uint64_t nowUs)
+    {
+        std::scoped_lock<std::mutex> lock(clock.mutex);
+        clock.reportTimeUs = nowUs;
+        clock.paused = false;
+    }
+
+    void OnAudioWritten(Clock& clock, uint64_t frameTimeUs, uint32_t frames, uint64_t delayFrames, uint64_t nowUs)
+    {
+        std::scoped_lock<std::mutex> lock(clock.mutex);
+        if( !clock.started )
+        {
+            clock.started = true;
+            clock.baseTimeUs = frameTimeUs;
+        }
+
+        if( clock.sampleRate == 0 )
+        {
+            return;
+        }
+
+        clock.endTimeUs = frameTimeUs + static_cast<uint64_t>(frames) * 1000000 / clock.sampleRate;
+        const uint64_t delayUs = delayFrames * 1000000 / clock.sampleRate;
+        clock.playedTimeUs = clock.endTimeUs > delayUs ? clock.endTimeUs - delayUs : 0;
+        clock.reportTimeUs = nowUs;
+
+        clock.writtenFrames += frames;
+        clock.playing = clock.playing || delayFrames < clock.writtenFrames;
+    }
+
+    bool GetAudioTime(Clock& clock, uint64_t nowUs, uint64_t& timeUs)
+    {
+        std::scoped_lock<std::mutex> lock(clock.mutex);
+        return GetAudioTimeLocked(clock, nowUs, timeUs);
+    }
+
+    void Update(Clock& clock, std::atomic<uint64_t>& playbackStartTimeUs, uint64_t nowUs)
+    {
+        std::scoped_lock<std::mutex> lock(clock.mutex);
+
+        uint64_t audioTimeUs = 0;
+        if( !GetAudioTimeLocked(clock, nowUs, audioTimeUs) || !clock.playing )
+        {
+            return;
+        }
+
+        const int64_t videoTimeUs = static_cast<int64_t>(nowUs) - static_cast<int64_t>(playbackStartTimeUs.load());
+        const int64_t offsetUs = static_cast<int64_t>(audioTimeUs) - videoTimeUs;
+
+        Stats& stats = clock.stats;
+        stats.offsetUs = offsetUs;
+        stats.minOffsetUs = stats.updates == 0 ? offsetUs : std::min(stats.minOffsetUs, offsetUs);
+        stats.maxOffsetUs = stats.updates == 0 ? offsetUs : std::max(stats.maxOffsetUs, offsetUs);
+        stats.absOffsetSumUs += static_cast<double>(std::abs(offsetUs));
+        stats.updates++;
+        profiler::Set(profiler::GAUGE_AV_OFFSET, static_cast<uint64_t>(std::abs(offsetUs)));
+
+        // audio ahead moves the presentation clock forward, the start time back
+        if( std::abs(offsetUs) >= RESYNC_THRESHOLD_US )
+        {
+            logger::Info("A/V resync, audio clock offset %f ms", chrono::Milliseconds(offsetUs));
+            playbackStartTimeUs -= offsetUs;
+            stats.resyncs++;
+        }
+        else if( std::abs(offsetUs) >= SYNC_THRESHOLD_US )
+        {
+            playbackStartTimeUs -= static_cast<int64_t>(static_cast<double>(offsetUs) * SLEW_RATE);
+            stats.slews++;
+        }
+    }
+
+    void OnFrameDropped(Clock& clock)
+    {
+        std::scoped_lock<std::mutex> lock(clock.mutex);
+        clock.stats.droppedFrames++;
+    }
+
+    void OnFrameRepeated(Clock& clock, uint64_t frames)
+    {
+        std::scoped_lock<std::mutex> lock(clock.mutex);
+        clock.stats.repeatedFrames += frames;
+    }
+
+    void GetStats(Clock& clock, Stats& stats)
+    {
+        std::scoped_lock<std::mutex> lock(clock.mutex);
+        stats = clock.stats;
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+
+namespace avsync
+{
+    // audio position is known to a period, smaller offsets are left alone
+    static const int64_t SYNC_THRESHOLD_US = 15000;
+
+    // offsets larger than this are corrected at once, after a pause or an underrun
+    static const int64_t RESYNC_THRESHOLD_US = 200000;
+
+    // fraction of the offset corrected per presented frame, video pacing stays smooth
+    static const double SLEW_RATE = 0.1;
+
+    struct Stats
+    {
+        // audio clock minus presentation clock
+        int64_t  offsetUs = 0;
+        int64_t  minOffsetUs = 0;
+        int64_t  maxOffsetUs = 0;
+        double   absOffsetSumUs = 0.0;
+        uint64_t updates = 0;
+
+        uint64_t slews = 0;
+        uint64_t resyncs = 0;
+
+        // drift corrected on the video side
+        uint64_t droppedFrames = 0;
+        uint64_t repeatedFrames = 0;
+    };
+
+    // Audio master clock.
+    //
+    // The audio thread reports each write with the device delay measured right after it.
+    // The played time is the end of the last written frame minus that delay, so timestamp
+    // gaps and resampler drift do not accumulate. The presentation thread extrapolates
+    // it from the last report.
+    struct Clock
+    {
+        std::mutex mutex;
+        uint32_t sampleRate = 0;
+
+        // media time of the first frame written since the last reset
+        bool started = false;
+        uint64_t baseTimeUs = 0;
+
+        // media time at the end of the last written frame and being played at the report
+        uint64_t endTimeUs = 0;
+        uint64_t playedTimeUs = 0;
+        uint64_t reportTimeUs = 0;
+        bool paused = false;
+
+        // the clock is trusted once the delay no longer covers every frame written since the reset
+        uint64_t writtenFrames = 0;
+        bool playing = false;
+
+        Stats stats;
+    };
+
+    // audio was flushed, position restarts from the next write
+    void Reset(Clock&, uint32_t sampleRate);
+
+    // frames were written with frameTimeUs as media time of the first one, delayFrames are still queued
+    void OnAudioWritten(Clock&, uint64_t frameTimeUs, uint32_t frames, uint64_t delayFrames, uint64_t nowUs);
+
+    // the position does not move while the device is paused
+    void Pause(Clock&, uint64_t nowUs);
+    void Resume(Clock&, uint64_t nowUs);
+
+    // media time being played, false before the first write
+    bool GetAudioTime(Clock&, uint64_t nowUs, uint64_t& timeUs);
+
+    // slave the presentation time base to the audio clock, no effect without audio
+    void Update(Clock&, std::atomic<uint64_t>& playbackStartTimeUs, uint64_t nowUs);
+
+    void OnFrameDropped(Clock&);
+    void OnFrameRepeated(Clock&, uint64_t frames);
+
+    void GetStats(Clock&, Stats&);
+}
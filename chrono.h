@@ -2,16 +2,179 @@
 
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <set>
+#include <condition_variable>
 #include <stdio.h>
 #include <inttypes.h>
 
 namespace chrono
 {
-    // epoch time in us
-    inline uint64_t Now()
+    enum ClockType
+    {
+        CLOCK_REAL,
+        CLOCK_SCALED,
+        CLOCK_VIRTUAL
+    };
+
+    // a virtual clock jumps to the earliest sleeper deadline once the sleepers waited this long
+    // without the clock moving, held clocks wait up to the hold timeout
+    static const uint64_t VIRTUAL_SETTLE_US = 1000;
+    static const uint64_t VIRTUAL_HOLD_TIMEOUT_US = 100000;
+
+    // Clock read by playback timing decisions, real unless --clockspeed or a test harness installs another.
+    // A scaled clock runs scale times faster than real time. A virtual one only moves on Advance
+    // or when every sleeper is idle, playback then runs as fast as the pipeline settles.
+    // Set the clock before playback starts, switching while playing makes time jump.
+    struct ClockSource
+    {
+        std::atomic<ClockType> type = CLOCK_REAL;
+        std::atomic<double> scale = 1.0;
+        std::atomic<uint64_t> originUs = 0;
+        std::atomic<uint64_t> realOriginUs = 0;
+        std::atomic<uint64_t> virtualTimeUs = 0;
+
+        // virtual clock sleepers deadlines and threads waiting on real time work
+        std::multiset<uint64_t> deadlines;
+        uint32_t holds = 0;
+
+        std::mutex mutex;
+        std::condition_variable advanced;
+    };
+
+    inline ClockSource clockSource;
+
+    // monotonic time in us, for costs & latencies that must not follow the clock source
+    inline uint64_t RealNow()
     {
         return std::chrono::duration_cast<std::chrono::microseconds>(
-                                   std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+                                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // clock source time in us
+    inline uint64_t Now()
+    {
+        switch(clockSource.type.load())
+        {
+            case CLOCK_SCALED:
+                return clockSource.originUs + static_cast<uint64_t>(static_cast<double>(RealNow() - clockSource.realOriginUs) * clockSource.scale);
+            case CLOCK_VIRTUAL:
+                return clockSource.virtualTimeUs;
+            default:
+                return RealNow();
+        }
+    }
+
+    // clocks start from the current time
+    inline void SetRealClock()
+    {
+        {
+            std::scoped_lock<std::mutex> lock(clockSource.mutex);
+            clockSource.type = CLOCK_REAL;
+        }
+        clockSource.advanced.notify_all();
+    }
+
+    inline void SetScaledClock(double scale)
+    {
+        const uint64_t nowUs = Now();
+        {
+            std::scoped_lock<std::mutex> lock(clockSource.mutex);
+            clockSource.realOriginUs = RealNow();
+            clockSource.originUs = nowUs;
+            clockSource.scale = scale;
+            clockSource.type = CLOCK_SCALED;
+        }
+        clockSource.advanced.notify_all();
+    }
+
+    inline void SetVirtualClock()
+    {
+        const uint64_t nowUs = Now();
+        std::scoped_lock<std::mutex> lock(clockSource.mutex);
+        clockSource.virtualTimeUs = nowUs;
+        clockSource.type = CLOCK_VIRTUAL;
+    }
+
+    inline bool IsVirtualClock()
+    {
+        return clockSource.type == CLOCK_VIRTUAL;
+    }
+
+    // move the virtual clock forward and wake the threads sleeping up to the new time
+    inline void Advance(uint64_t timeUs)
+    {
+        {
+            std::scoped_lock<std::mutex> lock(clockSource.mutex);
+            clockSource.virtualTimeUs += timeUs;
+        }
+        clockSource.advanced.notify_all();
+    }
+
+    // Keeps a virtual clock still while the holder waits for work done in real time, like
+    // decoding the next frame. Without it time would run ahead of the decoder.
+    struct HoldClock
+    {
+        HoldClock()
+        {
+            std::scoped_lock<std::mutex> lock(clockSource.mutex);
+            clockSource.holds++;
+        }
+
+        ~HoldClock()
+        {
+            {
+                std::scoped_lock<std::mutex> lock(clockSource.mutex);
+                clockSource.holds--;
+            }
+            clockSource.advanced.notify_all();
+        }
+    };
+
+    // sleep for a clock source duration
+    inline void Sleep(uint64_t timeUs)
+    {
+        if( clockSource.type == CLOCK_VIRTUAL )
+        {
+            std::unique_lock<std::mutex> lock(clockSource.mutex);
+            const uint64_t deadlineUs = clockSource.virtualTimeUs + timeUs;
+            const auto deadline = clockSource.deadlines.insert(deadlineUs);
+
+            uint64_t lastTimeUs = clockSource.virtualTimeUs;
+            uint64_t idleStartUs = RealNow();
+            while( clockSource.virtualTimeUs < deadlineUs && clockSource.type == CLOCK_VIRTUAL )
+            {
+                clockSource.advanced.wait_for(lock, std::chrono::microseconds(VIRTUAL_SETTLE_US));
+                if( clockSource.virtualTimeUs != lastTimeUs )
+                {
+                    lastTimeUs = clockSource.virtualTimeUs;
+                    idleStartUs = RealNow();
+                    continue;
+                }
+
+                // the earliest sleeper moves the clock, the others are woken by it
+                const uint64_t idleUs = RealNow() - idleStartUs;
+                const bool settled = idleUs >= VIRTUAL_SETTLE_US && (clockSource.holds == 0 || idleUs >= VIRTUAL_HOLD_TIMEOUT_US);
+                if( settled && *clockSource.deadlines.begin() == deadlineUs )
+                {
+                    clockSource.virtualTimeUs = deadlineUs;
+                    lastTimeUs = deadlineUs;
+                    clockSource.advanced.notify_all();
+                }
+            }
+
+            clockSource.deadlines.erase(deadline);
+        }
+        else if( clockSource.type == CLOCK_SCALED )
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(static_cast<uint64_t>(static_cast<double>(timeUs) / clockSource.scale)));
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(timeUs));
+        }
     }
 
     // elapsed time since start
@@ -0,0 +1,229 @@
+#include "precomp.h"
+#include "chunkbuffer.h"
+#include "curl.h"
+#include "chrono.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+    uint8_t* TakeBlock(chunkbuffer::Buffer& buffer)
+    {
+        if( buffer.spares.empty() )
+        {
+            return new uint8_t[chunkbuffer::BLOCK_SIZE];
+        }
+
+        uint8_t* block = buffer.spares.back();
+        buffer.spares.pop_back();
+        return block;
+    }
+
+    void GiveBlock(chunkbuffer::Buffer& buffer, uint8_t* block)
+    {
+        if( buffer.spares.size() < buffer.maxSpares )
+        {
+            buffer.spares.push_back(block);
+        }
+        else
+        {
+            delete [] block;
+        }
+    }
+
+    // unlink the first block once consumed, an emptied buffer restarts at the beginning of its block
+    void PopConsumed(chunkbuffer::Buffer& buffer)
+    {
+        if( buffer.blocks.size() > 1 && buffer.head == chunkbuffer::BLOCK_SIZE )
+        {
+            GiveBlock(buffer, buffer.blocks.front());
+            buffer.blocks.pop_front();
+            buffer.head = 0;
+        }
+        else if( buffer.size == 0 && !buffer.blocks.empty() )
+        {
+            buffer.head = 0;
+            buffer.tail = 0;
+        }
+    }
+
+    // network callback sized appends, demuxer io context sized reads
+    const size_t APPEND_SIZE = 16 * 1024;
+    const size_t READ_SIZE = 32 * 1024;
+    const uint64_t STREAM_BYTES = 2ULL * 1024 * 1024 * 1024;
+
+    template<typename Append, typename Read, typename Size>
+    uint64_t Stream(Append append, Read read, Size size)
+    {
+        std::vector<uint8_t> input(APPEND_SIZE);
+        std::vector<uint8_t> output(READ_SIZE);
+        for(size_t i = 0; i < input.size(); i++)
+        {
+            input[i] = static_cast<uint8_t>(i * 7);
+        }
+
+        uint64_t streamed = 0;
+        const uint64_t startTimeUs = chrono::RealNow();
+        while( streamed < STREAM_BYTES )
+        {
+            // download to the high watermark then play down to the low one
+            while( size() < curl::MAX_BUFFER_SIZE )
+            {
+                append(input.data(), input.size());
+            }
+            while( size() > curl::MIN_BUFFER_SIZE )
+            {
+                streamed += read(output.data(), output.size());
+            }
+        }
+        return chrono::RealNow() - startTimeUs;
+    }
+}
+
+namespace chunkbuffer
+{
+    void Init(Buffer& buffer, size_t maxSpares)
+    {
+        Clear(buffer);
+        buffer.maxSpares = maxSpares;
+    }
+
+    void Destroy(Buffer& buffer)
+    {
+        buffer.maxSpares = 0;
+        Clear(buffer);
+        for(auto it = buffer.spares.begin(); it != buffer.spares.end(); ++it)
+        {
+            delete [] *it;
+        }
+        buffer.spares.clear();
+    }
+
+    void Append(Buffer& buffer, const uint8_t* data, size_t size)
+    {
+        buffer.size += size;
+        while( size > 0 )
+        {
+            if( buffer.blocks.empty() || buffer.tail == BLOCK_SIZE )
+            {
+                buffer.blocks.push_back(TakeBlock(buffer));
+                buffer.tail = 0;
+            }
+
+            const size_t bytes = std::min(size, BLOCK_SIZE - buffer.tail);
+            memcpy(buffer.blocks.back() + buffer.tail, data, bytes);
+            buffer.tail += bytes;
+            data += bytes;
+            size -= bytes;
+        }
+    }
+
+    size_t Read(Buffer& buffer, uint8_t* data, size_t size)
+    {
+        size = std::min(size, buffer.size);
+        size_t remaining = size;
+        while( remaining > 0 )
+        {
+            const size_t bytes = std::min(remaining, BLOCK_SIZE - buffer.head);
+            memcpy(data, buffer.blocks.front() + buffer.head, bytes);
+            buffer.head += bytes;
+            buffer.size -= bytes;
+            data += bytes;
+            remaining -= bytes;
+            PopConsumed(buffer);
+        }
+        return size;
+    }
+
+    size_t Skip(Buffer& buffer, size_t size)
+    {
+        size = std::min(size, buffer.size);
+        size_t remaining = size;
+        while( remaining > 0 )
+        {
+            const size_t bytes = std::min(remaining, BLOCK_SIZE - buffer.head);
+            buffer.head += bytes;
+            buffer.size -= bytes;
+            remaining -= bytes;
+            PopConsumed(buffer);
+        }
+        return size;
+    }
+
+    size_t Move(Buffer& dst, Buffer& src)
+    {
+        const size_t size = src.size;
+        while( src.size > 0 )
+        {
+            const bool single = src.blocks.size() == 1;
+            const size_t end = single ? src.tail : BLOCK_SIZE;
+
+            if( src.head == 0 && end == BLOCK_SIZE && dst.tail == BLOCK_SIZE )
+            {
+                dst.blocks.push_back(src.blocks.front());
+                dst.size += BLOCK_SIZE;
+                src.blocks.pop_front();
+                src.size -= BLOCK_SIZE;
+                if( single )
+                {
+                    src.tail = BLOCK_SIZE;
+                }
+                continue;
+            }
+
+            const size_t bytes = end - src.head;
+            Append(dst, src.blocks.front() + src.head, bytes);
+            src.head = end;
+            src.size -= bytes;
+            PopConsumed(src);
+        }
+        return size;
+    }
+
+    void Clear(Buffer& buffer)
+    {
+        for(auto it = buffer.blocks.begin(); it != buffer.blocks.end(); ++it)
+        {
+            GiveBlock(buffer, *it);
+        }
+        buffer.blocks.clear();
+        buffer.head = 0;
+        buffer.tail = BLOCK_SIZE;
+        buffer.size = 0;
+    }
+
+    Result Benchmark()
+    {
+        std::deque<uint8_t> deque;
+        const uint64_t dequeTimeUs = Stream(
+            [&deque](const uint8_t* data, size_t size) {
+                deque.insert(deque.end(), data, data + size);
+            },
+            [&deque](uint8_t* data, size_t size) {
+                size = std::min(size, deque.size());
+                std::copy_n(deque.begin(), size, data);
+                deque.erase(deque.begin(), deque.begin() + size);
+                return size;
+            },
+            [&deque]() { return deque.size(); });
+        deque.clear();
+        deque.shrink_to_fit();
+
+        Buffer buffer;
+        Init(buffer, (curl::MAX_BUFFER_SIZE - curl::MIN_BUFFER_SIZE) / BLOCK_SIZE);
+        const uint64_t chunkTimeUs = Stream(
+            [&buffer](const uint8_t* data, size_t size) { Append(buffer, data, size); },
+            [&buffer](uint8_t* data, size_t size) { return Read(buffer, data, size); },
+            [&buffer]() { return buffer.size; });
+        Destroy(buffer);
+
+        const double megabytes = static_cast<double>(STREAM_BYTES) / (1024.0 * 1024.0);
+        logger::Info("Network buffer %f MB streamed: deque %f ms %f MB/s chunk %f ms %f MB/s speedup %fx",
+                     megabytes, chrono::Milliseconds(dequeTimeUs), megabytes / chrono::Seconds(dequeTimeUs),
+                     chrono::Milliseconds(chunkTimeUs), megabytes / chrono::Seconds(chunkTimeUs),
+                     static_cast<double>(dequeTimeUs) / static_cast<double>(std::max<uint64_t>(chunkTimeUs, 1)));
+        return Result(true);
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "result.h"
+
+#include <deque>
+#include <vector>
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace chunkbuffer
+{
+    static const size_t BLOCK_SIZE = 1024 * 1024;
+
+    // Byte fifo made of fixed size blocks.
+    //
+    // Appends fill the last block and link a new one when it is full, reads copy out
+    // of the first block and unlink it once consumed. Unlinked blocks are kept as spares
+    // up to maxSpares so a steady stream stops allocating. The owner locks.
+    struct Buffer
+    {
+        std::deque<uint8_t*> blocks;
+        std::vector<uint8_t*> spares;
+        size_t maxSpares = 0;
+
+        // read offset in the first block, write offset in the last one
+        size_t head = 0;
+        size_t tail = BLOCK_SIZE;
+        size_t size = 0;
+    };
+
+    void   Init(Buffer&, size_t maxSpares);
+    void   Destroy(Buffer&);
+
+    void   Append(Buffer&, const uint8_t* data, size_t size);
+
+    // copy up to size bytes out of the buffer, returns the bytes read
+    size_t Read(Buffer&, uint8_t* data, size_t size);
+
+    // drop up to size bytes, returns the bytes dropped
+    size_t Skip(Buffer&, size_t size);
+
+    // append all of src to dst and empty src, full blocks are relinked without copy. Returns the bytes moved
+    size_t Move(Buffer& dst, Buffer& src);
+
+    void   Clear(Buffer&);
+
+    // Stream through a std::deque<uint8_t> and a chunk buffer between the network
+    // session buffer watermarks and compare throughput.
+    Result Benchmark();
+}
@@ -2,133 +2,687 @@
 #include "curl.h"
 #include "logger.h"
 
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+
 #ifdef WIN32
 #undef min
 #endif
 
 namespace {
 
-    void DownloadThread(curl::Session* session)
+    const long HTTP_OK = 200;
+    const long HTTP_PARTIAL_CONTENT = 206;
+    const long HTTP_RANGE_NOT_SATISFIABLE = 416;
+
+    // concurrent range requests of a session and the bytes they fetch ahead, 0 is one segment per connection
+    uint32_t connections = 1;
+    uint64_t windowSize = 0;
+
+    // Upper bound of a wait on the transfer sockets. Seeks and cancels wake the wait up
+    // when libcurl has curl_multi_wakeup (7.68), refills are picked up on timeout.
+    const int multiWaitTimeMs = 100;
+
+    // session mutex held
+    bool IsStale(curl::Session* session)
     {
-        CURLcode res = curl_easy_perform(session->curl);
-        session->done = true;
-        session->result = res;
+        return session->segmentGeneration != session->generation;
+    }
 
-        logger::Info("Curl Session Ended %s", curl_easy_strerror(res));
+    // Bytes left to a request replaced by a seek that are read rather than aborting it, at least
+    // DRAIN_SIZE, more when downloading them takes less than a reconnection. Session mutex held.
+    uint64_t GetDrainSize(curl::Session* session)
+    {
+        return std::max(curl::DRAIN_SIZE, session->bytesPerSecond * session->connectTimeUs / 1000000);
+    }
+
+    // session mutex held
+    void Wake(curl::Session* session)
+    {
+        session->requestCondition.notify_one();
+#if LIBCURL_VERSION_NUM >= 0x074400
+        if( session->multi )
+        {
+            curl_multi_wakeup(session->multi);
+        }
+#endif
     }
 
     size_t WriteCallback(char *ptr, size_t, size_t nmemb, void *userdata)
     {
         curl::Session* session = static_cast<curl::Session*>(userdata);
-        uint8_t* data = reinterpret_cast<uint8_t*>(ptr);
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(ptr);
+        size_t size = nmemb;
+
+        if( session->segmentStatus == 0 )
+        {
+            curl_easy_getinfo(session->curl, CURLINFO_RESPONSE_CODE, &session->segmentStatus);
+        }
+
+        // only media is buffered, an error page or a 416 body aborts the transfer
+        if( session->segmentStatus != HTTP_PARTIAL_CONTENT && session->segmentStatus != HTTP_OK )
+        {
+            return 0;
+        }
 
         std::scoped_lock<std::mutex> guard(session->mutex);
-        std::deque<uint8_t>& buffer = session->buffer;
-        buffer.insert(buffer.end(), data, data + nmemb);
+        if( session->cancel )
+        {
+            return 0;
+        }
+
+        // Replaced by a seek. Reading the end of the response keeps the connection,
+        // returning less than nmemb aborts the transfer.
+        if( IsStale(session) )
+        {
+            const uint64_t remaining = session->segmentSize > session->segmentReceived ? session->segmentSize - session->segmentReceived : 0;
+            if( session->segmentStatus == HTTP_OK || remaining > GetDrainSize(session) )
+            {
+                return 0;
+            }
+            session->segmentReceived += nmemb;
+            return nmemb;
+        }
+
+        // The whole resource is sent and has no segment end, the transfer is paused at the
+        // high watermark and resumed by the progress callback once the reader drained the buffer.
+        if( session->segmentStatus == HTTP_OK && session->buffer.size >= curl::MAX_BUFFER_SIZE )
+        {
+            logger::Info("Curl: pausing at max buffer size %lu", session->buffer.size);
+            session->filling = false;
+            session->paused = true;
+            return CURL_WRITEFUNC_PAUSE;
+        }
+
+        // range ignored, the whole resource is sent
+        if( session->segmentStatus == HTTP_OK && session->segmentReceived < session->segmentStart )
+        {
+            const size_t skip = static_cast<size_t>(std::min<uint64_t>(size, session->segmentStart - session->segmentReceived));
+            session->segmentReceived += skip;
+            data += skip;
+            size -= skip;
+        }
+
+        chunkbuffer::Append(session->buffer, data, size);
+        session->segmentReceived += size;
         return nmemb;
     }
 
-    int ProgressCallback(void *clientp, curl_off_t dlnow, curl_off_t dltotal, curl_off_t ultotal, curl_off_t ulnow)
+    // total size from Content-Range: bytes first-last/total
+    size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata)
+    {
+        curl::Session* session = static_cast<curl::Session*>(userdata);
+        std::string header(buffer, size * nitems);
+        const std::string contentRange = "content-range:";
+
+        std::transform(header.begin(), header.end(), header.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+        if( header.compare(0, contentRange.size(), contentRange) == 0 )
+        {
+            const size_t slash = header.find('/');
+            if( slash != std::string::npos && header[slash + 1] != '*' )
+            {
+                session->totalBytes = strtoull(header.c_str() + slash + 1, nullptr, 10);
+            }
+        }
+        return size * nitems;
+    }
+
+    int ProgressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
     {
         curl::Session* session = static_cast<curl::Session*>(clientp);
-        session->totalBytes = static_cast<uint64_t>(dltotal);
-        if(session->cancel)
+        if( session->segmentStatus == HTTP_OK && dltotal > 0 )
+        {
+            session->totalBytes = static_cast<uint64_t>(dltotal);
+        }
+
+        if( session->paused )
+        {
+            bool resume = false;
+            {
+                std::scoped_lock<std::mutex> guard(session->mutex);
+                resume = session->filling || session->cancel || IsStale(session);
+            }
+            if( resume )
+            {
+                session->paused = false;
+                curl_easy_pause(session->curl, CURLPAUSE_CONT);
+            }
+        }
+
+        // a stalled transfer replaced by a seek is not waited for
+        if( session->cancel || (session->segmentGeneration != session->generation && dlnow == 0) )
         {
             return 1;
         }
         return 0;
     }
 
-    void Cancel(curl::Session* session, bool clear)
+    CURL* CreateHandle(curl::Session* session, curl_write_callback write, void* writeData)
     {
-        logger::Info("Curl cancel session clear %d", clear);
+        CURL* curl = curl_easy_init();
+        curl_easy_setopt(curl, CURLOPT_URL, session->url.c_str());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, writeData);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, session);
 
-        session->cancel = true;
-        if(session->thread.joinable())
+        // an aborted HTTP/2 stream leaves the connection open
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        return curl;
+    }
+
+    void Setup(curl::Session* session)
+    {
+        session->curl = CreateHandle(session, WriteCallback, session);
+        curl_easy_setopt(session->curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(session->curl, CURLOPT_XFERINFOFUNCTION, ProgressCallback);
+        curl_easy_setopt(session->curl, CURLOPT_XFERINFODATA, session);
+    }
+
+    // session mutex held, returns false when the request was replaced by a seek
+    bool Perform(curl::Session* session, std::unique_lock<std::mutex>& lock, uint64_t start)
+    {
+        const uint64_t total = session->totalBytes;
+        session->segmentGeneration = session->generation;
+        session->segmentStart = start;
+        session->segmentSize = total != 0 ? std::min(curl::SEGMENT_SIZE, total - std::min(start, total)) : curl::SEGMENT_SIZE;
+        session->segmentReceived = 0;
+        session->segmentStatus = 0;
+        session->requests++;
+        lock.unlock();
+
+        const std::string range = std::to_string(start) + "-" + std::to_string(start + session->segmentSize - 1);
+        curl_easy_setopt(session->curl, CURLOPT_RANGE, range.c_str());
+
+        CURLcode res = curl_easy_perform(session->curl);
+
+        long connects = 0;
+        curl_easy_getinfo(session->curl, CURLINFO_NUM_CONNECTS, &connects);
+        if( connects != 0 )
         {
-            session->thread.join();
+            double connectTime = 0.0;
+            double appConnectTime = 0.0;
+            curl_easy_getinfo(session->curl, CURLINFO_CONNECT_TIME, &connectTime);
+            curl_easy_getinfo(session->curl, CURLINFO_APPCONNECT_TIME, &appConnectTime);
+            session->connectTimeUs = static_cast<uint64_t>(std::max(connectTime, appConnectTime) * 1000000.0);
         }
 
-        if(clear)
+        curl_off_t speed = 0;
+        curl_easy_getinfo(session->curl, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+        if( session->segmentStatus == 0 )
         {
-            session->buffer.clear();
-            session->totalBytes = 0;
-            session->offset = 0;
+            curl_easy_getinfo(session->curl, CURLINFO_RESPONSE_CODE, &session->segmentStatus);
         }
 
-        if(session->curl)
+        // past the end the resource is complete, other statuses carry no media
+        if( session->segmentStatus == HTTP_RANGE_NOT_SATISFIABLE )
+        {
+            res = CURLE_OK;
+        }
+        else if( session->segmentStatus != HTTP_PARTIAL_CONTENT && session->segmentStatus != HTTP_OK && (res == CURLE_OK || res == CURLE_WRITE_ERROR) )
         {
-            curl_easy_cleanup(session->curl);
+            logger::Error("Curl: %s returned status %ld for range %s", session->url.c_str(), session->segmentStatus, range.c_str());
+            res = CURLE_HTTP_RETURNED_ERROR;
         }
 
-        session->curl = nullptr;
-        session->cancel = false;
-        session->done = false;
-        session->result = CURLE_OK;
+        lock.lock();
+        session->connects += static_cast<uint32_t>(connects);
+        if( res == CURLE_OK && speed > 0 )
+        {
+            session->bytesPerSecond = static_cast<uint64_t>(speed);
+        }
+        if( connects != 0 && session->requests > 1 )
+        {
+            logger::Info("Curl reconnected for range %s", range.c_str());
+        }
+
+        if( IsStale(session) || session->cancel )
+        {
+            return false;
+        }
+
+        session->result = res;
+        return true;
     }
 
-    void StartSession(curl::Session* session, uint64_t offset, bool clear)
+    size_t TransferWriteCallback(char *ptr, size_t, size_t nmemb, void *userdata)
     {
-        session->curl = curl_easy_init();
-        curl_easy_setopt(session->curl, CURLOPT_URL, session->url.c_str());
-        curl_easy_setopt(session->curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(session->curl, CURLOPT_WRITEDATA, session);
-        curl_easy_setopt(session->curl, CURLOPT_NOPROGRESS, 0);
-        curl_easy_setopt(session->curl, CURLOPT_PROGRESSFUNCTION, ProgressCallback);
-        curl_easy_setopt(session->curl, CURLOPT_PROGRESSDATA, session);
-        curl_easy_setopt(session->curl, CURLOPT_RESUME_FROM_LARGE, offset); 
+        curl::Transfer* transfer = static_cast<curl::Transfer*>(userdata);
+        curl::Session* session = transfer->session;
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(ptr);
 
-        logger::Info("Curl Session Started %s offset %ld clear %d", session->url.c_str(), offset, clear);
+        if( transfer->status == 0 )
+        {
+            curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &transfer->status);
+        }
 
-        session->cancel = false;
-        session->result = CURLE_OK;
+        std::scoped_lock<std::mutex> guard(session->mutex);
+        if( session->cancel )
+        {
+            return 0;
+        }
 
-        if(clear)
+        // replaced by a seek and kept by StopTransfers to be drained
+        if( transfer->generation != session->generation )
         {
-            session->totalBytes = 0;
-            session->done = false;
-            session->offset = 0;
+            transfer->received += nmemb;
+            return nmemb;
         }
-        session->thread = std::thread(DownloadThread, session);
+
+        // the whole resource is sent, it is streamed on one connection instead
+        if( transfer->status == HTTP_OK )
+        {
+            session->rangesIgnored = true;
+            return 0;
+        }
+
+        // a range past the end or an error, the body is not media
+        if( transfer->status != HTTP_PARTIAL_CONTENT )
+        {
+            return nmemb;
+        }
+
+        // the transfer at the assembled position writes straight to the read buffer
+        if( transfer->start + transfer->merged == session->assembled && transfer->data.size == 0 )
+        {
+            chunkbuffer::Append(session->buffer, data, nmemb);
+            transfer->merged += nmemb;
+            session->assembled += nmemb;
+        }
+        else
+        {
+            chunkbuffer::Append(transfer->data, data, nmemb);
+        }
+        transfer->received += nmemb;
+        return nmemb;
+    }
+
+    // session mutex held
+    void StartTransfer(curl::Session* session, curl::Transfer* transfer, uint64_t start, uint64_t size)
+    {
+        transfer->generation = session->generation;
+        transfer->start = start;
+        transfer->size = size;
+        transfer->received = 0;
+        transfer->merged = 0;
+        transfer->status = 0;
+        transfer->result = CURLE_OK;
+        transfer->active = true;
+        chunkbuffer::Clear(transfer->data);
+
+        const std::string range = std::to_string(start) + "-" + std::to_string(start + size - 1);
+        curl_easy_setopt(transfer->curl, CURLOPT_RANGE, range.c_str());
+        curl_multi_add_handle(session->multi, transfer->curl);
+        session->requests++;
+    }
+
+    // session mutex held
+    void RemoveTransfer(curl::Session* session, curl::Transfer* transfer)
+    {
+        long connects = 0;
+        curl_easy_getinfo(transfer->curl, CURLINFO_NUM_CONNECTS, &connects);
+        session->connects += static_cast<uint32_t>(connects);
+
+        curl_multi_remove_handle(session->multi, transfer->curl);
+        transfer->active = false;
+    }
+
+    // Session mutex held. Removing an unfinished HTTP/1.1 transfer closes its connection,
+    // when drain is set the transfers close to their end are left to complete instead.
+    void StopTransfers(curl::Session* session, bool drain)
+    {
+        for(curl::Transfer* transfer : session->transfers)
+        {
+            const uint64_t remaining = transfer->size > transfer->received ? transfer->size - transfer->received : 0;
+            const bool drained = drain && transfer->status == HTTP_PARTIAL_CONTENT && remaining <= GetDrainSize(session);
+            if( transfer->active && !drained )
+            {
+                RemoveTransfer(session, transfer);
+            }
+            chunkbuffer::Clear(transfer->data);
+        }
+    }
+
+    // session mutex held
+    void CompleteTransfer(curl::Session* session, CURL* easy, CURLcode result)
+    {
+        auto it = std::find_if(session->transfers.begin(), session->transfers.end(), [easy](curl::Transfer* transfer) {
+            return transfer->curl == easy;
+        });
+        if( it == session->transfers.end() )
+        {
+            return;
+        }
+
+        curl::Transfer* transfer = *it;
+        long connects = 0;
+        curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects);
+        RemoveTransfer(session, transfer);
+        transfer->result = result;
+        if( transfer->status == 0 )
+        {
+            curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &transfer->status);
+        }
+
+        // cost of a reconnection against the throughput of one connection
+        if( connects != 0 )
+        {
+            double connectTime = 0.0;
+            double appConnectTime = 0.0;
+            curl_easy_getinfo(easy, CURLINFO_CONNECT_TIME, &connectTime);
+            curl_easy_getinfo(easy, CURLINFO_APPCONNECT_TIME, &appConnectTime);
+            session->connectTimeUs = static_cast<uint64_t>(std::max(connectTime, appConnectTime) * 1000000.0);
+        }
+        curl_off_t speed = 0;
+        curl_easy_getinfo(easy, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+        if( result == CURLE_OK && speed > 0 )
+        {
+            session->bytesPerSecond = static_cast<uint64_t>(speed);
+        }
+
+        if( transfer->generation != session->generation || session->rangesIgnored )
+        {
+            chunkbuffer::Clear(transfer->data);
+            return;
+        }
+
+        // a range past the end or a short response bounds the resource
+        uint64_t end = 0;
+        if( transfer->status == HTTP_RANGE_NOT_SATISFIABLE )
+        {
+            end = transfer->start;
+        }
+        else if( result != CURLE_OK || transfer->status != HTTP_PARTIAL_CONTENT )
+        {
+            session->result = result != CURLE_OK ? result : CURLE_HTTP_RETURNED_ERROR;
+            session->done = true;
+            logger::Info("Curl Session Ended %s status %ld at %lu", curl_easy_strerror(result), transfer->status, transfer->start + transfer->received);
+            return;
+        }
+        else if( transfer->received < transfer->size )
+        {
+            end = transfer->start + transfer->received;
+        }
+
+        if( end != 0 && (session->totalBytes == 0 || end < session->totalBytes) )
+        {
+            session->totalBytes = end;
+        }
+    }
+
+    // session mutex held, moves the bytes received ahead in order once the transfers before them are merged
+    void Merge(curl::Session* session)
+    {
+        bool merged = true;
+        while( merged )
+        {
+            merged = false;
+            for(curl::Transfer* transfer : session->transfers)
+            {
+                if( transfer->data.size > 0 && transfer->start + transfer->merged == session->assembled )
+                {
+                    const size_t size = chunkbuffer::Move(session->buffer, transfer->data);
+                    transfer->merged += size;
+                    session->assembled += size;
+                    merged = true;
+                }
+            }
+        }
+    }
+
+    // session mutex held, returns false when the server ignores ranges
+    bool DownloadParallel(curl::Session* session, std::unique_lock<std::mutex>& lock)
+    {
+        session->multi = curl_multi_init();
+
+        // one connection per transfer, a multiplexed HTTP/2 connection would share its throughput
+        curl_multi_setopt(session->multi, CURLMOPT_PIPELINING, CURLPIPE_NOTHING);
+        curl_multi_setopt(session->multi, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(session->connections));
+
+        for(uint32_t i = 0; i < session->connections; i++)
+        {
+            curl::Transfer* transfer = new curl::Transfer;
+            transfer->session = session;
+            transfer->curl = CreateHandle(session, TransferWriteCallback, transfer);
+            chunkbuffer::Init(transfer->data, curl::SEGMENT_SIZE / chunkbuffer::BLOCK_SIZE);
+            session->transfers.push_back(transfer);
+        }
+
+        uint64_t next = 0;
+        for(;;)
+        {
+            if( session->requestPending )
+            {
+                StopTransfers(session, true);
+                next = session->requestOffset;
+                session->assembled = session->requestOffset;
+                session->requestPending = false;
+                session->filling = true;
+            }
+
+            if( session->cancel || session->rangesIgnored )
+            {
+                break;
+            }
+
+            Merge(session);
+
+            const uint64_t total = session->totalBytes;
+            if( !session->done && total != 0 && session->assembled >= total )
+            {
+                session->done = true;
+                logger::Info("Curl Session Ended at %lu", session->assembled);
+            }
+
+            // the transfers idle until the reader drains the buffer to the low watermark
+            if( session->filling && session->buffer.size >= curl::MAX_BUFFER_SIZE )
+            {
+                logger::Info("Curl: downloaded max buffer size %lu", session->buffer.size);
+                session->filling = false;
+            }
+
+            // a transfer is free once its bytes are merged
+            bool active = false;
+            for(curl::Transfer* transfer : session->transfers)
+            {
+                if( !transfer->active && transfer->data.size == 0 && session->filling && !session->done
+                    && next < session->assembled + session->window && (total == 0 || next < total) )
+                {
+                    const uint64_t size = total != 0 ? std::min(curl::SEGMENT_SIZE, total - next) : curl::SEGMENT_SIZE;
+                    StartTransfer(session, transfer, next, size);
+                    next += size;
+                }
+                active = active || transfer->active;
+            }
+
+            if( !active )
+            {
+                session->requestCondition.wait(lock, [session]() {
+                    return session->cancel || session->requestPending || (session->filling && !session->done);
+                });
+                continue;
+            }
+
+            lock.unlock();
+            int running = 0;
+            curl_multi_perform(session->multi, &running);
+#if LIBCURL_VERSION_NUM >= 0x074400
+            curl_multi_poll(session->multi, nullptr, 0, multiWaitTimeMs, nullptr);
+#else
+            curl_multi_wait(session->multi, nullptr, 0, multiWaitTimeMs, nullptr);
+#endif
+            lock.lock();
+
+            int queued = 0;
+            while( CURLMsg* message = curl_multi_info_read(session->multi, &queued) )
+            {
+                if( message->msg == CURLMSG_DONE )
+                {
+                    CompleteTransfer(session, message->easy_handle, message->data.result);
+                }
+            }
+        }
+
+        StopTransfers(session, false);
+        for(curl::Transfer* transfer : session->transfers)
+        {
+            curl_easy_cleanup(transfer->curl);
+            chunkbuffer::Destroy(transfer->data);
+            delete transfer;
+        }
+        session->transfers.clear();
+        curl_multi_cleanup(session->multi);
+        session->multi = nullptr;
+
+        return !session->rangesIgnored;
+    }
+
+    // session mutex held
+    void DownloadSequential(curl::Session* session, std::unique_lock<std::mutex>& lock, uint64_t next)
+    {
+        lock.unlock();
+        Setup(session);
+        lock.lock();
+
+        for(;;)
+        {
+            session->requestCondition.wait(lock, [session]() {
+                return session->cancel || session->requestPending || (session->filling && !session->done);
+            });
+
+            if( session->cancel )
+            {
+                break;
+            }
+
+            if( session->requestPending )
+            {
+                next = session->requestOffset;
+                session->requestPending = false;
+                session->filling = true;
+            }
+
+            const uint64_t start = next;
+            if( session->totalBytes != 0 && start >= session->totalBytes )
+            {
+                session->done = true;
+                continue;
+            }
+
+            if( !Perform(session, lock, start) )
+            {
+                continue;
+            }
+
+            const uint64_t received = session->segmentReceived;
+            const uint64_t total = session->totalBytes;
+            next = start + received;
+
+            if( session->result != CURLE_OK || session->segmentStatus == HTTP_OK || session->segmentStatus == HTTP_RANGE_NOT_SATISFIABLE
+                || received < session->segmentSize || (total != 0 && next >= total) )
+            {
+                session->done = true;
+                logger::Info("Curl Session Ended %s status %ld at %lu", curl_easy_strerror(session->result), session->segmentStatus, next);
+            }
+
+            // the connection idles until the reader drains the buffer to the low watermark
+            if( session->buffer.size >= curl::MAX_BUFFER_SIZE )
+            {
+                logger::Info("Curl: downloaded max buffer size %lu", session->buffer.size);
+                session->filling = false;
+            }
+        }
+
+        lock.unlock();
+        curl_easy_cleanup(session->curl);
+        session->curl = nullptr;
+    }
+
+    void DownloadThread(curl::Session* session)
+    {
+        std::unique_lock<std::mutex> lock(session->mutex);
+        uint64_t next = 0;
+
+        if( session->connections > 1 )
+        {
+            if( DownloadParallel(session, lock) )
+            {
+                return;
+            }
+
+            // the read buffer holds the resource up to the assembled position
+            logger::Info("Curl: %s ignores ranges, downloading on one connection", session->url.c_str());
+            next = session->assembled;
+        }
+
+        DownloadSequential(session, lock, next);
+    }
+
+    // session mutex held
+    void Request(curl::Session* session, uint64_t offset)
+    {
+        chunkbuffer::Clear(session->buffer);
+        session->pos = offset;
+        session->offset = 0;
+        session->done = false;
+        session->result = CURLE_OK;
+        session->generation++;
+        session->requestOffset = offset;
+        session->requestPending = true;
+        Wake(session);
     }
- 
 }
 
 namespace curl
 {
+    void SetConnections(uint32_t count)
+    {
+        connections = count;
+    }
+
+    void SetWindowSize(uint64_t bytes)
+    {
+        windowSize = bytes;
+    }
+
+    uint32_t GetConnections()
+    {
+        return connections;
+    }
+
     Result Create(Session*& session, const std::string& url, uint64_t offset)
     {
         Result result;
         session = new Session;
         session->url = url;
-        
-        StartSession(session, offset, true);
+        session->connections = std::max<uint32_t>(connections, 1);
+        session->window = windowSize != 0 ? windowSize : session->connections * SEGMENT_SIZE;
+        chunkbuffer::Init(session->buffer, (MAX_BUFFER_SIZE - MIN_BUFFER_SIZE) / chunkbuffer::BLOCK_SIZE);
+
+        logger::Info("Curl Session Started %s offset %lu", url.c_str(), offset);
+        {
+            std::scoped_lock<std::mutex> guard(session->mutex);
+            Request(session, offset);
+        }
+        session->thread = std::thread(DownloadThread, session);
 
         return result;
     }
 
     size_t Read(Session* session, uint8_t* readbuf, size_t size)
     {
-        session->mutex.lock();
-        std::deque<uint8_t>& buffer = session->buffer;
-        size = std::min(size, buffer.size());
-        std::copy_n(buffer.begin(), size, readbuf);
-        buffer.erase(buffer.begin(), buffer.begin()+size);
+        std::scoped_lock<std::mutex> guard(session->mutex);
+        size = chunkbuffer::Read(session->buffer, readbuf, size);
         session->offset += static_cast<uint64_t>(size);
-        const size_t bufferSize = session->buffer.size();
-        session->mutex.unlock();
  
-        // we have too much buffer, stop downloading
-        if(bufferSize >= MAX_BUFFER_SIZE && !session->cancel && session->curl != nullptr)
+        // we do not have enough buffer, resume downloading on the same connection
+        if( session->buffer.size <= MIN_BUFFER_SIZE && !session->filling )
         {
-            logger::Info("Curl: downloaded max buffer size %ld", bufferSize);
-            Cancel(session, false);
-        }
-        // we do not have enough bufer, restart download
-        else if(bufferSize <= MIN_BUFFER_SIZE && session->curl == nullptr)
-        {
-            logger::Info("Curl: downloading after hitting min buffer offset %ld size: %ld", session->offset.load() + session->pos.load(), bufferSize);
-            StartSession(session,session->pos + session->offset + bufferSize, false);
+            logger::Info("Curl: downloading after hitting min buffer offset %lu size: %lu", session->pos + session->offset, session->buffer.size);
+            session->filling = true;
+            session->requestCondition.notify_one();
         }
 
         return size;
@@ -136,29 +690,33 @@ namespace curl
 
     size_t Seek(Session* session, uint64_t offset)
     {
-        logger::Info("Curl: seek %ld", offset);
-        std::deque<uint8_t>& buffer = session->buffer;
-        size_t position = 0;
+        logger::Info("Curl: seek %lu", offset);
+
+        std::scoped_lock<std::mutex> guard(session->mutex);
+        const uint64_t position = session->pos + session->offset;
 
         // Can we continue the download session
-        if(offset >= session->offset &&  offset < session->offset + buffer.size()  )
+        if( offset >= position && offset < position + session->buffer.size )
         {
-            std::scoped_lock<std::mutex> guard(session->mutex);
-            logger::Info("Curl seek. Buffer already in memory. Size %d", buffer.size());
-            size_t offsetBytes = offset - session->offset;
-            buffer.erase(buffer.begin(), buffer.begin()+offsetBytes);
-            session->offset += offset;
-            position = session->offset;
+            logger::Info("Curl seek. Buffer already in memory. Size %lu", session->buffer.size);
+            chunkbuffer::Skip(session->buffer, offset - position);
         }
         else
         {
-            Cancel(session, true);
-            StartSession(session,offset, true);
+            // a new range request, the kept alive connection is reused
+            Request(session, offset);
         }
 
         session->pos = offset;
+        session->offset = 0;
 
-        return position;
+        return offset;
+    }
+
+    size_t GetBufferSize(Session* session)
+    {
+        std::scoped_lock<std::mutex> guard(session->mutex);
+        return session->buffer.size;
     }
 
     void Destroy(Session* session)
@@ -168,7 +726,19 @@ namespace curl
             return;
         }
 
-        Cancel(session, true);
+        {
+            std::scoped_lock<std::mutex> guard(session->mutex);
+            session->cancel = true;
+            Wake(session);
+        }
+        if(session->thread.joinable())
+        {
+            session->thread.join();
+        }
+
+        logger::Info("Curl session %u requests %u connections", session->requests, session->connects);
+
+        chunkbuffer::Destroy(session->buffer);
         delete session;
     }
 
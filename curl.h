@@ -13,25 +13,61 @@
 
 #include <curl/curl.h>
 
-#include <deque>
 #include <string>
+#include <vector>
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
 
 #include "result.h"
+#include "chunkbuffer.h"
 
 namespace curl
 {
     static const uint32_t MAX_BUFFER_SIZE = 100 * 1024 * 1024;
     static const uint32_t MIN_BUFFER_SIZE = 20 * 1024 * 1024;
 
+    // Range request size. Bounded requests let a seek drain the end of the current
+    // one instead of aborting it, an aborted HTTP/1.1 transfer closes its connection.
+    // A seek drains at least DRAIN_SIZE, more when downloading it takes less than a reconnection.
+    static const uint64_t SEGMENT_SIZE = 8 * 1024 * 1024;
+    static const uint64_t DRAIN_SIZE = 1024 * 1024;
+
+    struct Session;
+
+    // One of the parallel range requests, download thread. Bytes arriving ahead of
+    // the assembled position wait in data until the transfers before it are merged.
+    struct Transfer
+    {
+        Session* session = nullptr;
+        CURL* curl = nullptr;
+        chunkbuffer::Buffer data;
+
+        uint64_t generation = 0;
+        uint64_t start = 0;
+        uint64_t size = 0;
+        uint64_t received = 0;
+        uint64_t merged = 0;
+        long status = 0;
+
+        bool active = false;
+        CURLcode result = CURLE_OK;
+    };
+
+    // A session owns one download thread and one easy handle for its lifetime so
+    // the connection is kept alive across seeks and refills. With more than one
+    // connection, window bytes ahead of the read position are fetched as concurrent
+    // range requests through a multi handle and reassembled in order.
     struct Session
     {
         CURL* curl = nullptr;
 
+        // downloaded bytes not read yet, blocks consumed between the watermarks are recycled
         std::mutex mutex;
-        std::deque<uint8_t> buffer;
+        chunkbuffer::Buffer buffer;
+
+        // position of the last seek and bytes read since
         std::atomic<uint64_t> pos = 0;
         std::atomic<uint64_t> offset = 0;
 
@@ -44,12 +80,49 @@ namespace curl
         
         std::string url;
         std::thread thread;
+
+        // requests to the download thread, mutex held
+        std::condition_variable requestCondition;
+        std::atomic<uint64_t> generation = 0;
+        bool requestPending = false;
+        uint64_t requestOffset = 0;
+        bool filling = true;
+
+        // range request in flight, download thread
+        uint64_t segmentGeneration = 0;
+        uint64_t segmentStart = 0;
+        uint64_t segmentSize = 0;
+        uint64_t segmentReceived = 0;
+        long segmentStatus = 0;
+        bool paused = false;
+
+        // cost of a reconnection, download thread
+        uint64_t connectTimeUs = 0;
+        uint64_t bytesPerSecond = 0;
+
+        // parallel range requests, download thread
+        uint32_t connections = 1;
+        uint64_t window = 0;
+        CURLM* multi = nullptr;
+        std::vector<Transfer*> transfers;
+        uint64_t assembled = 0;
+        bool rangesIgnored = false;
+
+        uint32_t requests = 0;
+        uint32_t connects = 0;
     };
 
+    // Concurrent range requests per session, 1 streams on a single connection.
+    // The window is the bytes fetched ahead of the read position, 0 is one segment per connection.
+    void SetConnections(uint32_t connections);
+    void SetWindowSize(uint64_t bytes);
+    uint32_t GetConnections();
+
     // create a download session
     Result Create(Session*& session, const std::string& url, uint64_t offset);
     size_t Read(Session*, uint8_t* buf, size_t size);
     size_t Seek(Session*, uint64_t offset);
+    size_t GetBufferSize(Session*);
     void   Destroy(Session*);
 
 
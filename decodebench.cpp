@@ -0,0 +1,182 @@
+#include "precomp.h"
+#include "decodebench.h"
+#include "mediadecoder.h"
+#include "eventcount.h"
+#include "profiler.h"
+#include "logger.h"
+#include "chrono.h"
+
+#include <iostream>
+#include <sstream>
+
+namespace {
+    const uint32_t FRAME_WAIT_TIME_MS = 10;
+
+    std::string JsonString(const std::string& s)
+    {
+        std::string out = "\"";
+        for(auto it = s.begin(); it != s.end(); ++it)
+        {
+            const char c = *it;
+            if(c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if(static_cast<unsigned char>(c) < 0x20)
+            {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            }
+            else
+            {
+                out += c;
+            }
+        }
+        return out + "\"";
+    }
+
+    double PerSecond(uint64_t value, uint64_t elapsedUs)
+    {
+        return elapsedUs != 0 ? static_cast<double>(value) / chrono::Seconds(elapsedUs) : 0.0;
+    }
+
+    void PrintStages(std::ostringstream& out)
+    {
+        out << "  \"stages\": {\n";
+        for(uint32_t i = 0; i < profiler::PROFILER_NB; i++)
+        {
+            std::string name;
+            profiler::GetPointName(static_cast<profiler::Point>(i), name);
+
+            profiler::Profiler stats;
+            profiler::GetStats(static_cast<profiler::Point>(i), stats);
+
+            const bool timed = stats.count != 0;
+            const double averageUs = timed ? static_cast<double>(stats.totalTime) / static_cast<double>(stats.count) : 0.0;
+
+            out << "    " << JsonString(name) << ": { "
+                << "\"count\": " << stats.count << ", "
+                << "\"total_ms\": " << chrono::Milliseconds(stats.totalTime) << ", "
+                << "\"avg_ms\": " << chrono::Milliseconds(averageUs) << ", "
+                << "\"min_ms\": " << (timed ? chrono::Milliseconds(stats.minTime) : 0.0) << ", "
+                << "\"max_ms\": " << chrono::Milliseconds(stats.maxTime) << " }"
+                << (i + 1 < profiler::PROFILER_NB ? ",\n" : "\n");
+        }
+        out << "  },\n";
+    }
+}
+
+namespace decodebench
+{
+    Result Run(const std::string& filename)
+    {
+        profiler::Init();
+        profiler::Enable(true);
+
+        mediadecoder::Decoder* decoder = nullptr;
+        mediadecoder::Producer* producer = nullptr;
+
+        Result result = mediadecoder::Create(decoder);
+        if(result)
+        {
+            result = mediadecoder::Open(decoder, filename);
+        }
+
+        // audio is converted to its own format like a device accepting it as is
+        if(result && mediadecoder::GetHaveAudio(decoder))
+        {
+            result = mediadecoder::SetAudioOutputFormat(decoder, mediadecoder::GetAudioNumChannels(decoder),
+                                                        mediadecoder::GetAudioSampleRate(decoder),
+                                                        mediadecoder::GetAudioSampleFormat(decoder));
+        }
+
+        const uint64_t startTimeUs = chrono::RealNow();
+        if(result)
+        {
+            result = mediadecoder::Create(producer, decoder);
+        }
+        if(!result)
+        {
+            mediadecoder::Destroy(producer);
+            mediadecoder::Destroy(decoder);
+            return result;
+        }
+
+        uint64_t videoFrames = 0;
+        uint64_t audioSamples = 0;
+
+        for(;;)
+        {
+            bool consumed = false;
+
+            mediadecoder::VideoFrame* videoFrame = nullptr;
+            if( mediadecoder::Consume(producer, videoFrame) )
+            {
+                videoFrames++;
+                mediadecoder::Release(producer, videoFrame);
+                consumed = true;
+            }
+
+            mediadecoder::AudioFrame* audioFrame = nullptr;
+            if( mediadecoder::Consume(producer, audioFrame) )
+            {
+                audioSamples += audioFrame->nbSamples;
+                mediadecoder::Release(producer, audioFrame);
+                consumed = true;
+            }
+
+            mediadecoder::Subtitle* subtitle = nullptr;
+            if( mediadecoder::Consume(producer, subtitle) )
+            {
+                mediadecoder::Release(producer, subtitle);
+                consumed = true;
+            }
+
+            if( consumed )
+            {
+                continue;
+            }
+
+            if( producer->done && producer->videoQueueSize == 0 && producer->audioQueueSize == 0 && producer->subtitleQueueSize == 0 )
+            {
+                break;
+            }
+
+            eventcount::Wait(&producer->frameProduced, [producer]() {
+                return producer->videoQueueSize > 0 || producer->audioQueueSize > 0 || producer->subtitleQueueSize > 0 || producer->done;
+            }, FRAME_WAIT_TIME_MS);
+        }
+
+        const uint64_t elapsedUs = chrono::RealNow() - startTimeUs;
+        const uint64_t peakQueueBytes = producer->peakQueueBytes;
+
+        mediadecoder::Destroy(producer);
+
+        std::ostringstream out;
+        out << "{\n";
+        out << "  \"file\": " << JsonString(filename) << ",\n";
+        out << "  \"elapsed_s\": " << chrono::Seconds(elapsedUs) << ",\n";
+        out << "  \"video\": { "
+            << "\"frames\": " << videoFrames << ", "
+            << "\"fps\": " << PerSecond(videoFrames, elapsedUs) << ", "
+            << "\"width\": " << mediadecoder::GetVideoWidth(decoder) << ", "
+            << "\"height\": " << mediadecoder::GetVideoHeight(decoder) << " },\n";
+        out << "  \"audio\": { "
+            << "\"samples\": " << audioSamples << ", "
+            << "\"samples_per_sec\": " << PerSecond(audioSamples, elapsedUs) << ", "
+            << "\"sample_rate\": " << mediadecoder::GetAudioSampleRate(decoder) << ", "
+            << "\"channels\": " << mediadecoder::GetAudioNumChannels(decoder) << " },\n";
+        PrintStages(out);
+        out << "  \"peak_queue_bytes\": " << peakQueueBytes << ",\n";
+        out << "  \"allocations\": " << profiler::GetCount(profiler::COUNTER_FRAME_ALLOCATIONS) << ",\n";
+        out << "  \"video_bytes_copied\": " << profiler::GetCount(profiler::COUNTER_VIDEO_BYTES_COPIED) << "\n";
+        out << "}" << std::endl;
+
+        mediadecoder::Destroy(decoder);
+
+        std::cout << out.str();
+        return result;
+    }
+}
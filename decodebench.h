@@ -0,0 +1,12 @@
+#pragma once
+
+#include "result.h"
+
+#include <string>
+
+namespace decodebench
+{
+    // Decode a file as fast as possible without window nor audio device and
+    // print throughput, profiler stage times, peak queue bytes and allocations as json on stdout.
+    Result Run(const std::string& filename);
+}
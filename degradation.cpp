@@ -0,0 +1,107 @@
+#include "precomp.h"
+#include "degradation.h"
+#include "logger.h"
+#include "chrono.h"
+
+#include <algorithm>
+
+namespace {
+    void Transition(degradation::Controller& controller, degradation::Level level, uint32_t queueCapacity)
+    {
+        logger::Info("Degradation %s -> %s: %d/%d late frames, max lateness %f ms, min queue %d/%d frames",
+                     degradation::GetLevelName(controller.level), degradation::GetLevelName(level),
+                     controller.lateFrames, controller.frames, chrono::Milliseconds(controller.maxLatenessUs),
+                     controller.minQueuedFrames, queueCapacity);
+
+        controller.level = level;
+        controller.settleWindows = degradation::SETTLE_WINDOWS;
+        controller.goodWindows = 0;
+    }
+}
+
+namespace degradation
+{
+    void Init(Controller& controller, Level maxLevel)
+    {
+        controller = Controller();
+        controller.maxLevel = maxLevel;
+    }
+
+    void Reset(Controller& controller)
+    {
+        controller.windowStartUs = 0;
+        controller.frames = 0;
+        controller.lateFrames = 0;
+        controller.maxLatenessUs = 0;
+        controller.minQueuedFrames = UINT32_MAX;
+        controller.goodWindows = 0;
+    }
+
+    bool Update(Controller& controller, int64_t latenessUs, uint32_t queuedFrames, uint32_t queueCapacity, uint64_t nowUs)
+    {
+        if(controller.windowStartUs == 0)
+        {
+            controller.windowStartUs = nowUs;
+        }
+
+        controller.frames++;
+        controller.lateFrames += latenessUs > LATE_THRESHOLD_US ? 1 : 0;
+        controller.maxLatenessUs = std::max(controller.maxLatenessUs, latenessUs);
+        controller.minQueuedFrames = std::min(controller.minQueuedFrames, queuedFrames);
+
+        if(nowUs - controller.windowStartUs < WINDOW_US)
+        {
+            return false;
+        }
+
+        const Level previousLevel = controller.level;
+
+        const bool late = controller.lateFrames > static_cast<uint32_t>(controller.frames * LATE_FRAMES_RATIO);
+        const bool draining = controller.minQueuedFrames < queueCapacity / 2;
+
+        if(controller.settleWindows > 0)
+        {
+            controller.settleWindows--;
+        }
+        else if(late)
+        {
+            // decoding settings only help when the decoder cannot fill the queue
+            const Level next = static_cast<Level>(controller.level + 1);
+            const bool useful = controller.level == LEVEL_NONE || draining;
+            if(next <= controller.maxLevel && useful)
+            {
+                Transition(controller, next, queueCapacity);
+            }
+            controller.goodWindows = 0;
+        }
+        else if(controller.level != LEVEL_NONE && controller.lateFrames == 0 && ++controller.goodWindows >= RECOVERY_WINDOWS)
+        {
+            Transition(controller, static_cast<Level>(controller.level - 1), queueCapacity);
+        }
+
+        const uint32_t goodWindows = controller.goodWindows;
+        Reset(controller);
+        controller.goodWindows = goodWindows;
+
+        return controller.level != previousLevel;
+    }
+
+    const char* GetLevelName(Level level)
+    {
+        switch(level)
+        {
+            case LEVEL_NONE:
+                return "none";
+            case LEVEL_DROP_LATE_FRAMES:
+                return "drop late frames";
+            case LEVEL_SKIP_LOOP_FILTER:
+                return "skip loop filter";
+            case LEVEL_SKIP_NONREF:
+                return "skip non reference frames";
+            case LEVEL_LOWRES:
+                return "low resolution";
+            default:
+                return "invalid";
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace degradation
+{
+    // cheaper presentation & decoding settings, each level includes the previous ones
+    enum Level
+    {
+        LEVEL_NONE = 0,
+        LEVEL_DROP_LATE_FRAMES,
+        LEVEL_SKIP_LOOP_FILTER,
+        LEVEL_SKIP_NONREF,
+        LEVEL_LOWRES,
+        LEVEL_NB
+    };
+
+    // evaluation window of presentation stats
+    static const uint64_t WINDOW_US = 1000000;
+
+    // a frame presented later than this is late
+    static const int64_t LATE_THRESHOLD_US = 20000;
+
+    // degrade when more late frames than this ratio in a window
+    static const double LATE_FRAMES_RATIO = 0.1;
+
+    // windows to wait after a transition before evaluating again, a new level takes time to show effect
+    static const uint32_t SETTLE_WINDOWS = 2;
+
+    // consecutive windows without late frames before recovering one level
+    static const uint32_t RECOVERY_WINDOWS = 5;
+
+    // Steps through the levels from presentation lateness and decoded queue depth.
+    //
+    // A window with too many late frames while the queue is draining degrades one level.
+    // Late frames with a full queue are a presentation problem, only dropping frames helps then.
+    struct Controller
+    {
+        Level level = LEVEL_NONE;
+        Level maxLevel = LEVEL_NB;
+
+        uint64_t windowStartUs = 0;
+        uint32_t frames = 0;
+        uint32_t lateFrames = 0;
+        int64_t maxLatenessUs = 0;
+        uint32_t minQueuedFrames = UINT32_MAX;
+
+        uint32_t settleWindows = 0;
+        uint32_t goodWindows = 0;
+    };
+
+    // maxLevel is the last usable level, LEVEL_LOWRES needs codec support
+    void Init(Controller&, Level maxLevel);
+
+    // drop the current window stats, level is kept
+    void Reset(Controller&);
+
+    // account a presented frame, returns true when the level changed
+    bool Update(Controller&, int64_t latenessUs, uint32_t queuedFrames, uint32_t queueCapacity, uint64_t nowUs);
+
+    const char* GetLevelName(Level);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+#include <stdint.h>
+
+namespace eventcount
+{
+    // Blocking wait/notify layered over lock free state.
+    //
+    // Producers update their lock free state (queue, atomic size) then call Notify.
+    // Notify only takes the lock when a thread is waiting so the fast path stays lock free.
+    // Waiters register themselves before checking the condition so a state change
+    // is never missed.
+    struct EventCount
+    {
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::atomic<uint32_t> waiters = 0;
+    };
+
+    inline void Notify(EventCount* ec)
+    {
+        if( ec->waiters.load() == 0 )
+        {
+            return;
+        }
+
+        {
+            std::scoped_lock<std::mutex> guard(ec->mutex);
+        }
+        ec->condition.notify_all();
+    }
+
+    // wait for condition to be true or timeout. Returns condition.
+    template<typename Condition>
+    bool Wait(EventCount* ec, Condition condition, uint32_t timeoutMs)
+    {
+        if( condition() )
+        {
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lock(ec->mutex);
+        ec->waiters++;
+        const bool outcome = ec->condition.wait_for(lock, std::chrono::milliseconds(timeoutMs), condition);
+        ec->waiters--;
+
+        return outcome;
+    }
+}
@@ -0,0 +1,182 @@
+#include "precomp.h"
+#include "framearena.h"
+#include "logger.h"
+
+#include <stdlib.h>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+    size_t Align(size_t size, size_t alignment)
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    // returns nullptr if huge pages are not available
+    uint8_t* AllocateHugePages(size_t size)
+    {
+#ifdef WIN32
+        const size_t largePageSize = GetLargePageMinimum();
+        if( largePageSize == 0 )
+        {
+            return nullptr;
+        }
+
+        // requires the lock pages in memory privilege
+        void* memory = VirtualAlloc(nullptr, Align(size, largePageSize), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        return reinterpret_cast<uint8_t*>(memory);
+#else
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if( memory == MAP_FAILED )
+        {
+            // no reserved huge pages, ask for transparent huge pages instead
+            memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if( memory == MAP_FAILED )
+            {
+                return nullptr;
+            }
+            madvise(memory, size, MADV_HUGEPAGE);
+        }
+        return reinterpret_cast<uint8_t*>(memory);
+#endif
+    }
+
+    void FreeHugePages(uint8_t* memory, size_t size)
+    {
+#ifdef WIN32
+        VirtualFree(memory, 0, MEM_RELEASE);
+#else
+        munmap(memory, size);
+#endif
+    }
+
+    uint8_t* AllocateAligned(size_t size)
+    {
+#ifdef WIN32
+        return reinterpret_cast<uint8_t*>(_aligned_malloc(size, framearena::ALIGNMENT));
+#else
+        void* memory = nullptr;
+        if( posix_memalign(&memory, framearena::ALIGNMENT, size) != 0 )
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<uint8_t*>(memory);
+#endif
+    }
+
+    void FreeAligned(uint8_t* memory)
+    {
+#ifdef WIN32
+        _aligned_free(memory);
+#else
+        free(memory);
+#endif
+    }
+}
+
+namespace framearena
+{
+    Result Create(Arena*& arena, size_t slotSize, uint32_t nbSlots, bool hugePages)
+    {
+        Result result;
+
+        arena = new Arena();
+        arena->slotSize = Align(slotSize, ALIGNMENT);
+        arena->nbSlots = nbSlots;
+        arena->size = arena->slotSize * nbSlots;
+
+        if( hugePages )
+        {
+            arena->size = Align(arena->size, HUGE_PAGE_SIZE);
+            arena->memory = AllocateHugePages(arena->size);
+            arena->hugePages = arena->memory != nullptr;
+            if( !arena->hugePages )
+            {
+                logger::Warn("Frame arena cannot use huge pages");
+            }
+        }
+
+        if( !arena->memory )
+        {
+            arena->memory = AllocateAligned(arena->size);
+        }
+
+        if( !arena->memory )
+        {
+            delete arena;
+            arena = nullptr;
+            return Result(false, "Cannot allocate frame arena of %zu bytes", slotSize * nbSlots);
+        }
+
+        // owner reference
+        arena->references = 1;
+
+        logger::Info("Frame arena %d slots of %zu bytes (%zu MB)%s", nbSlots, arena->slotSize,
+                     arena->size / (1024 * 1024), arena->hugePages ? " huge pages" : "");
+
+        return result;
+    }
+
+    uint8_t* Allocate(Arena* arena)
+    {
+        {
+            std::scoped_lock<std::mutex> guard(arena->mutex);
+            if( !arena->freeSlots.empty() )
+            {
+                uint8_t* memory = arena->freeSlots.back();
+                arena->freeSlots.pop_back();
+                arena->references++;
+                return memory;
+            }
+        }
+
+        const uint32_t slot = arena->nextSlot.fetch_add(1);
+        if( slot >= arena->nbSlots )
+        {
+            arena->nextSlot = arena->nbSlots;
+            return nullptr;
+        }
+
+        arena->references++;
+        return arena->memory + arena->slotSize * slot;
+    }
+
+    void Free(Arena*& arena, uint8_t* slot)
+    {
+        if( !arena )
+        {
+            return;
+        }
+
+        {
+            std::scoped_lock<std::mutex> guard(arena->mutex);
+            arena->freeSlots.push_back(slot);
+        }
+        Release(arena);
+    }
+
+    void Release(Arena*& arena)
+    {
+        if( !arena )
+        {
+            return;
+        }
+
+        if( --arena->references == 0 )
+        {
+            if( arena->hugePages )
+            {
+                FreeHugePages(arena->memory, arena->size);
+            }
+            else
+            {
+                FreeAligned(arena->memory);
+            }
+            delete arena;
+        }
+        arena = nullptr;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "result.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace framearena
+{
+    static const size_t ALIGNMENT = 64;
+    static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    // One contiguous region carved into fixed size slots.
+    //
+    // A freed slot is handed out again before the never used ones.
+    // Each slot in use and the owner hold a reference, the region is
+    // freed with the last one so frames in flight outlive a format change.
+    struct Arena
+    {
+        uint8_t* memory = nullptr;
+        size_t size = 0;
+        size_t slotSize = 0;
+        uint32_t nbSlots = 0;
+        bool hugePages = false;
+
+        std::atomic<uint32_t> nextSlot = 0;
+        std::atomic<uint32_t> references = 0;
+
+        // slots given back by deleted frames
+        std::mutex mutex;
+        std::vector<uint8_t*> freeSlots;
+    };
+
+    // slotSize is rounded up to ALIGNMENT
+    Result Create(Arena*& arena, size_t slotSize, uint32_t nbSlots, bool hugePages);
+
+    // get a free slot, nullptr when the arena is exhausted. The slot holds a reference.
+    uint8_t* Allocate(Arena* arena);
+
+    // give a slot back to the arena and drop its reference, arena is set to nullptr
+    void Free(Arena*& arena, uint8_t* slot);
+
+    // drop a reference, arena is set to nullptr
+    void Release(Arena*& arena);
+}
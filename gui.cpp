@@ -6,6 +6,7 @@
 
 #include <lodepng/picopng.h>
 #include <map>
+#include <algorithm>
 
 namespace {
 
@@ -69,6 +70,25 @@ namespace {
         ToggleFullScreen(window);
     }
 
+    double GetSeekPercent(gui::Handle* handle)
+    {
+        const double percent = static_cast<double>(handle->posx) / static_cast<double>(handle->width);
+        return std::min(std::max(percent, 0.0), 1.0);
+    }
+
+    // show the thumbnail under the cursor while shift is held and no button is pressed
+    void UpdatePreview(GLFWwindow* window, gui::Handle* handle)
+    {
+        const bool shift = glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS;
+        const bool visible = shift && !handle->mouseButtonPress;
+
+        if( handle->previewCb && (visible || handle->previewVisible) )
+        {
+            handle->previewVisible = visible;
+            handle->previewCb(handle, GetSeekPercent(handle), visible);
+        }
+    }
+
     void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
     {
         gui::Handle* handle = handles[window];
@@ -79,14 +99,15 @@ namespace {
             {
                 handle->mouseButtonPress = true;
                 handle->mouseButtonShift = mods & GLFW_MOD_SHIFT;
+                UpdatePreview(window, handle);
 
                 if( handle->mouseButtonShift )
                 {
-                    const double seekPercent 
-                                      = static_cast<double>(handle->posx) / static_cast<double>(handle->width);
+                    const double seekPercent = GetSeekPercent(handle);
 
-                    logger::Debug("Seeking %f %%", seekPercent);
-                    handle->seekCb(handle, seekPercent);
+                    logger::Debug("Scrubbing %f %%", seekPercent);
+                    handle->scrubbing = true;
+                    handle->seekCb(handle, seekPercent, true);
                 }
             }
             else if( action == GLFW_RELEASE ) 
@@ -94,14 +115,24 @@ namespace {
                 handle->mouseButtonPress = false;
                 handle->mouseButtonShift = mods & GLFW_MOD_SHIFT;
 
+                // full seek where the seek bar is released
+                if( handle->scrubbing )
+                {
+                    const double seekPercent = GetSeekPercent(handle);
+
+                    logger::Debug("Seeking %f %%", seekPercent);
+                    handle->scrubbing = false;
+                    handle->seekCb(handle, seekPercent, false);
+                }
+
                 // double click handling
                 if( handle->mouseReleaseTimeUs == 0 )
                 {
-                    handle->mouseReleaseTimeUs = chrono::Now();
+                    handle->mouseReleaseTimeUs = chrono::RealNow();
                 }
                 else
                 {
-                    uint64_t diffUs = chrono::Now() - handle->mouseReleaseTimeUs;
+                    uint64_t diffUs = chrono::RealNow() - handle->mouseReleaseTimeUs;
                     double diffMs = chrono::Milliseconds(diffUs);
                     if(diffMs >10.0 && diffMs < 200.0)
                     {
@@ -118,13 +149,28 @@ namespace {
     {
         gui::Handle* handle = handles[window];
 
+        const int32_t previousPosx = handle->posx;
+
         handle->posx = static_cast<int32_t>(xpos);
         handle->posy = static_cast<int32_t>(ypos);
+
+        if( handle->scrubbing && handle->posx != previousPosx )
+        {
+            handle->seekCb(handle, GetSeekPercent(handle), true);
+        }
+
+        UpdatePreview(window, handle);
     }
 
     void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
     {
         gui::Handle* handle = handles[window];
+
+        if(key == GLFW_KEY_LEFT_SHIFT || key == GLFW_KEY_RIGHT_SHIFT)
+        {
+            UpdatePreview(window, handle);
+        }
+
         if(action == GLFW_PRESS)
         {
             switch(key)
@@ -235,6 +281,11 @@ namespace gui
         handle->seekCb = seekCb;
     }
 
+    void SetPreviewCallback(Handle* handle, PreviewCb previewCb)
+    {
+        handle->previewCb = previewCb;
+    }
+
     void SetPauseCallback(Handle* handle, PauseCb pauseCb)
     {
         handle->pauseCb = pauseCb;
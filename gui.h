@@ -22,7 +22,10 @@ namespace gui
 
     typedef boost::function<void (Handle*, uint32_t, uint32_t)> WindowSizeChangeCb;
     typedef boost::function<void (Handle*, const std::string&)> FileDropCb;
-    typedef boost::function<void (Handle*, double)> SeekCb;
+    // scrub is true while the seek bar is dragged, false on release
+    typedef boost::function<void (Handle*, double, bool)> SeekCb;
+    // seek bar thumbnail at percent, visible while shift is held over the window
+    typedef boost::function<void (Handle*, double, bool)> PreviewCb;
     typedef boost::function<void (Handle*)> PauseCb;
     typedef boost::function<void (Handle*)> SubtitleCb;
 
@@ -33,6 +36,7 @@ namespace gui
         WindowSizeChangeCb sizeChangeCb;
         FileDropCb fileDropCb;
         SeekCb seekCb;
+        PreviewCb previewCb;
         PauseCb pauseCb;
         SubtitleCb subtitleCb;
 
@@ -46,6 +50,8 @@ namespace gui
 
         bool mouseButtonPress = false;
         bool mouseButtonShift = false;
+        bool scrubbing = false;
+        bool previewVisible = false;
         uint64_t mouseReleaseTimeUs = 0;
     };
 
@@ -61,6 +67,7 @@ namespace gui
     void   SetWindowSizeChangeCallback(Handle*, WindowSizeChangeCb);
     void   SetFileDropCallback(Handle*, FileDropCb);
     void   SetSeekCallback(Handle*, SeekCb);
+    void   SetPreviewCallback(Handle*, PreviewCb);
     void   SetPauseCallback(Handle*, PauseCb);
     void   SetSubtitleCallback(Handle*, SubtitleCb);
 
@@ -0,0 +1,432 @@
+#include "precomp.h"
+#include "interleave.h"
+#include "chrono.h"
+#include "logger.h"
+
+#include <map>
+#include <vector>
+#include <string.h>
+#include <assert.h>
+#include <stddef.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// x86-64 baseline, the kernels without an AVX2 build fall back to 128 bits
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HAVE_SSE2
+#endif
+
+namespace {
+
+    // samples are copied as raw bits, use unsigned types of the sample size
+    template<uint32_t SampleSize> struct Sample;
+    template<> struct Sample<1> { typedef uint8_t Type; };
+    template<> struct Sample<2> { typedef uint16_t Type; };
+    template<> struct Sample<4> { typedef uint32_t Type; };
+    template<> struct Sample<8> { typedef uint64_t Type; };
+
+    template<typename T, uint32_t Channels>
+    void InterleaveScalar(const T* const* in, T* out, uint32_t start, uint32_t nbSamples)
+    {
+        for(uint32_t i = start; i < nbSamples; i++)
+        {
+            for(uint32_t ch = 0; ch < Channels; ch++)
+            {
+                out[i * Channels + ch] = in[ch][i];
+            }
+        }
+    }
+
+    // planar to interleaved, channel count known at compile time
+    template<typename T, uint32_t Channels>
+    struct Planar
+    {
+        static void Run(const uint8_t* const* input, const uint32_t* permutation, uint32_t, uint8_t* output, uint32_t nbSamples)
+        {
+            const T* in[Channels];
+            for(uint32_t ch = 0; ch < Channels; ch++)
+            {
+                in[ch] = reinterpret_cast<const T*>(input[permutation[ch]]);
+            }
+            InterleaveScalar<T, Channels>(in, reinterpret_cast<T*>(output), 0, nbSamples);
+        }
+    };
+
+#ifdef HAVE_SSE2
+    // 16 bits stereo
+    template<>
+    struct Planar<uint16_t, 2>
+    {
+        static void Run(const uint8_t* const* input, const uint32_t* permutation, uint32_t, uint8_t* output, uint32_t nbSamples)
+        {
+            const uint16_t* in[2] = { reinterpret_cast<const uint16_t*>(input[permutation[0]]),
+                                      reinterpret_cast<const uint16_t*>(input[permutation[1]]) };
+            uint16_t* out = reinterpret_cast<uint16_t*>(output);
+
+            uint32_t i = 0;
+            for(; i + 8 <= nbSamples; i += 8)
+            {
+                const __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[0] + i));
+                const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[1] + i));
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), _mm_unpacklo_epi16(l, r));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 8), _mm_unpackhi_epi16(l, r));
+            }
+            InterleaveScalar<uint16_t, 2>(in, out, i, nbSamples);
+        }
+    };
+#endif
+
+#ifdef __AVX2__
+    // 32 bits stereo
+    template<>
+    struct Planar<uint32_t, 2>
+    {
+        static void Run(const uint8_t* const* input, const uint32_t* permutation, uint32_t, uint8_t* output, uint32_t nbSamples)
+        {
+            const uint32_t* in[2] = { reinterpret_cast<const uint32_t*>(input[permutation[0]]),
+                                      reinterpret_cast<const uint32_t*>(input[permutation[1]]) };
+            uint32_t* out = reinterpret_cast<uint32_t*>(output);
+
+            uint32_t i = 0;
+            for(; i + 8 <= nbSamples; i += 8)
+            {
+                const __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in[0] + i));
+                const __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in[1] + i));
+
+                // l0 r0 l1 r1 | l4 r4 l5 r5 and l2 r2 l3 r3 | l6 r6 l7 r7
+                const __m256i lo = _mm256_unpacklo_epi32(l, r);
+                const __m256i hi = _mm256_unpackhi_epi32(l, r);
+
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+            }
+            InterleaveScalar<uint32_t, 2>(in, out, i, nbSamples);
+        }
+    };
+
+    // 32 bits 7.1, 8x8 transpose
+    template<>
+    struct Planar<uint32_t, 8>
+    {
+        static void Run(const uint8_t* const* input, const uint32_t* permutation, uint32_t, uint8_t* output, uint32_t nbSamples)
+        {
+            const uint32_t* in[8];
+            for(uint32_t ch = 0; ch < 8; ch++)
+            {
+                in[ch] = reinterpret_cast<const uint32_t*>(input[permutation[ch]]);
+            }
+            uint32_t* out = reinterpret_cast<uint32_t*>(output);
+
+            uint32_t i = 0;
+            for(; i + 8 <= nbSamples; i += 8)
+            {
+                __m256i r[8];
+                for(uint32_t ch = 0; ch < 8; ch++)
+                {
+                    r[ch] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in[ch] + i));
+                }
+
+                const __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+                const __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+                const __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+                const __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+                const __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+                const __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+                const __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+                const __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+                const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+                const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+                const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+                const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+                const __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+                const __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+                const __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+                const __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+                __m256i* o = reinterpret_cast<__m256i*>(out + 8 * i);
+                _mm256_storeu_si256(o + 0, _mm256_permute2x128_si256(u0, u4, 0x20));
+                _mm256_storeu_si256(o + 1, _mm256_permute2x128_si256(u1, u5, 0x20));
+                _mm256_storeu_si256(o + 2, _mm256_permute2x128_si256(u2, u6, 0x20));
+                _mm256_storeu_si256(o + 3, _mm256_permute2x128_si256(u3, u7, 0x20));
+                _mm256_storeu_si256(o + 4, _mm256_permute2x128_si256(u0, u4, 0x31));
+                _mm256_storeu_si256(o + 5, _mm256_permute2x128_si256(u1, u5, 0x31));
+                _mm256_storeu_si256(o + 6, _mm256_permute2x128_si256(u2, u6, 0x31));
+                _mm256_storeu_si256(o + 7, _mm256_permute2x128_si256(u3, u7, 0x31));
+            }
+            InterleaveScalar<uint32_t, 8>(in, out, i, nbSamples);
+        }
+    };
+#elif defined(HAVE_SSE2)
+    // 32 bits stereo
+    template<>
+    struct Planar<uint32_t, 2>
+    {
+        static void Run(const uint8_t* const* input, const uint32_t* permutation, uint32_t, uint8_t* output, uint32_t nbSamples)
+        {
+            const uint32_t* in[2] = { reinterpret_cast<const uint32_t*>(input[permutation[0]]),
+                                      reinterpret_cast<const uint32_t*>(input[permutation[1]]) };
+            uint32_t* out = reinterpret_cast<uint32_t*>(output);
+
+            uint32_t i = 0;
+            for(; i + 4 <= nbSamples; i += 4)
+            {
+                const __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[0] + i));
+                const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[1] + i));
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), _mm_unpacklo_epi32(l, r));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 4), _mm_unpackhi_epi32(l, r));
+            }
+            InterleaveScalar<uint32_t, 2>(in, out, i, nbSamples);
+        }
+    };
+
+    // 32 bits 7.1, two 4x4 transposes per 4 samples
+    template<>
+    struct Planar<uint32_t, 8>
+    {
+        static void Run(const uint8_t* const* input, const uint32_t* permutation, uint32_t, uint8_t* output, uint32_t nbSamples)
+        {
+            const uint32_t* in[8];
+            for(uint32_t ch = 0; ch < 8; ch++)
+            {
+                in[ch] = reinterpret_cast<const uint32_t*>(input[permutation[ch]]);
+            }
+            uint32_t* out = reinterpret_cast<uint32_t*>(output);
+
+            uint32_t i = 0;
+            for(; i + 4 <= nbSamples; i += 4)
+            {
+                __m128i* o = reinterpret_cast<__m128i*>(out + 8 * i);
+
+                // channels 0-3 fill the even vectors, 4-7 the odd ones
+                for(uint32_t half = 0; half < 2; half++)
+                {
+                    const uint32_t* const* group = in + 4 * half;
+                    const __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group[0] + i));
+                    const __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group[1] + i));
+                    const __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group[2] + i));
+                    const __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group[3] + i));
+
+                    const __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+                    const __m128i t1 = _mm_unpackhi_epi32(r0, r1);
+                    const __m128i t2 = _mm_unpacklo_epi32(r2, r3);
+                    const __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+                    _mm_storeu_si128(o + half + 0, _mm_unpacklo_epi64(t0, t2));
+                    _mm_storeu_si128(o + half + 2, _mm_unpackhi_epi64(t0, t2));
+                    _mm_storeu_si128(o + half + 4, _mm_unpacklo_epi64(t1, t3));
+                    _mm_storeu_si128(o + half + 6, _mm_unpackhi_epi64(t1, t3));
+                }
+            }
+            InterleaveScalar<uint32_t, 8>(in, out, i, nbSamples);
+        }
+    };
+#endif
+
+    // interleaved input, channels are reordered
+    template<typename T, uint32_t Channels>
+    struct Packed
+    {
+        static void Run(const uint8_t* const* input, const uint32_t* permutation, uint32_t, uint8_t* output, uint32_t nbSamples)
+        {
+            bool identity = true;
+            for(uint32_t ch = 0; ch < Channels; ch++)
+            {
+                identity = identity && permutation[ch] == ch;
+            }
+
+            if(identity)
+            {
+                memcpy(output, input[0], static_cast<size_t>(nbSamples) * Channels * sizeof(T));
+                return;
+            }
+
+            const T* in = reinterpret_cast<const T*>(input[0]);
+            T* out = reinterpret_cast<T*>(output);
+
+            for(uint32_t i = 0; i < nbSamples; i++)
+            {
+                for(uint32_t ch = 0; ch < Channels; ch++)
+                {
+                    out[i * Channels + ch] = in[i * Channels + permutation[ch]];
+                }
+            }
+        }
+    };
+
+    // channel count known at runtime
+    template<typename T>
+    void PlanarGeneric(const uint8_t* const* input, const uint32_t* permutation, uint32_t channels, uint8_t* output, uint32_t nbSamples)
+    {
+        T* out = reinterpret_cast<T*>(output);
+        for(uint32_t ch = 0; ch < channels; ch++)
+        {
+            const T* in = reinterpret_cast<const T*>(input[permutation[ch]]);
+            for(uint32_t i = 0; i < nbSamples; i++)
+            {
+                out[i * channels + ch] = in[i];
+            }
+        }
+    }
+
+    template<typename T>
+    void PackedGeneric(const uint8_t* const* input, const uint32_t* permutation, uint32_t channels, uint8_t* output, uint32_t nbSamples)
+    {
+        const T* in = reinterpret_cast<const T*>(input[0]);
+        T* out = reinterpret_cast<T*>(output);
+        for(uint32_t i = 0; i < nbSamples; i++)
+        {
+            for(uint32_t ch = 0; ch < channels; ch++)
+            {
+                out[i * channels + ch] = in[i * channels + permutation[ch]];
+            }
+        }
+    }
+
+    template<typename T, uint32_t Channels>
+    interleave::Function GetFunction(bool planar)
+    {
+        return planar ? Planar<T, Channels>::Run : Packed<T, Channels>::Run;
+    }
+
+    template<typename T>
+    interleave::Function GetFunction(uint32_t channels, bool planar)
+    {
+        switch(channels)
+        {
+            case 1: return GetFunction<T, 1>(planar);
+            case 2: return GetFunction<T, 2>(planar);
+            case 3: return GetFunction<T, 3>(planar);
+            case 4: return GetFunction<T, 4>(planar);
+            case 5: return GetFunction<T, 5>(planar);
+            case 6: return GetFunction<T, 6>(planar);
+            case 7: return GetFunction<T, 7>(planar);
+            case 8: return GetFunction<T, 8>(planar);
+            default:
+                break;
+        }
+        return planar ? PlanarGeneric<T> : PackedGeneric<T>;
+    }
+
+    // per sample map lookup and byte copy loop used before the kernels
+    void InterleaveReference(const uint8_t* const* input, const std::map<uint32_t, uint32_t>& inputToOutputMapping,
+                             uint32_t sampleSize, uint32_t channels, uint8_t* samples, uint32_t nbSamples)
+    {
+        uint32_t pos = 0;
+
+        for(uint32_t i = 0; i < nbSamples; i++ )
+        {
+            for( uint32_t ch = 0; ch < channels; ch++)
+            {
+                std::map<uint32_t, uint32_t>::const_iterator it = inputToOutputMapping.find(ch);
+                assert(it != inputToOutputMapping.end());
+
+                const uint32_t outputChannel = it->second;
+                const uint8_t* data  = input[outputChannel] + static_cast<ptrdiff_t>(static_cast<size_t>(sampleSize)*static_cast<size_t>(i));
+
+                for( uint32_t j = 0; j < sampleSize; j++ )
+                {
+                    samples[pos++] = data[j];
+                }
+            }
+        }
+    }
+
+    Result Benchmark(uint32_t sampleSize, uint32_t channels)
+    {
+        const uint32_t sampleRate = 48000;
+        const uint32_t nbSamples = 1024;
+        const uint32_t nbSeconds = 60;
+        const uint32_t iterations = nbSeconds * sampleRate / nbSamples;
+        const size_t planeSize = static_cast<size_t>(nbSamples) * sampleSize;
+
+        std::vector<std::vector<uint8_t>> planes(channels, std::vector<uint8_t>(planeSize));
+        std::vector<const uint8_t*> input(channels);
+        std::map<uint32_t, uint32_t> mapping;
+        std::vector<uint32_t> permutation(channels);
+
+        for(uint32_t ch = 0; ch < channels; ch++)
+        {
+            for(size_t i = 0; i < planeSize; i++)
+            {
+                planes[ch][i] = static_cast<uint8_t>(ch * 31 + i);
+            }
+            input[ch] = planes[ch].data();
+
+            // reversed channel order
+            mapping[ch] = channels - ch - 1;
+            permutation[ch] = mapping[ch];
+        }
+
+        std::vector<uint8_t> referenceOutput(planeSize * channels);
+        std::vector<uint8_t> output(planeSize * channels);
+
+        interleave::Function function = interleave::GetFunction(sampleSize, channels, true);
+        if(!function)
+        {
+            return Result(false, "No interleave kernel for sample size %d", sampleSize);
+        }
+
+        uint64_t startTimeUs = chrono::RealNow();
+        for(uint32_t i = 0; i < iterations; i++)
+        {
+            InterleaveReference(input.data(), mapping, sampleSize, channels, referenceOutput.data(), nbSamples);
+        }
+        const uint64_t referenceTimeUs = chrono::RealNow() - startTimeUs;
+
+        startTimeUs = chrono::RealNow();
+        for(uint32_t i = 0; i < iterations; i++)
+        {
+            function(input.data(), permutation.data(), channels, output.data(), nbSamples);
+        }
+        const uint64_t kernelTimeUs = chrono::RealNow() - startTimeUs;
+
+        if(referenceOutput != output)
+        {
+            return Result(false, "Interleave kernel mismatch sample size %d channels %d", sampleSize, channels);
+        }
+
+        logger::Info("Interleave %d bytes %d channels %ds audio: reference %f ms kernel %f ms speedup %fx",
+                     sampleSize, channels, nbSeconds, chrono::Milliseconds(referenceTimeUs), chrono::Milliseconds(kernelTimeUs),
+                     static_cast<double>(referenceTimeUs) / static_cast<double>(std::max<uint64_t>(kernelTimeUs, 1)));
+
+        return Result(true);
+    }
+}
+
+namespace interleave
+{
+    Function GetFunction(uint32_t sampleSize, uint32_t channels, bool planar)
+    {
+        switch(sampleSize)
+        {
+            case 1: return ::GetFunction<Sample<1>::Type>(channels, planar);
+            case 2: return ::GetFunction<Sample<2>::Type>(channels, planar);
+            case 4: return ::GetFunction<Sample<4>::Type>(channels, planar);
+            case 8: return ::GetFunction<Sample<8>::Type>(channels, planar);
+            default:
+                break;
+        }
+        return nullptr;
+    }
+
+    Result Benchmark()
+    {
+        const uint32_t configs[][2] = { {2, 2}, {4, 2}, {4, 6}, {4, 8}, {8, 2} };
+
+        for(auto config : configs)
+        {
+            Result result = ::Benchmark(config[0], config[1]);
+            if(!result)
+            {
+                return result;
+            }
+        }
+        return Result(true);
+    }
+}
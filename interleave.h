@@ -0,0 +1,21 @@
+#pragma once
+
+#include "result.h"
+
+#include <stdint.h>
+
+namespace interleave
+{
+    static const uint32_t MAX_SPECIALIZED_CHANNELS = 8;
+
+    // Convert decoded audio samples to interleaved output.
+    // Output channel ch is read from input channel permutation[ch].
+    // Planar input has one buffer per channel, packed input a single interleaved buffer.
+    typedef void (*Function)(const uint8_t* const* input, const uint32_t* permutation, uint32_t channels, uint8_t* output, uint32_t nbSamples);
+
+    // Get the kernel specialized for a sample size, a channel count and input layout
+    Function GetFunction(uint32_t sampleSize, uint32_t channels, bool planar);
+
+    // Compare kernels against a per sample map lookup loop
+    Result Benchmark();
+}
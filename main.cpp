@@ -6,6 +6,7 @@
 #include <string>
 #include <cstring>
 #include <iostream>
+#include <cmath>
 
 #include "mediadecoder.h"
 #include "audiodevice.h"
@@ -15,6 +16,15 @@
 #include "profiler.h"
 #include "logger.h"
 #include "chrono.h"
+#include "interleave.h"
+#include "seekbench.h"
+#include "playbench.h"
+#include "netbench.h"
+#include "decodebench.h"
+#include "audiobench.h"
+#include "chunkbuffer.h"
+#include "curl.h"
+#include "thumbnail.h"
 
 #include "result.h"
 
@@ -41,13 +51,25 @@ namespace {
         }
     }
 
-    void SeekCallback(gui::Handle* handle, double percent, player::Player* player)
+    void SeekCallback(gui::Handle* handle, double percent, bool scrub, player::Player* player)
     {
         const uint64_t duration = player::GetDuration(player);
         const double pos = static_cast<double>(duration) * percent;
 
         logger::Debug("SeekCallback duration %f s percent %f %% pos %f s" , chrono::Seconds(duration), percent, chrono::Seconds(static_cast<uint64_t>(pos)));
-        player::Seek(player, static_cast<uint64_t>(pos));
+        if( scrub )
+        {
+            player::Scrub(player, static_cast<uint64_t>(pos));
+        }
+        else
+        {
+            player::Seek(player, static_cast<uint64_t>(pos));
+        }
+    }
+
+    void PreviewCallback(gui::Handle* handle, double percent, bool visible, player::Player* player)
+    {
+        player::SetPreview(player, percent, visible);
     }
 
     void PauseCallback(gui::Handle* handle, player::Player* player)
@@ -138,6 +160,244 @@ void EnableProfiler(bool enable)
     profiler::Enable(enable);
 }
 
+void EnableZeroCopy(bool enable)
+{
+    mediadecoder::SetZeroCopy(enable);
+}
+
+void EnableHugePages(bool enable)
+{
+    mediadecoder::SetHugePages(enable);
+}
+
+void SetQueueBudget(uint32_t megabytes)
+{
+    mediadecoder::SetQueueBudget(static_cast<uint64_t>(megabytes) * 1024 * 1024);
+}
+
+void SetPreRollDuration(double seconds)
+{
+    mediadecoder::SetPreRollDuration(chrono::Microseconds(seconds));
+}
+
+void SetReadAheadDuration(double seconds)
+{
+    mediadecoder::SetReadAheadDuration(chrono::Microseconds(seconds));
+}
+
+void SetReadAheadBudget(uint32_t megabytes)
+{
+    mediadecoder::SetReadAheadBudget(static_cast<uint64_t>(megabytes) * 1024 * 1024);
+}
+
+void EnableThumbnails(bool enable)
+{
+    player::SetThumbnails(enable);
+}
+
+void SetThumbnailCpuBudget(double percent)
+{
+    thumbnail::SetCpuBudget(percent / 100.0);
+}
+
+void SetScaleThreads(uint32_t threads)
+{
+    mediadecoder::SetScaleThreads(threads);
+}
+
+void SetDecoderThreads(uint32_t threads)
+{
+    mediadecoder::SetDecoderThreads(threads);
+}
+
+void SetDecoderThreadType(std::string type)
+{
+    mediadecoder::ThreadType threadType = mediadecoder::GetThreadTypeFromString(type);
+    if( threadType == mediadecoder::THREAD_TYPE_INVALID )
+    {
+        logger::Error("Invalid thread type %s", type.c_str() );
+        exit(1);
+    }
+
+    mediadecoder::SetDecoderThreadType(threadType);
+}
+
+Result RunMicroBenchmark(const std::string& name, const std::string& path)
+{
+    if( name == "interleave" )
+    {
+        return interleave::Benchmark();
+    }
+    else if( name == "netbuffer" )
+    {
+        return chunkbuffer::Benchmark();
+    }
+    else if( name == "audiowrite" )
+    {
+        return audiobench::Run();
+    }
+    else if( name == "netfetch" )
+    {
+        return netbench::Run(path);
+    }
+    else if( name == "seekstorm" )
+    {
+        if( path.empty() )
+        {
+            return Result(false, "seekstorm requires a media path");
+        }
+        return seekbench::Run(path);
+    }
+    else if( name == "playcheck" )
+    {
+        return playbench::Run(path);
+    }
+    return Result(false, "Unknown microbenchmark %s", name.c_str());
+}
+
+void SetClockSpeed(double speed)
+{
+    if( speed <= 0.0 )
+    {
+        logger::Error("Invalid clock speed %f", speed );
+        exit(1);
+    }
+
+    if( speed != 1.0 )
+    {
+        chrono::SetScaledClock(speed);
+    }
+}
+
+void SetAudioBackend(std::string name)
+{
+    audiodevice::Backend backend = audiodevice::GetBackendFromString(name);
+    if( backend == audiodevice::BACKEND_INVALID )
+    {
+        logger::Error("Invalid audio device %s", name.c_str() );
+        exit(1);
+    }
+
+    audiodevice::SetBackend(backend);
+}
+
+void EnableAudioMmap(bool enable)
+{
+    audiodevice::SetMmap(enable);
+}
+
+void SetAudioLatency(uint32_t milliseconds)
+{
+    audiodevice::SetLatency(milliseconds);
+}
+
+void SetNetConnections(uint32_t connections)
+{
+    if( connections == 0 )
+    {
+        logger::Error("Invalid network connections %d", connections );
+        exit(1);
+    }
+
+    curl::SetConnections(connections);
+}
+
+void SetNetWindow(uint32_t megabytes)
+{
+    curl::SetWindowSize(static_cast<uint64_t>(megabytes) * 1024 * 1024);
+}
+
+void SetVideoBackend(std::string name)
+{
+    videodevice::Backend backend = videodevice::GetBackendFromString(name);
+    if( backend == videodevice::BACKEND_INVALID )
+    {
+        logger::Error("Invalid video device %s", name.c_str() );
+        exit(1);
+    }
+
+    videodevice::SetBackend(backend);
+}
+
+// play without window until the end of the file and report frame pacing & audio consumption
+int RunHeadless(const std::string& path, std::shared_ptr<subtitle::SubRip> srt)
+{
+    if( path.empty() )
+    {
+        logger::Error("Null video device requires a media path");
+        return 1;
+    }
+
+    player::Player* player = nullptr;
+
+    Result result = player::Init( [](){} );
+    if(result)
+    {
+        result = player::Create(player);
+    }
+    if(result)
+    {
+        result = player::Open(player, path);
+    }
+    if(!result)
+    {
+        logger::Error("Unable to open %s: %s", path.c_str(), result.getError().c_str());
+        return 1;
+    }
+
+    if(srt)
+    {
+        player::AddSubtitleTrack(player, srt);
+    }
+
+    player::Play(player);
+
+    while( !player::IsEndOfStream(player) )
+    {
+        player::Present(player);
+        profiler::Print();
+    }
+
+    if(player->videoDevice)
+    {
+        videodevice::FrameStats stats;
+        videodevice::GetFrameStats(player->videoDevice, stats);
+
+        const uint64_t intervals = stats.frames > 1 ? stats.frames - 1 : 1;
+        const double averageUs = static_cast<double>(stats.totalIntervalUs) / static_cast<double>(intervals);
+        const double variance = stats.intervalSquaresUs / static_cast<double>(intervals) - averageUs * averageUs;
+
+        logger::Info("Frame pacing: %lu frames interval avg %f ms min %f ms max %f ms stddev %f ms", stats.frames,
+                     chrono::Milliseconds(averageUs), chrono::Milliseconds(stats.frames > 1 ? stats.minIntervalUs : 0),
+                     chrono::Milliseconds(stats.maxIntervalUs), chrono::Milliseconds(std::sqrt(std::max(variance, 0.0))));
+    }
+
+    if( player->audioDevice )
+    {
+        logger::Info("Audio device latency %f ms", chrono::Milliseconds(audiodevice::GetLatency(player->audioDevice)));
+    }
+
+    audiodevice::SinkStats sinkStats;
+    if( audiodevice::GetSinkStats(player->audioDevice, sinkStats) )
+    {
+        logger::Info("Audio sink: %lu frames written %lu consumed %d underruns", 
+                     sinkStats.framesWritten, sinkStats.framesConsumed, sinkStats.underruns);
+    }
+
+    avsync::Stats syncStats;
+    player::GetAvSyncStats(player, syncStats);
+    if( syncStats.updates != 0 )
+    {
+        logger::Info("A/V offset: avg %f ms min %f ms max %f ms %lu slews %lu resyncs %lu dropped %lu repeated",
+                     chrono::Milliseconds(syncStats.absOffsetSumUs / static_cast<double>(syncStats.updates)),
+                     chrono::Milliseconds(static_cast<double>(syncStats.minOffsetUs)), chrono::Milliseconds(static_cast<double>(syncStats.maxOffsetUs)),
+                     syncStats.slews, syncStats.resyncs, syncStats.droppedFrames, syncStats.repeatedFrames);
+    }
+
+    player::Destroy(player);
+    return 0;
+}
+
 void SetLogLevel(std::string level)
 {
     logger::Level logLevel = logger::GetLevelFromString(level);
@@ -223,8 +483,31 @@ int main(int argc, char** argv)
           ("help,h", "Print program options.")
           ("path", boost::program_options::value<std::string>(), "Path the the media file.")
           ("profiler", boost::program_options::bool_switch()->default_value(false)->notifier(EnableProfiler), "Enable profiling.")
+          ("zerocopy", boost::program_options::bool_switch()->default_value(false)->notifier(EnableZeroCopy), "Hand-off native format decoded video frames to the renderer without copy.")
+          ("hugepages", boost::program_options::bool_switch()->default_value(false)->notifier(EnableHugePages), "Back the decoded frame arenas with huge pages.")
+          ("queuebudget", boost::program_options::value<uint32_t>()->default_value(512)->notifier(SetQueueBudget), "Decoded frame queues memory budget in MB.")
+          ("preroll", boost::program_options::value<double>()->default_value(10.0)->notifier(SetPreRollDuration), "Decoded frame queues duration in seconds.")
+          ("readahead", boost::program_options::value<double>()->default_value(60.0)->notifier(SetReadAheadDuration), "Compressed packets read-ahead duration in seconds.")
+          ("readaheadbudget", boost::program_options::value<uint32_t>()->default_value(256)->notifier(SetReadAheadBudget), "Compressed packets read-ahead memory budget in MB.")
+          ("scalethreads", boost::program_options::value<uint32_t>()->default_value(0)->notifier(SetScaleThreads), "Number of threads converting video frames: 0 one per core up to 4, 1 disables sliced conversion.")
+          ("threads", boost::program_options::value<uint32_t>()->default_value(0)->notifier(SetDecoderThreads), "Number of video decoder threads: 0 one per core.")
+          ("threadtype", boost::program_options::value<std::string>()->notifier(SetDecoderThreadType), "Video decoder threading: auto, frame or slice.")
+          ("thumbnails", boost::program_options::value<bool>()->default_value(true)->notifier(EnableThumbnails), "Extract seek bar thumbnails in the background, shown while shift is held.")
+          ("thumbnailcpu", boost::program_options::value<double>()->default_value(10.0)->notifier(SetThumbnailCpuBudget), "Thumbnail extraction CPU budget in percent of one core.")
+          ("thumbnailcache", boost::program_options::value<std::string>(), "Thumbnail cache directory, the temporary directory by default.")
           ("loglevel", boost::program_options::value<std::string>(), "Specify log level: debug, info, warning or error.")
-          ("srt", boost::program_options::value<std::string>(), "Specify a subtitle srt file path.");
+          ("srt", boost::program_options::value<std::string>(), "Specify a subtitle srt file path.")
+          ("audiodevice", boost::program_options::value<std::string>()->default_value("default")->notifier(SetAudioBackend), "Audio output: default, null (consumed at the sample rate) or wav.")
+          ("wav", boost::program_options::value<std::string>(), "Wav file written by the wav audio device.")
+          ("audiolatency", boost::program_options::value<uint32_t>()->default_value(0)->notifier(SetAudioLatency), "ALSA buffer latency in ms negotiated in explicit periods on a hw: device, 0 keeps the default device buffering.")
+          ("audiommap", boost::program_options::bool_switch()->default_value(false)->notifier(EnableAudioMmap), "Interleave audio straight into the ALSA device buffer with mmap access.")
+          ("alsadevice", boost::program_options::value<std::string>(), "ALSA pcm device, e.g. hw:0,0 or plughw:0,0.")
+          ("netconnections", boost::program_options::value<uint32_t>()->default_value(1)->notifier(SetNetConnections), "Concurrent range requests downloading network streams, 1 streams on a single connection.")
+          ("netwindow", boost::program_options::value<uint32_t>()->default_value(0)->notifier(SetNetWindow), "Network bytes in MB fetched ahead of the read position by concurrent range requests, 0 is 8 MB per connection.")
+          ("videodevice", boost::program_options::value<std::string>()->default_value("opengl")->notifier(SetVideoBackend), "Video output: opengl or null (no window, plays path to the end).")
+          ("clockspeed", boost::program_options::value<double>()->default_value(1.0)->notifier(SetClockSpeed), "Playback clock speed factor, faster than real time with null devices.")
+          ("microbench", boost::program_options::value<std::string>(), "Run a microbenchmark and exit: interleave, netbuffer, netfetch (path url or a throttled loopback server), audiowrite (8 channels to the audio device), seekstorm (on path) or playcheck (path through the null devices on a virtual clock, fails on late, dropped or drifting frames).")
+          ("bench", boost::program_options::bool_switch()->default_value(false), "Decode path as fast as possible without window nor audio device, print json stats and exit.");
 
         boost::program_options::variables_map vm;
         boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
@@ -241,11 +524,60 @@ int main(int argc, char** argv)
             path = vm["path"].as<std::string>();
         }
 
+        // stdout is kept for the json report
+        if( vm["bench"].as<bool>() )
+        {
+            logger::SetLevel(logger::WARNING);
+        }
+
         if( vm.count("loglevel") )
         {
             SetLogLevel(vm["loglevel"].as<std::string>());
         }
 
+        if( vm.count("thumbnailcache") )
+        {
+            thumbnail::SetCacheDirectory(vm["thumbnailcache"].as<std::string>());
+        }
+
+        if( vm.count("wav") )
+        {
+            audiodevice::SetWavPath(vm["wav"].as<std::string>());
+        }
+
+        if( vm.count("alsadevice") )
+        {
+            audiodevice::SetPcmName(vm["alsadevice"].as<std::string>());
+        }
+
+        if( vm.count("microbench") )
+        {
+            Result result = RunMicroBenchmark(vm["microbench"].as<std::string>(), path);
+            if(!result)
+            {
+                logger::Error("Microbenchmark failed: %s", result.getError().c_str());
+                return 1;
+            }
+            return 0;
+        }
+
+        if( vm["bench"].as<bool>() )
+        {
+            if( path.empty() )
+            {
+                logger::Error("Benchmark requires a media path");
+                return 1;
+            }
+
+            Result result = decodebench::Run(path);
+            if(!result)
+            {
+                logger::Error("Benchmark failed: %s", result.getError().c_str());
+                return 1;
+            }
+            return 0;
+        }
+
         if( vm.count("srt") )
         {
             const std::string srtPath = vm["srt"].as<std::string>();
@@ -269,6 +601,11 @@ int main(int argc, char** argv)
     }
 
 
+    if( videodevice::GetBackend() == videodevice::BACKEND_NULL )
+    {
+        return RunHeadless(path, srt);
+    }
+
     // gui 
     gui::Handle* uiHandle = nullptr;
 
@@ -340,7 +677,10 @@ int main(int argc, char** argv)
                   = boost::bind(FileDropCallback, _1, _2, player);
 
     gui::SeekCb seekCallback
-                  = boost::bind(SeekCallback, _1, _2, player);
+                  = boost::bind(SeekCallback, _1, _2, _3, player);
+
+    gui::PreviewCb previewCallback
+                  = boost::bind(PreviewCallback, _1, _2, _3, player);
 
     gui::PauseCb pauseCallback
                   = boost::bind(PauseCallback, _1, player);
@@ -351,6 +691,7 @@ int main(int argc, char** argv)
     gui::SetWindowSizeChangeCallback(uiHandle, windowSizeChangeCallback);
     gui::SetFileDropCallback(uiHandle, fileDropCallback);
     gui::SetSeekCallback(uiHandle, seekCallback);
+    gui::SetPreviewCallback(uiHandle, previewCallback);
     gui::SetPauseCallback(uiHandle, pauseCallback);
     gui::SetSubtitleCallback(uiHandle, subtitleCallback);
 
@@ -15,13 +15,37 @@
 #include <vector>
 #include <thread>
 #include <algorithm>
+#include <cmath>
 
 #include <stdlib.h>
 #include <malloc.h>
 
 namespace {
-    const uint32_t QUEUE_FULL_SLEEP_TIME_MS = 200;
-    const uint32_t WAIT_PLAYBACK_SLEEP_TIME_MS = 100;
+    // maximum wait time before checking the queues again if no event was received
+    const uint32_t QUEUE_FULL_WAIT_TIME_MS = 200;
+    const uint32_t WAIT_PLAYBACK_WAIT_TIME_MS = 100;
+    const uint32_t PACKET_QUEUE_WAIT_TIME_MS = 100;
+
+    // hand-off decoder frames to the renderer without copying them
+    bool zeroCopyEnabled = false;
+
+    // number of threads converting video frames, 0 is one per core up to the slice count and MAX_AUTO_SCALE_THREADS
+    uint32_t scaleThreads = 0;
+
+    // back frame arenas with huge pages
+    bool hugePagesEnabled = false;
+
+    // decoded frame queues limits
+    uint64_t queueBudget = mediadecoder::DEFAULT_QUEUE_BUDGET_BYTES;
+    uint64_t preRollDurationUs = mediadecoder::DEFAULT_PRE_ROLL_US;
+
+    // compressed packets read-ahead limits
+    uint64_t readAheadDurationUs = mediadecoder::DEFAULT_READ_AHEAD_US;
+    uint64_t readAheadBudget = mediadecoder::DEFAULT_READ_AHEAD_BYTES;
+
+    // video decoder threading policy
+    uint32_t decoderThreads = 0;
+    mediadecoder::ThreadType decoderThreadType = mediadecoder::THREAD_TYPE_AUTO;
 
     // output channel mapping 
     const AudioChannelList ChannelMap2ChannelsDefault = {AC_CH_FRONT_LEFT, AC_CH_FRONT_RIGHT};
@@ -123,25 +147,29 @@ namespace {
     {
         SampleFormat sf = SF_FMT_INVALID;
 
+        // planar formats are interleaved before being sent to the audio device
         switch(f)
         {
             case AV_SAMPLE_FMT_U8:
+            case AV_SAMPLE_FMT_U8P:
                 sf = SF_FMT_U8;
                 break;
             case AV_SAMPLE_FMT_S16:
+            case AV_SAMPLE_FMT_S16P:
                 sf = SF_FMT_S16;
                 break;
             case AV_SAMPLE_FMT_S32:
+            case AV_SAMPLE_FMT_S32P:
                 sf = SF_FMT_S32;
                 break;
             case AV_SAMPLE_FMT_FLT:
+            case AV_SAMPLE_FMT_FLTP:
                 sf = SF_FMT_FLOAT;
                 break;
             case AV_SAMPLE_FMT_DBL:
+            case AV_SAMPLE_FMT_DBLP:
                 sf = SF_FMT_DOUBLE;
                 break;
-            case AV_SAMPLE_FMT_FLTP:
-                sf = SF_FMT_FLOAT;
             default:
                 break;
         }
@@ -149,6 +177,84 @@ namespace {
         return sf;
     }
 
+    AVSampleFormat SampleFormatToAVFormat(SampleFormat sf)
+    {
+        AVSampleFormat f = AV_SAMPLE_FMT_NONE;
+
+        switch(sf)
+        {
+            case SF_FMT_U8:
+                f = AV_SAMPLE_FMT_U8;
+                break;
+            case SF_FMT_S16:
+                f = AV_SAMPLE_FMT_S16;
+                break;
+            case SF_FMT_S32:
+                f = AV_SAMPLE_FMT_S32;
+                break;
+            case SF_FMT_FLOAT:
+                f = AV_SAMPLE_FMT_FLT;
+                break;
+            case SF_FMT_DOUBLE:
+                f = AV_SAMPLE_FMT_DBL;
+                break;
+            default:
+                break;
+        }
+
+        return f;
+    }
+
+    const char* ThreadTypeToString(int threadType)
+    {
+        switch(threadType)
+        {
+            case FF_THREAD_FRAME:
+                return "frame";
+            case FF_THREAD_SLICE:
+                return "slice";
+            default:
+                return "none";
+        }
+    }
+
+    // must be called before avcodec_open2, libavcodec sets up its threads when the codec is opened
+    void SetThreadingPolicy(AVCodecContext* codecContext, const AVCodec* codec)
+    {
+        const bool frameThreads = (codec->capabilities & AV_CODEC_CAP_FRAME_THREADS) != 0;
+        const bool sliceThreads = (codec->capabilities & AV_CODEC_CAP_SLICE_THREADS) != 0;
+
+        uint32_t threads = decoderThreads;
+        if(threads == 0)
+        {
+            threads = std::min(std::max(1U, std::thread::hardware_concurrency()), mediadecoder::MAX_AUTO_DECODER_THREADS);
+        }
+
+        // auto prefers frame threading, it scales with any stream but adds a frame of latency per thread.
+        // the requested type falls back to the other one when the codec does not support it.
+        int threadType = 0;
+        switch(decoderThreadType)
+        {
+            case mediadecoder::THREAD_TYPE_SLICE:
+                threadType = sliceThreads ? FF_THREAD_SLICE : (frameThreads ? FF_THREAD_FRAME : 0);
+                break;
+            default:
+                threadType = frameThreads ? FF_THREAD_FRAME : (sliceThreads ? FF_THREAD_SLICE : 0);
+                break;
+        }
+
+        if(threadType == 0 || threads == 1)
+        {
+            threads = 1;
+            threadType = 0;
+        }
+
+        logger::Info("Decoder %s threading requested: %d threads %s", codec->name, threads, ThreadTypeToString(threadType));
+
+        codecContext->thread_count = threads;
+        codecContext->thread_type = threadType;
+    }
+
     std::string ErrorToString(int errnum)
     {
         char buf[BUFSIZ];
@@ -156,42 +262,173 @@ namespace {
         return std::string(buf);
     }
 
-    Result Create(mediadecoder::Producer* producer, mediadecoder::VideoFrame*& frame, uint32_t width, uint32_t height, uint8_t** data, int32_t* linesize)
+    // rgb rows are tightly packed for the renderer, planar rows are aligned and rendered with their line size
+    void GetFrameLayout(AVPixelFormat format, uint32_t width, uint32_t height, mediadecoder::FrameLayout& layout)
+    {
+        const int32_t align = format == AV_PIX_FMT_RGB24 ? 1 : static_cast<int32_t>(framearena::ALIGNMENT);
+        const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+
+        layout = mediadecoder::FrameLayout();
+        layout.format = format;
+        layout.width = width;
+        layout.height = height;
+
+        av_image_fill_linesizes(layout.lineSize, format, FFALIGN(static_cast<int32_t>(width), align));
+
+        for(uint32_t i = 0; i < mediadecoder::NUM_FRAME_DATA_POINTERS && layout.lineSize[i] != 0; i++)
+        {
+            const uint32_t shift = (i == 1 || i == 2) ? desc->log2_chroma_h : 0;
+            const size_t planeHeight = (static_cast<size_t>(height) + (1ULL << shift) - 1) >> shift;
+
+            layout.offsets[i] = layout.size;
+            layout.size += FFALIGN(static_cast<size_t>(layout.lineSize[i]) * planeHeight, framearena::ALIGNMENT);
+        }
+    }
+
+    bool operator==(const mediadecoder::FrameLayout& lhs, const mediadecoder::FrameLayout& rhs)
+    {
+        return lhs.format == rhs.format && lhs.width == rhs.width && lhs.height == rhs.height;
+    }
+
+    void Delete(mediadecoder::VideoFrame* frame);
+
+    Result Create(mediadecoder::Producer* producer, mediadecoder::VideoFrame*& frame, const mediadecoder::FrameLayout& layout)
     {
         Result result;
-        if( !producer->videoFramePool->pop(frame) )
+        frame = nullptr;
+        if( producer->videoFramePool->pop(frame) && (frame->avFrame || frame->format != layout.format || 
+                                                      frame->width != layout.width || frame->height != layout.height) )
         {
-            frame = new mediadecoder::VideoFrame();
+            // pooled frame has another format
+            Delete(frame);
+            frame = nullptr;
+        }
+
+        if( frame )
+        {
+            return result;
+        }
+
+        // format change, frames in flight keep the previous arena alive
+        if( producer->videoArena && !(producer->videoArenaLayout == layout) )
+        {
+            logger::Info("Video frame arena format changed to %dx%d", layout.width, layout.height);
+            framearena::Release(producer->videoArena);
+        }
 
-            for(uint32_t i = 0; i < mediadecoder::NUM_FRAME_DATA_POINTERS; i++)
+        if( !producer->videoArena && producer->videoArenaSlots > 0 )
+        {
+            result = framearena::Create(producer->videoArena, layout.size, producer->videoArenaSlots, hugePagesEnabled);
+            if(!result)
             {
-                if(data[i] != nullptr && linesize[i] != 0)
-                {
-                    frame->buffers[i] = reinterpret_cast<uint8_t*>(av_malloc(static_cast<size_t>(linesize[i]) * static_cast<size_t>(height)));
-                    frame->lineSize[i] = linesize[i];
-                }
+                return result;
             }
-            frame->width = width;
-            frame->height = height;
+            producer->videoArenaLayout = layout;
+        }
+
+        frame = new mediadecoder::VideoFrame();
+
+        uint8_t* memory = producer->videoArena ? framearena::Allocate(producer->videoArena) : nullptr;
+        if( memory )
+        {
+            frame->arena = producer->videoArena;
+        }
+        else
+        {
+            memory = reinterpret_cast<uint8_t*>(av_malloc(layout.size));
+            profiler::Count(profiler::COUNTER_FRAME_ALLOCATIONS, 1);
         }
+        frame->memory = memory;
+
+        for(uint32_t i = 0; i < mediadecoder::NUM_FRAME_DATA_POINTERS; i++)
+        {
+            frame->buffers[i] = layout.lineSize[i] != 0 ? memory + layout.offsets[i] : nullptr;
+            frame->lineSize[i] = layout.lineSize[i];
+        }
+        frame->format = layout.format;
+        frame->width = layout.width;
+        frame->height = layout.height;
+        frame->size = static_cast<uint32_t>(layout.size);
+
         return result;
     }
 
-    Result Create(mediadecoder::Producer* producer, mediadecoder::VideoFrame*& frame, uint32_t width, uint32_t height, uint32_t bufferSize)
+
+    Result Create(mediadecoder::Producer* producer, mediadecoder::VideoFrame*& frame, AVFrame* avFrame)
     {
         Result result;
-        if( !producer->videoFramePool->pop(frame) )
+        frame = nullptr;
+        if( producer->videoFramePool->pop(frame) && !frame->avFrame )
+        {
+            // pooled frame owns its buffers
+            Delete(frame);
+            frame = nullptr;
+        }
+
+        if( !frame )
         {
             frame = new mediadecoder::VideoFrame();
+            frame->avFrame = av_frame_alloc();
+        }
+
+        int outcome = av_frame_ref(frame->avFrame, avFrame);
+        if(outcome < 0)
+        {
+            Delete(frame);
+            frame = nullptr;
+            return Result(false, "av_frame_ref error %s", ErrorToString(outcome).c_str());
+        }
 
-            frame->buffers[0] = reinterpret_cast<uint8_t*>(av_malloc(bufferSize));
-            frame->lineSize[0] = bufferSize / height;
-            frame->width = width;
-            frame->height = height;
+        for(uint32_t i = 0; i < mediadecoder::NUM_FRAME_DATA_POINTERS; i++)
+        {
+            frame->buffers[i] = frame->avFrame->data[i];
+            frame->lineSize[i] = frame->avFrame->linesize[i];
+        }
+        frame->width = avFrame->width;
+        frame->height = avFrame->height;
+
+        frame->size = 0;
+        for(uint32_t i = 0; i < AV_NUM_DATA_POINTERS && frame->avFrame->buf[i]; i++)
+        {
+            frame->size += static_cast<uint32_t>(frame->avFrame->buf[i]->size);
         }
+
         return result;
     }
 
+    void AllocateSamples(mediadecoder::Producer* producer, mediadecoder::AudioFrame* frame, uint32_t bufferSize)
+    {
+        framearena::Arena* arena = producer->audioArena;
+        uint8_t* samples = arena && bufferSize <= arena->slotSize ? framearena::Allocate(arena) : nullptr;
+
+        if( samples )
+        {
+            frame->samples = samples;
+            frame->bufferSize = static_cast<uint32_t>(arena->slotSize);
+            frame->arena = arena;
+        }
+        else
+        {
+            frame->samples = new uint8_t[bufferSize];
+            frame->bufferSize = bufferSize;
+            profiler::Count(profiler::COUNTER_FRAME_ALLOCATIONS, 1);
+        }
+    }
+
+    void FreeSamples(mediadecoder::AudioFrame* frame)
+    {
+        if( frame->arena )
+        {
+            framearena::Free(frame->arena, frame->samples);
+        }
+        else
+        {
+            delete [] frame->samples;
+        }
+        frame->samples = nullptr;
+        frame->bufferSize = 0;
+    }
+
     Result Create(mediadecoder::Producer* producer, mediadecoder::AudioFrame*& frame, uint32_t nbSamples, uint32_t sampleSize, uint32_t channels)
     {
         const uint32_t requestedBufferSize = nbSamples * sampleSize * channels;
@@ -201,14 +438,10 @@ namespace {
 
         if( haveFrame && !frame->inUse )
         {
-            const uint32_t frameBufferSize = frame->nbSamples * frame->sampleSize * frame->channels;
-            if(requestedBufferSize > frameBufferSize)
+            if(requestedBufferSize > frame->bufferSize)
             {
-                delete [] frame->samples;
-                frame->samples = new uint8_t[requestedBufferSize];
-                frame->sampleSize = sampleSize;
-                frame->nbSamples = nbSamples;
-                frame->channels = channels;
+                FreeSamples(frame);
+                AllocateSamples(producer, frame, requestedBufferSize);
             }
         }
         else
@@ -223,37 +456,97 @@ namespace {
             }
 
             frame = new mediadecoder::AudioFrame();
-            frame->samples = new uint8_t[requestedBufferSize];
-            frame->sampleSize = sampleSize;
-            frame->nbSamples = nbSamples;
-            frame->channels = channels;
+            AllocateSamples(producer, frame, requestedBufferSize);
             frame->inUse = false;
         }
+
+        frame->sampleSize = sampleSize;
+        frame->nbSamples = nbSamples;
+        frame->channels = channels;
         return result;
 
     }
 
     void Delete(mediadecoder::VideoFrame* frame)
     {
-        for(uint32_t i = 0; i < mediadecoder::NUM_FRAME_DATA_POINTERS; i++)
+        // buffers are owned by the decoder frame
+        if(frame->avFrame)
         {
-            if(frame->buffers[i])
-            {
-                av_free(frame->buffers[i]);
-            }
+            av_frame_free(&frame->avFrame);
+        }
+
+        if(frame->arena)
+        {
+            framearena::Free(frame->arena, frame->memory);
+        }
+        else
+        {
+            av_free(frame->memory);
         }
         delete frame;
     }
 
     void Delete(mediadecoder::AudioFrame* frame)
     {
-        delete [] frame->samples;
+        if(frame->avFrame)
+        {
+            av_frame_free(&frame->avFrame);
+        }
+
+        FreeSamples(frame);
         delete frame;
     }
 
+    // reference a decoder frame interleaved by the consumer
+    Result Create(mediadecoder::Producer* producer, mediadecoder::AudioFrame*& frame, AVFrame* avFrame, const mediadecoder::AudioStream* audioStream)
+    {
+        if( producer->audioFramePool->pop(frame) && frame->inUse )
+        {
+            const bool outcome = producer->audioFramePool->push(frame);
+            assert(outcome);
+            frame = nullptr;
+        }
+
+        if( !frame )
+        {
+            frame = new mediadecoder::AudioFrame();
+            profiler::Count(profiler::COUNTER_FRAME_ALLOCATIONS, 1);
+        }
+
+        if( !frame->avFrame )
+        {
+            frame->avFrame = av_frame_alloc();
+        }
+
+        const int outcome = av_frame_ref(frame->avFrame, avFrame);
+        if( outcome < 0 )
+        {
+            Delete(frame);
+            frame = nullptr;
+            return Result(false, "av_frame_ref error %s", ErrorToString(outcome).c_str());
+        }
+
+        frame->sampleSize = av_get_bytes_per_sample(static_cast<AVSampleFormat>(avFrame->format));
+        frame->nbSamples = avFrame->nb_samples;
+        frame->channels = audioStream->channels;
+        frame->interleaveFunction = audioStream->interleaveFunction;
+        frame->permutation = audioStream->channelPermutation.data();
+        return Result(true);
+    }
+
+    void Delete(AVPacket* packet)
+    {
+        av_packet_free(&packet);
+    }
+
     template<typename T>
     void Clear(mediadecoder::FrameQueue<T>* q)
     {
+        if(!q)
+        {
+            return;
+        }
+
         T item;
         while( q->pop(item) )
         {
@@ -272,12 +565,87 @@ namespace {
     }
 
 
+    void UpdatePeakBytes(mediadecoder::Producer* producer)
+    {
+        const uint64_t bytes = producer->videoQueueUsage.bytes + producer->audioQueueUsage.bytes;
+        profiler::Set(profiler::GAUGE_QUEUE_BYTES, bytes);
+
+        uint64_t peak = producer->peakQueueBytes;
+        while( bytes > peak && !producer->peakQueueBytes.compare_exchange_weak(peak, bytes) )
+        {
+        }
+    }
+
+    // bytes are added before the push, the consumer can pop and subtract them before it returns
+    void OnPush(mediadecoder::QueueUsage& usage, uint32_t queueSize, uint64_t timeUs)
+    {
+        if( queueSize == 0 )
+        {
+            usage.startTimeUs = timeUs;
+        }
+        usage.endTimeUs = timeUs;
+    }
+
+    void OnPop(mediadecoder::QueueUsage& usage, uint64_t bytes, uint64_t timeUs)
+    {
+        usage.startTimeUs = timeUs;
+        usage.bytes -= bytes;
+    }
+
+    void ResetUsage(mediadecoder::QueueUsage& usage)
+    {
+        usage.bytes = 0;
+        usage.startTimeUs = 0;
+        usage.endTimeUs = 0;
+    }
+
+    uint64_t GetDurationUs(const mediadecoder::QueueUsage& usage)
+    {
+        const uint64_t startTimeUs = usage.startTimeUs;
+        const uint64_t endTimeUs = usage.endTimeUs;
+        return endTimeUs > startTimeUs ? endTimeUs - startTimeUs : 0;
+    }
+
+    bool IsFull(mediadecoder::Producer* producer, const mediadecoder::QueueUsage& usage, uint32_t queueSize, uint32_t queueCapacity)
+    {
+        return queueSize >= queueCapacity || usage.bytes >= usage.budget || GetDurationUs(usage) >= producer->preRollUs;
+    }
+
+    void OnFrameQueued(mediadecoder::Producer* producer)
+    {
+        if( producer->seekFirstFramePending.exchange(false) )
+        {
+            producer->seekLatencyUs = chrono::RealNow() - producer->seekStartTimeUs;
+            logger::Info("Seek latency %lu us", producer->seekLatencyUs.load());
+        }
+    }
+
+    uint64_t GetSize(const mediadecoder::AudioFrame* frame)
+    {
+        return static_cast<uint64_t>(frame->nbSamples) * frame->sampleSize * frame->channels;
+    }
+
     bool PushFrame(mediadecoder::Producer* producer, mediadecoder::AudioFrame* audioFrame)
     {
+        const uint32_t queueSize = producer->audioQueueSize;
+        const uint64_t bytes = GetSize(audioFrame);
+        producer->audioQueueUsage.bytes += bytes;
         bool success = producer->audioQueue->push(audioFrame);
+        if( !success )
+        {
+            producer->audioQueueUsage.bytes -= bytes;
+        }
+
         if( success )
         {
+            OnPush(producer->audioQueueUsage, queueSize, audioFrame->timeUs);
+            UpdatePeakBytes(producer);
+            if( !producer->decoder->videoStream )
+            {
+                OnFrameQueued(producer);
+            }
             producer->audioQueueSize++;
+            eventcount::Notify(&producer->frameProduced);
         }
         else if( producer->seeking )
         {
@@ -287,17 +655,31 @@ namespace {
         else
         {
             logger::Warn("AudioDecoderCallback queue full. Waiting.");
-            std::this_thread::sleep_for(std::chrono::milliseconds(QUEUE_FULL_SLEEP_TIME_MS));
+            eventcount::Wait(&producer->frameConsumed, [producer]() { 
+                return producer->audioQueueSize < producer->audioQueueCapacity || producer->seeking || producer->quitting;
+            }, QUEUE_FULL_WAIT_TIME_MS);
         }
         return success;
     }
 
     bool PushFrame(mediadecoder::Producer* producer, mediadecoder::VideoFrame* videoFrame)
     {
+        const uint32_t queueSize = producer->videoQueueSize;
+        const uint64_t bytes = videoFrame->size;
+        producer->videoQueueUsage.bytes += bytes;
         bool success = producer->videoQueue->push(videoFrame);
+        if( !success )
+        {
+            producer->videoQueueUsage.bytes -= bytes;
+        }
+
         if( success )
         {
+            OnPush(producer->videoQueueUsage, queueSize, videoFrame->timeUs);
+            UpdatePeakBytes(producer);
+            OnFrameQueued(producer);
             producer->videoQueueSize++;
+            eventcount::Notify(&producer->frameProduced);
         }
         else if( producer->seeking )
         {
@@ -306,8 +688,10 @@ namespace {
         }
         else
         {
-            logger::Warn("AudioDecoderCallback queue full. Waiting.");
-            std::this_thread::sleep_for(std::chrono::milliseconds(QUEUE_FULL_SLEEP_TIME_MS));
+            logger::Warn("VideoDecoderCallback queue full. Waiting.");
+            eventcount::Wait(&producer->frameConsumed, [producer]() { 
+                return producer->videoQueueSize < producer->videoQueueCapacity || producer->seeking || producer->quitting;
+            }, QUEUE_FULL_WAIT_TIME_MS);
         }
         return success;
     }
@@ -364,49 +748,94 @@ namespace {
     void AudioDecoderCallback(mediadecoder::Stream* stream, mediadecoder::Producer* producer, AVFrame* frame, AVPacket* packet)
     {
         profiler::ScopeProfiler profiler(profiler::PROFILER_PROCESS_AUDIO_FRAME);
-        const uint32_t sampleSize = av_get_bytes_per_sample(stream->codecContext->sample_fmt);
-        const uint32_t channels = stream->codecContext->channels;
+        mediadecoder::AudioStream* audioStream 
+                       = reinterpret_cast<mediadecoder::AudioStream*>(stream);
+
         const uint32_t nbSamples = frame->nb_samples;
         const AVRational& timeBase = stream->stream->time_base;
         const double timeSeconds = static_cast<double>(frame->pts) * static_cast<double>(timeBase.num) / static_cast<double>(timeBase.den);
-        const uint64_t timeUs = chrono::Microseconds(timeSeconds);
+        uint64_t timeUs = chrono::Microseconds(timeSeconds);
+
+        // seeking, skip frames ending before the seek time
+        if( stream->skipUntilUs != 0 )
+        {
+            const uint64_t durationUs = static_cast<uint64_t>(nbSamples) * 1000000 / std::max(1, frame->sample_rate);
+            if( timeUs + durationUs <= stream->skipUntilUs )
+            {
+                return;
+            }
+            stream->skipUntilUs = 0;
+        }
 
         mediadecoder::AudioFrame* audioFrame;
         Result result;
 
-        result = Create(producer, audioFrame, frame->nb_samples, sampleSize, channels);
-        assert(result);
-        if(!result)
+        if(audioStream->swrContext)
         {
-            logger::Error("AudioDecoderCallback cannot create audio frame: %s", result.getError().c_str());
-            return;
-        }
-
-        mediadecoder::AudioStream* audioStream 
-                       = reinterpret_cast<mediadecoder::AudioStream*>(stream);
+            // convert, remap & resample directly into the device format
+            SwrContext* swrContext = audioStream->swrContext;
+            const uint32_t sampleSize = av_get_bytes_per_sample(SampleFormatToAVFormat(audioStream->outputSampleFormat));
+            const uint32_t channels = audioStream->outputChannels;
+            const int maxSamples = swr_get_out_samples(swrContext, nbSamples);
 
-        const std::map<uint32_t, uint32_t>& inputToOutputMapping = audioStream->channelInputToOutputMapping;
-        audioFrame->timeUs = timeUs;
-        uint8_t* samples = audioFrame->samples;
-        uint32_t pos = 0;
+            // samples buffered by the resampler are output first
+            const uint64_t delayUs = static_cast<uint64_t>(swr_get_delay(swrContext, 1000000));
+            timeUs = timeUs > delayUs ? timeUs - delayUs : 0;
 
-        for(uint32_t i = 0; i < nbSamples; i++ )
-        {
-            for( uint32_t ch = 0; ch < channels; ch++)
+            if(maxSamples <= 0)
             {
-                std::map<uint32_t, uint32_t>::const_iterator it = inputToOutputMapping.find(ch);
-                assert(it != inputToOutputMapping.end());
+                return;
+            }
 
-                const uint32_t outputChannel = it->second;
-                uint8_t* data  = (uint8_t*)(frame->data[outputChannel] + static_cast<ptrdiff_t>(static_cast<size_t>(sampleSize)*static_cast<size_t>(i)));
+            result = Create(producer, audioFrame, maxSamples, sampleSize, channels);
+            assert(result);
+            if(!result)
+            {
+                logger::Error("AudioDecoderCallback cannot create audio frame: %s", result.getError().c_str());
+                return;
+            }
 
-                for( uint32_t j = 0; j < sampleSize; j++ )
+            uint8_t* output[1] = { audioFrame->samples };
+            const int outcome = swr_convert(swrContext, output, maxSamples, const_cast<const uint8_t**>(frame->extended_data), nbSamples);
+            if(outcome <= 0)
+            {
+                if(outcome < 0)
                 {
-                    samples[pos++] = data[j];
+                    logger::Error("AudioDecoderCallback swr_convert error %s", ErrorToString(outcome).c_str());
                 }
+                mediadecoder::Release(producer, audioFrame);
+                return;
+            }
+            audioFrame->nbSamples = outcome;
+        }
+        else if(audioStream->deferInterleave)
+        {
+            // interleaved by the consumer into the device buffer
+            result = Create(producer, audioFrame, frame, audioStream);
+            if(!result)
+            {
+                logger::Error("AudioDecoderCallback cannot reference audio frame: %s", result.getError().c_str());
+                return;
+            }
+        }
+        else
+        {
+            const uint32_t sampleSize = av_get_bytes_per_sample(stream->codecContext->sample_fmt);
+            const uint32_t channels = stream->codecContext->channels;
+
+            result = Create(producer, audioFrame, nbSamples, sampleSize, channels);
+            assert(result);
+            if(!result)
+            {
+                logger::Error("AudioDecoderCallback cannot create audio frame: %s", result.getError().c_str());
+                return;
             }
+
+            audioStream->interleaveFunction(frame->extended_data, audioStream->channelPermutation.data(), channels, audioFrame->samples, nbSamples);
         }
 
+        audioFrame->timeUs = timeUs;
+
         bool success = false;
         do
         {
@@ -415,30 +844,206 @@ namespace {
         } while( !success && !producer->quitting && !producer->seeking );
     }
 
-    void VideoDecoderCallback(mediadecoder::Stream* stream, mediadecoder::Producer* producer, AVFrame* frame, AVPacket*)
+    // offset frame planes to the first row of a slice
+    void GetSlicePlanes(AVPixelFormat format, uint8_t* const* data, const int32_t* linesize, uint32_t row, uint8_t** slice)
     {
-        profiler::ScopeProfiler profiler(profiler::PROFILER_PROCESS_VIDEO_FRAME);
+        const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+        const int32_t planes = av_pix_fmt_count_planes(format);
+        const bool palette = (desc->flags & AV_PIX_FMT_FLAG_PAL) != 0;
 
-        mediadecoder::VideoStream* videoStream 
-                       = reinterpret_cast<mediadecoder::VideoStream*>(stream);
+        for(int32_t i = 0; i < static_cast<int32_t>(mediadecoder::NUM_FRAME_DATA_POINTERS); i++)
+        {
+            slice[i] = data[i];
+            if(!data[i] || i >= planes || (palette && i > 0))
+            {
+                continue;
+            }
 
-        const AVRational& timeBase = stream->stream->time_base;
-        const uint32_t reformatBufferSize = videoStream->reformatBufferSize;
-        const bool convertFrame = videoStream->swsContext != nullptr;
-        const double timeSeconds = static_cast<double>(frame->pts) * static_cast<double>(timeBase.num) / static_cast<double>(timeBase.den);
-        const uint64_t timeUs = chrono::Microseconds(timeSeconds);
-        producer->currentDecodingTimeUs = timeUs;
+            const uint32_t shift = (i == 1 || i == 2) ? desc->log2_chroma_h : 0;
+            slice[i] += static_cast<ptrdiff_t>(row >> shift) * linesize[i];
+        }
+    }
 
-        mediadecoder::VideoFrame* videoFrame;
-        Result result;
+    void ScaleSlices(mediadecoder::VideoStream* videoStream, AVFrame* frame, mediadecoder::VideoFrame* videoFrame)
+    {
+        const AVPixelFormat srcFormat = videoStream->codecContext->pix_fmt;
+        const AVPixelFormat dstFormat = videoStream->dstFormat;
+        const uint32_t nbSlices = static_cast<uint32_t>(videoStream->swsSliceContexts.size());
 
-        result = convertFrame ? Create(producer, videoFrame, frame->width, frame->height, reformatBufferSize)
-                              : Create(producer, videoFrame, frame->width, frame->height, frame->data, frame->linesize);
+        workerpool::Run(videoStream->scalePool, nbSlices, [videoStream, frame, videoFrame, srcFormat, dstFormat](uint32_t slice)
+        {
+            const uint64_t startTimeUs = chrono::RealNow();
+            const uint32_t row = videoStream->sliceRows[slice];
+            const uint32_t height = videoStream->sliceRows[slice+1] - row;
 
-        assert(result);
+            uint8_t* src[mediadecoder::NUM_FRAME_DATA_POINTERS];
+            uint8_t* dst[mediadecoder::NUM_FRAME_DATA_POINTERS];
+            GetSlicePlanes(srcFormat, frame->data, frame->linesize, row, src);
+            GetSlicePlanes(dstFormat, videoFrame->buffers, videoFrame->lineSize, row, dst);
+
+            sws_scale(videoStream->swsSliceContexts[slice], src, frame->linesize, 0, height, dst, videoFrame->lineSize);
+            videoStream->sliceTimeUs[slice] = chrono::RealNow() - startTimeUs;
+        });
+
+        // profiler is updated from the decoder thread only
+        for(uint32_t i = 0; i < nbSlices; i++)
+        {
+            profiler::AddBlock(profiler::PROFILER_SCALE_SLICE, videoStream->sliceTimeUs[i]);
+        }
+    }
+
+    Result CreateScaleSlices(mediadecoder::VideoStream* videoStream, AVPixelFormat inputPixelFormat, uint32_t width, uint32_t height)
+    {
+        Result result;
+
+        const AVPixelFormat outputPixelFormat = videoStream->dstFormat;
+        const uint32_t maxSlices = std::max(1U, height / mediadecoder::MIN_SCALE_SLICE_HEIGHT);
+
+        if(!videoStream->scalePool)
+        {
+            uint32_t threads = scaleThreads;
+            if(threads == 0)
+            {
+                threads = std::min({std::max(1U, std::thread::hardware_concurrency()), mediadecoder::MAX_AUTO_SCALE_THREADS, maxSlices});
+            }
+
+            result = workerpool::Create(videoStream->scalePool, threads);
+            if(!result)
+            {
+                return result;
+            }
+        }
+
+        // slices start on a row aligned to the chroma subsampling of both formats
+        const uint32_t nbSlices = std::min(workerpool::GetNumThreads(videoStream->scalePool), maxSlices);
+        const uint32_t alignment = mediadecoder::SCALE_SLICE_ALIGNMENT;
+        const uint32_t sliceHeight = ((height + nbSlices - 1) / nbSlices + alignment - 1) / alignment * alignment;
+
+        for(uint32_t row = 0; row < height; row += sliceHeight)
+        {
+            const uint32_t rows = std::min(sliceHeight, height - row);
+            SwsContext* swsContext = sws_getContext(width, rows, inputPixelFormat, width, rows,
+                                                    outputPixelFormat, SWS_BICUBIC, nullptr, nullptr, nullptr);
+            if(!swsContext)
+            {
+                return Result(false, "sws_getContext failed for slice at row %d", row);
+            }
+
+            videoStream->swsSliceContexts.push_back(swsContext);
+            videoStream->sliceRows.push_back(row);
+        }
+        videoStream->sliceRows.push_back(height);
+        videoStream->sliceTimeUs.resize(videoStream->swsSliceContexts.size());
+
+        logger::Info("Video conversion %zu slices of %d rows", videoStream->swsSliceContexts.size(), sliceHeight);
+
+        return result;
+    }
+
+    void FreeScaleContexts(mediadecoder::VideoStream* videoStream)
+    {
+        sws_freeContext(videoStream->swsContext);
+        videoStream->swsContext = nullptr;
+
+        for(auto it = videoStream->swsSliceContexts.begin(); it != videoStream->swsSliceContexts.end(); ++it)
+        {
+            sws_freeContext(*it);
+        }
+        videoStream->swsSliceContexts.clear();
+        videoStream->sliceRows.clear();
+        videoStream->sliceTimeUs.clear();
+    }
+
+    Result CreateScaleContexts(mediadecoder::VideoStream* videoStream, AVPixelFormat inputPixelFormat, uint32_t width, uint32_t height)
+    {
+        FreeScaleContexts(videoStream);
+
+        if(scaleThreads != 1 && height >= 2 * mediadecoder::MIN_SCALE_SLICE_HEIGHT)
+        {
+            return CreateScaleSlices(videoStream, inputPixelFormat, width, height);
+        }
+
+        videoStream->swsContext = sws_getContext(width, height, inputPixelFormat, width, height,
+                                                 videoStream->dstFormat, SWS_BICUBIC, nullptr, nullptr, nullptr);
+        if(!videoStream->swsContext)
+        {
+            return Result(false, "sws_getContext failed");
+        }
+        return Result(true);
+    }
+
+    // decoded frame size differs from the stream, update output layout & conversion
+    Result ResizeVideoStream(mediadecoder::VideoStream* videoStream, uint32_t width, uint32_t height)
+    {
+        Result result;
+
+        logger::Info("Video resolution changed from %dx%d to %dx%d", videoStream->width.load(), videoStream->height.load(), width, height);
+
+        videoStream->width = width;
+        videoStream->height = height;
+        GetFrameLayout(videoStream->frameLayout.format, width, height, videoStream->frameLayout);
+
+        if(videoStream->reformatBufferSize != 0)
+        {
+            videoStream->reformatBufferSize = static_cast<uint32_t>(videoStream->frameLayout.size);
+            result = CreateScaleContexts(videoStream, videoStream->codecContext->pix_fmt, width, height);
+        }
+
+        return result;
+    }
+
+    void VideoDecoderCallback(mediadecoder::Stream* stream, mediadecoder::Producer* producer, AVFrame* frame, AVPacket*)
+    {
+        profiler::ScopeProfiler profiler(profiler::PROFILER_PROCESS_VIDEO_FRAME);
+
+        mediadecoder::VideoStream* videoStream 
+                       = reinterpret_cast<mediadecoder::VideoStream*>(stream);
+
+        // lowres frames are converted at their decoded size, the renderer follows the frame size
+        if(!videoStream->zeroCopy && (static_cast<uint32_t>(frame->width) != videoStream->frameLayout.width || 
+                                      static_cast<uint32_t>(frame->height) != videoStream->frameLayout.height))
+        {
+            Result resizeResult = ResizeVideoStream(videoStream, frame->width, frame->height);
+            if(!resizeResult)
+            {
+                logger::Error("VideoDecoderCallback cannot resize video stream: %s", resizeResult.getError().c_str());
+                return;
+            }
+        }
+
+        const AVRational& timeBase = stream->stream->time_base;
+        const uint32_t reformatBufferSize = videoStream->reformatBufferSize;
+        const bool zeroCopy = videoStream->zeroCopy;
+        const double timeSeconds = static_cast<double>(frame->pts) * static_cast<double>(timeBase.num) / static_cast<double>(timeBase.den);
+        const uint64_t timeUs = chrono::Microseconds(timeSeconds);
+        producer->currentDecodingTimeUs = timeUs;
+
+        // seeking, frames before the seek time are decoded to reach it but never converted
+        if( stream->skipUntilUs != 0 )
+        {
+            if( timeUs < stream->skipUntilUs )
+            {
+                return;
+            }
+            stream->skipUntilUs = 0;
+        }
+
+        mediadecoder::VideoFrame* videoFrame;
+        Result result;
+
+        if(zeroCopy)
+        {
+            result = Create(producer, videoFrame, frame);
+        }
+        else
+        {
+            result = Create(producer, videoFrame, videoStream->frameLayout);
+        }
+
+        assert(result);
         if(!result)
         {
-            logger::Error("VideoDecoderCallback cannot create audio frame: %s", result.getError().c_str());
+            logger::Error("VideoDecoderCallback cannot create video frame: %s", result.getError().c_str());
             return;
         }
 
@@ -446,15 +1051,27 @@ namespace {
         logger::Trace("Decode frame %f", chrono::Seconds(timeUs));
 
         // Convert the video frame to output format using sws_scale
-        if(videoStream->swsContext)
+        if(zeroCopy)
+        {
+            // videoFrame references decoder frame buffers
+        }
+        else if(!videoStream->swsSliceContexts.empty())
         {
-            sws_scale(videoStream->swsContext, frame->data, frame->linesize, 0, videoStream->codecContext->height,
+            ScaleSlices(videoStream, frame, videoFrame);
+            profiler::Count(profiler::COUNTER_VIDEO_BYTES_COPIED, reformatBufferSize);
+        }
+        else if(videoStream->swsContext)
+        {
+            sws_scale(videoStream->swsContext, frame->data, frame->linesize, 0, frame->height,
                       videoFrame->buffers, videoFrame->lineSize );
+            profiler::Count(profiler::COUNTER_VIDEO_BYTES_COPIED, reformatBufferSize);
         }
         else
         {
             av_image_copy(videoFrame->buffers, videoFrame->lineSize, (const uint8_t**)frame->data, frame->linesize, 
                           videoStream->codecContext->pix_fmt,  frame->width, frame->height);
+            profiler::Count(profiler::COUNTER_VIDEO_BYTES_COPIED, 
+                            av_image_get_buffer_size(videoStream->codecContext->pix_fmt, frame->width, frame->height, 1));
         }
 
 
@@ -542,27 +1159,174 @@ namespace {
             }
         }
 
-        producer->subtitleQueue->push(sub);
+        // counted before the push, the consumer may pop it right away
         producer->subtitleQueueSize++;
+        if( !producer->subtitleQueue->push(sub) )
+        {
+            producer->subtitleQueueSize--;
+            logger::Warn("SubtitleDecoderCallback queue full. Dropping subtitle.");
+            mediadecoder::Release(producer, sub);
+        }
 
         avsubtitle_free(&avSub);
     }
 
+    // wake up every thread waiting on the producer
+    void NotifyAll(mediadecoder::Producer* producer)
+    {
+        eventcount::Notify(&producer->frameProduced);
+        eventcount::Notify(&producer->frameConsumed);
+        eventcount::Notify(&producer->packetConsumed);
+
+        for( auto it = producer->streams.begin(); it != producer->streams.end(); ++it)
+        {
+            if(*it)
+            {
+                eventcount::Notify(&(*it)->packetProduced);
+            }
+        }
+    }
+
+    uint64_t ToMicroseconds(int64_t timestamp, const AVRational& timeBase)
+    {
+        return static_cast<uint64_t>(std::max<int64_t>(av_rescale_q(timestamp, timeBase, AVRational{1, 1000000}), 0));
+    }
+
+    void AddKeyframe(mediadecoder::KeyframeIndex& index, uint64_t timeUs)
+    {
+        std::vector<uint64_t>& times = index.timesUs;
+        if( times.empty() || timeUs > times.back() )
+        {
+            times.push_back(timeUs);
+            return;
+        }
+
+        auto it = std::lower_bound(times.begin(), times.end(), timeUs);
+        if( it == times.end() || *it != timeUs )
+        {
+            times.insert(it, timeUs);
+        }
+    }
+
+    // container indexes are usually complete (mp4, mkv cues), keyframes demuxed since are merged in
+    void BuildKeyframeIndex(mediadecoder::Decoder* decoder)
+    {
+        mediadecoder::KeyframeIndex& index = decoder->keyframeIndex;
+        if( index.built || !decoder->videoStream )
+        {
+            return;
+        }
+
+        const uint64_t startTimeUs = chrono::RealNow();
+        AVStream* stream = decoder->videoStream->stream;
+        for(int32_t i = 0; i < stream->nb_index_entries; i++)
+        {
+            const AVIndexEntry& entry = stream->index_entries[i];
+            if( entry.flags & AVINDEX_KEYFRAME )
+            {
+                AddKeyframe(index, ToMicroseconds(entry.timestamp, stream->time_base));
+            }
+        }
+        index.built = true;
+
+        logger::Info("Keyframe index %zu keyframes built in %lu us", index.timesUs.size(), chrono::RealNow() - startTimeUs);
+    }
+
+    // keyframe at or before time, false if unknown
+    bool FindKeyframe(const mediadecoder::KeyframeIndex& index, uint64_t timeUs, uint64_t& keyframeTimeUs)
+    {
+        const std::vector<uint64_t>& times = index.timesUs;
+        auto it = std::upper_bound(times.begin(), times.end(), timeUs);
+        if( it == times.begin() )
+        {
+            return false;
+        }
+        keyframeTimeUs = *(--it);
+        return true;
+    }
+
     void Seek(mediadecoder::Producer* producer )
     {
-        logger::Info("Seek %f", chrono::Seconds(producer->seekTime));
+        uint64_t seekTime = 0;
+        uint64_t seekRequest = 0;
+        bool keyframeOnly = false;
+        {
+            std::scoped_lock<std::mutex> lock(producer->seekMutex);
+            seekTime = producer->seekTime;
+            seekRequest = producer->seekRequests;
+            keyframeOnly = producer->seekKeyframeOnly;
+        }
+
+        logger::Info("%s %f serving %lu requests", keyframeOnly ? "Scrub" : "Seek", chrono::Seconds(seekTime), seekRequest - producer->seekServedRequests);
+        producer->seekServedRequests = seekRequest;
+        producer->scrubbing = keyframeOnly;
+        producer->scrubKeyframeSent = false;
+
+        // decoder threads are paused, drop pending packets and decoder state
         for( auto it = producer->streams.begin(); it != producer->streams.end(); ++it)
         {
             mediadecoder::Stream* stream = *it;
-            const AVRational& timeBase = stream->stream->time_base;
-            const double timeInTimeBase = chrono::Seconds(producer->seekTime) * static_cast<double>(timeBase.den) / static_cast<double>(timeBase.num);
-            int outcome = av_seek_frame(producer->decoder->avFormatContext, stream->streamIndex, static_cast<int64_t>(timeInTimeBase), 0);
+            if(stream && stream->packetQueue)
+            {
+                Clear(stream->packetQueue);
+                stream->packetQueueSize = 0;
+                ResetUsage(stream->packetQueueUsage);
+                stream->done = false;
+            }
+        }
+
+        // drop samples buffered by the resampler
+        mediadecoder::AudioStream* audioStream = producer->decoder->audioStream;
+        if(audioStream && audioStream->swrContext)
+        {
+            swr_init(audioStream->swrContext);
+        }
+
+        // seek the video stream to the keyframe preceding the seek time, other streams follow
+        mediadecoder::Decoder* decoder = producer->decoder;
+        mediadecoder::Stream* seekStream = decoder->videoStream ? static_cast<mediadecoder::Stream*>(decoder->videoStream) 
+                                                                : static_cast<mediadecoder::Stream*>(decoder->audioStream);
+        if(seekStream)
+        {
+            const uint64_t startTimeUs = chrono::RealNow();
+            uint64_t keyframeTimeUs = seekTime;
+
+            BuildKeyframeIndex(decoder);
+            if( FindKeyframe(decoder->keyframeIndex, seekTime, keyframeTimeUs) )
+            {
+                logger::Debug("Seek keyframe at %f", chrono::Seconds(keyframeTimeUs));
+            }
+
+            const AVRational& timeBase = seekStream->stream->time_base;
+            const int64_t timestamp = av_rescale_q(static_cast<int64_t>(keyframeTimeUs), AVRational{1, 1000000}, timeBase);
+            int outcome = av_seek_frame(decoder->avFormatContext, seekStream->streamIndex, timestamp, AVSEEK_FLAG_BACKWARD);
             if(outcome < 0 )
             {
                 std::string error = ErrorToString(outcome);
                 logger::Error("av_seek_frame error %s", error.c_str());
-                continue;
             }
+
+            for( auto it = producer->streams.begin(); it != producer->streams.end(); ++it)
+            {
+                mediadecoder::Stream* stream = *it;
+                if(stream && stream->packetQueue)
+                {
+                    const bool video = stream->codec->type == AVMEDIA_TYPE_VIDEO;
+
+                    // scrubbing shows the keyframe itself, it precedes the seek time
+                    stream->skipUntilUs = keyframeOnly && video ? 0 : seekTime;
+                    if(video)
+                    {
+                        // the decoder thread applies the degradation level again once scrubbing ends
+                        stream->codecContext->skip_frame = keyframeOnly ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+                        stream->codecContext->skip_loop_filter = AVDISCARD_DEFAULT;
+                        decoder->videoStream->degradation = degradation::LEVEL_NB;
+                    }
+                    avcodec_flush_buffers(stream->codecContext);
+                }
+            }
+
+            logger::Info("Seek av_seek_frame %lu us", chrono::RealNow() - startTimeUs);
         }
 
         // seek subtitles
@@ -570,10 +1334,10 @@ namespace {
         {
             mediadecoder::SubtitleSubRip& srt = it->second;
 
-            for( srt.posIt = srt.subs->diags.begin() ; srt.posIt != srt.subs->diags.end() && producer->seekTime != 0; ++srt.posIt)
+            for( srt.posIt = srt.subs->diags.begin() ; srt.posIt != srt.subs->diags.end() && seekTime != 0; ++srt.posIt)
             {
                 const subtitle::SubRipDialogue& d = *srt.posIt;
-                if(d.startTimeUs > producer->seekTime)
+                if(d.startTimeUs > seekTime)
                 {
                     logger::Info("Done Seek subtitle at %f seconds", chrono::Seconds(d.startTimeUs));
                     break;
@@ -587,9 +1351,39 @@ namespace {
         producer->videoQueueSize = 0;
         producer->audioQueueSize = 0;
         producer->subtitleQueueSize = 0;
+        ResetUsage(producer->videoQueueUsage);
+        ResetUsage(producer->audioQueueUsage);
+
+        producer->demuxDone = false;
+        producer->done = false;
+
+        // a newer request arrived meanwhile, keep the decoders paused and serve it next
+        {
+            std::scoped_lock<std::mutex> lock(producer->seekMutex);
+            if( seekRequest == producer->seekRequests )
+            {
+                producer->seekTime = 0;
+                producer->seekFirstFramePending = true;
+                producer->seeking = false;
+            }
+        }
 
-        producer->seekTime = 0;
-        producer->seeking = false;
+        NotifyAll(producer);
+    }
+
+    // the newest request replaces a pending one
+    void RequestSeek(mediadecoder::Producer* producer, uint64_t timeUs, bool keyframeOnly)
+    {
+        {
+            std::scoped_lock<std::mutex> lock(producer->seekMutex);
+            producer->seekTime = timeUs;
+            producer->seekKeyframeOnly = keyframeOnly;
+            producer->seekRequests++;
+            producer->seekStartTimeUs = chrono::RealNow();
+            producer->seekFirstFramePending = false;
+            producer->seeking = true;
+        }
+        NotifyAll(producer);
     }
 
     int ReadPacket(void *opaque, uint8_t *buf, int size)
@@ -619,7 +1413,7 @@ namespace {
                 int64_t position = curl::Seek(session, offset);
 
                 logger::Info("SeekPacket SEEK_SET %ld Curl pos %ld Offset %ld Buffer size %ld", 
-                              offset, position, session->offset.load(), session->buffer.size());
+                              offset, position, session->offset.load(), curl::GetBufferSize(session));
 
                 return position;
 
@@ -633,22 +1427,22 @@ namespace {
 
             case SEEK_END:
             {
-                logger::Info("SeekPacket SEEK_END %ld Buffer size %d", offset, session->buffer.size());
+                logger::Info("SeekPacket SEEK_END %ld Buffer size %d", offset, curl::GetBufferSize(session));
                 if(offset < 0)
                 {
                     return -1;
                 }
-                return offset + session->offset + session->buffer.size();
+                return offset + session->offset + curl::GetBufferSize(session);
 
             } break;
 
             break;
 
             case AVSEEK_SIZE:
-                logger::Info("SeekPacket AVSEEK_SIZE %ld", session->buffer.size());
-                if( session->buffer.size() > 0 )
+                logger::Info("SeekPacket AVSEEK_SIZE %ld", curl::GetBufferSize(session));
+                if( curl::GetBufferSize(session) > 0 )
                 {
-                    return session->buffer.size();
+                    return curl::GetBufferSize(session);
                 }
                 else
                 {
@@ -706,6 +1500,68 @@ namespace mediadecoder
         outputFormats = l;
     }
 
+    void SetScaleThreads(uint32_t threads)
+    {
+        scaleThreads = threads;
+    }
+
+    void SetHugePages(bool enable)
+    {
+        hugePagesEnabled = enable;
+    }
+
+    void SetQueueBudget(uint64_t bytes)
+    {
+        queueBudget = bytes;
+    }
+
+    void SetPreRollDuration(uint64_t timeUs)
+    {
+        preRollDurationUs = timeUs;
+    }
+
+    void SetReadAheadDuration(uint64_t timeUs)
+    {
+        readAheadDurationUs = timeUs;
+    }
+
+    void SetReadAheadBudget(uint64_t bytes)
+    {
+        readAheadBudget = bytes;
+    }
+
+    void SetDecoderThreads(uint32_t threads)
+    {
+        decoderThreads = threads;
+    }
+
+    void SetDecoderThreadType(ThreadType threadType)
+    {
+        decoderThreadType = threadType;
+    }
+
+    ThreadType GetThreadTypeFromString(const std::string& threadType)
+    {
+        if(threadType == "auto")
+        {
+            return THREAD_TYPE_AUTO;
+        }
+        else if(threadType == "frame")
+        {
+            return THREAD_TYPE_FRAME;
+        }
+        else if(threadType == "slice")
+        {
+            return THREAD_TYPE_SLICE;
+        }
+        return THREAD_TYPE_INVALID;
+    }
+
+    void SetZeroCopy(bool enable)
+    {
+        zeroCopyEnabled = enable;
+    }
+
     Result Create(Decoder*& decoder)
     {
         Result result;
@@ -767,10 +1623,20 @@ namespace mediadecoder
             }
 
             AVDictionary* opts = nullptr;
-            av_dict_set(&opts, "refcounted_frames", "0", 0);
+            av_dict_set(&opts, "refcounted_frames", zeroCopyEnabled ? "1" : "0", 0);
 
             AVCodecContext* codecContext = avcodec_alloc_context3(codec);
             avcodec_parameters_to_context(codecContext, codecParameters);
+            if(data->background)
+            {
+                codecContext->thread_count = 1;
+                codecContext->thread_type = 0;
+            }
+            else
+            {
+                SetThreadingPolicy(codecContext, codec);
+            }
+
             outcome = avcodec_open2(codecContext, codec, &opts);
             if(outcome < 0)
             {
@@ -778,12 +1644,12 @@ namespace mediadecoder
                 return Result(false, "avcodec_open2 error %s\n", error.c_str());
             }
 
+            logger::Info("Decoder %s threading in effect: %d threads %s", codec->name, 
+                         codecContext->thread_count, ThreadTypeToString(codecContext->active_thread_type));
+
             uint32_t framesPerSecond = GetStreamFrameRate(codecContext, stream);
             if(framesPerSecond <= MAX_FRAME_RATE)
             {
-                codecContext->thread_count = 8;
-                codecContext->thread_type = FF_THREAD_FRAME;
-                
                 data->videoStream = new VideoStream();
                 data->videoStream->codecParameters = codecParameters;
                 data->videoStream->codec = codec;
@@ -794,14 +1660,25 @@ namespace mediadecoder
                 AVPixelFormat outputPixelFormat;
                 data->videoStream->outputFormat = GetOutputFormat(codecContext->pix_fmt, outputPixelFormat);
                 data->videoStream->dstFormat = outputPixelFormat;
+                GetFrameLayout(outputPixelFormat, codecContext->width, codecContext->height, data->videoStream->frameLayout);
+
+                // background decoder frames are converted by their owner
+                if(codecContext->pix_fmt != outputPixelFormat && !data->background)
+                {
+                    data->videoStream->reformatBufferSize = static_cast<uint32_t>(data->videoStream->frameLayout.size);
 
-                if(codecContext->pix_fmt != outputPixelFormat)
+                    Result scaleResult = CreateScaleContexts(data->videoStream, codecContext->pix_fmt, codecContext->width, codecContext->height);
+                    if(!scaleResult)
+                    {
+                        return scaleResult;
+                    }
+                }
+                else
                 {
-                    data->videoStream->reformatBufferSize = av_image_get_buffer_size(outputPixelFormat, codecContext->width, codecContext->height, 32);
-                    data->videoStream->swsContext = sws_getContext(codecContext->width, codecContext->height,
-                                                                  codecContext->pix_fmt, codecContext->width, codecContext->height,
-                                                                  outputPixelFormat, SWS_BICUBIC, nullptr, nullptr, nullptr);
+                    // native format frames can be handed to the renderer as is
+                    data->videoStream->zeroCopy = zeroCopyEnabled;
                 }
+                logger::Info("Video zero copy %s", data->videoStream->zeroCopy ? "enabled" : "disabled");
 
                 data->videoStream->processCallback = VideoDecoderCallback;
                 data->videoStream->width = codecContext->width;
@@ -818,6 +1695,11 @@ namespace mediadecoder
             }
         }
 
+        if(data->background)
+        {
+            return result;
+        }
+
         index = av_find_best_stream(data->avFormatContext, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
         if(index >= 0)
         {
@@ -894,6 +1776,23 @@ namespace mediadecoder
             const AudioChannelList& channels = data->audioStream->channelMapping;
             GetChannelInputToOutputMap(channels, data->audioStream->channelInputToOutputMapping);
 
+            // compile the mapping into a permutation table & select the interleave kernel
+            const std::map<uint32_t, uint32_t>& inputToOutputMapping = data->audioStream->channelInputToOutputMapping;
+            data->audioStream->channelPermutation.resize(codecContext->channels);
+            for(uint32_t ch = 0; ch < static_cast<uint32_t>(codecContext->channels); ch++)
+            {
+                auto it = inputToOutputMapping.find(ch);
+                data->audioStream->channelPermutation[ch] = it != inputToOutputMapping.end() ? it->second : ch;
+            }
+
+            const bool planar = av_sample_fmt_is_planar(codecContext->sample_fmt) != 0;
+            data->audioStream->interleaveFunction = interleave::GetFunction(av_get_bytes_per_sample(codecContext->sample_fmt), 
+                                                                             codecContext->channels, planar);
+            if(!data->audioStream->interleaveFunction)
+            {
+                return Result(false, "No interleave function for sample format %s", av_get_sample_fmt_name(codecContext->sample_fmt));
+            }
+
             PrintStream(*data->audioStream);
         }
 
@@ -1009,34 +1908,151 @@ namespace mediadecoder
         return decoder->audioStream->sampleFormat;
     }
 
-    uint64_t GetDuration(Decoder* decoder)
+    Result SetAudioOutputFormat(Decoder* decoder, uint32_t channels, uint32_t sampleRate, SampleFormat sampleFormat)
     {
-        if(!decoder)
+        Result result;
+
+        if(!decoder || !decoder->audioStream)
         {
-            return 0;
+            return Result(false, "No audio stream");
         }
-        return decoder->avFormatContext->duration;
-    }
 
-    uint32_t GetFramesPerSecond(Decoder* decoder)
-    {
-        if(!decoder || !decoder->videoStream)
+        AudioStream* audioStream = decoder->audioStream;
+        AVCodecContext* codecContext = audioStream->codecContext;
+        const AVSampleFormat outputFormat = SampleFormatToAVFormat(sampleFormat);
+        if(outputFormat == AV_SAMPLE_FMT_NONE)
         {
-            return 0;
+            return Result(false, "Invalid audio output sample format %d", sampleFormat);
         }
-        return decoder->videoStream->framesPerSecond;
-    }
 
-    bool GetHaveAudio(Decoder* decoder)
-    {
-        if(!decoder || !decoder->audioStream)
+        // same format, the interleave kernels only need to interleave & remap channels
+        const bool sameFormat = channels == audioStream->channels && sampleRate == audioStream->sampleRate
+                             && outputFormat == av_get_packed_sample_fmt(codecContext->sample_fmt);
+
+        audioStream->outputChannels = channels;
+        audioStream->outputSampleRate = sampleRate;
+        audioStream->outputSampleFormat = sampleFormat;
+        swr_free(&audioStream->swrContext);
+
+        if(sameFormat)
         {
-            return false;
+            logger::Info("Audio output format: no conversion");
+            return result;
         }
-        return true;
-    }
 
-    bool GetHaveVideo(Decoder* decoder)
+        const int64_t inputLayout = codecContext->channel_layout ? codecContext->channel_layout 
+                                                                  : av_get_default_channel_layout(codecContext->channels);
+        int64_t outputLayout = av_get_default_channel_layout(channels);
+
+        // same channel count, keep the layout and apply the device channel order
+        const bool remap = channels == audioStream->channels;
+        if(remap)
+        {
+            outputLayout = inputLayout;
+        }
+
+        audioStream->swrContext = swr_alloc_set_opts(nullptr, outputLayout, outputFormat, sampleRate,
+                                                    inputLayout, codecContext->sample_fmt, codecContext->sample_rate, 0, nullptr);
+        if(!audioStream->swrContext)
+        {
+            return Result(false, "swr_alloc_set_opts failed");
+        }
+
+        if(remap)
+        {
+            // output channel ch is read from input channel swrChannelMap[ch]
+            audioStream->swrChannelMap.assign(audioStream->channelPermutation.begin(), audioStream->channelPermutation.end());
+
+            int outcome = swr_set_channel_mapping(audioStream->swrContext, audioStream->swrChannelMap.data());
+            if(outcome < 0)
+            {
+                swr_free(&audioStream->swrContext);
+                return Result(false, "swr_set_channel_mapping error %s", ErrorToString(outcome).c_str());
+            }
+        }
+
+        int outcome = swr_init(audioStream->swrContext);
+        if(outcome < 0)
+        {
+            swr_free(&audioStream->swrContext);
+            return Result(false, "swr_init error %s", ErrorToString(outcome).c_str());
+        }
+
+        logger::Info("Audio output format: %s %d channels %d Hz to %s %d channels %d Hz", 
+                     av_get_sample_fmt_name(codecContext->sample_fmt), codecContext->channels, codecContext->sample_rate,
+                     av_get_sample_fmt_name(outputFormat), channels, sampleRate);
+
+        return result;
+    }
+
+    void SetAudioDeferredInterleave(Decoder* decoder, bool enable)
+    {
+        if(!decoder || !decoder->audioStream)
+        {
+            return;
+        }
+
+        // conversions still run in the decoder thread
+        AudioStream* audioStream = decoder->audioStream;
+        audioStream->deferInterleave = enable && !audioStream->swrContext && audioStream->interleaveFunction;
+        logger::Info("Audio deferred interleave %s", audioStream->deferInterleave ? "enabled" : "disabled");
+    }
+
+    void Interleave(AudioFrame* frame, uint32_t offset, uint32_t nbSamples, uint8_t* output)
+    {
+        const AVFrame* avFrame = frame->avFrame;
+        if(!avFrame || !avFrame->buf[0])
+        {
+            const size_t frameBytes = static_cast<size_t>(frame->sampleSize) * frame->channels;
+            memcpy(output, frame->samples + offset * frameBytes, nbSamples * frameBytes);
+            return;
+        }
+
+        const AVSampleFormat format = static_cast<AVSampleFormat>(avFrame->format);
+        if(av_sample_fmt_is_planar(format))
+        {
+            frame->planes.resize(frame->channels);
+            for(uint32_t ch = 0; ch < frame->channels; ch++)
+            {
+                frame->planes[ch] = avFrame->extended_data[ch] + static_cast<size_t>(offset) * frame->sampleSize;
+            }
+        }
+        else
+        {
+            frame->planes.assign(1, avFrame->extended_data[0] + static_cast<size_t>(offset) * frame->sampleSize * frame->channels);
+        }
+
+        frame->interleaveFunction(frame->planes.data(), frame->permutation, frame->channels, output, nbSamples);
+    }
+
+    uint64_t GetDuration(Decoder* decoder)
+    {
+        if(!decoder)
+        {
+            return 0;
+        }
+        return decoder->avFormatContext->duration;
+    }
+
+    uint32_t GetFramesPerSecond(Decoder* decoder)
+    {
+        if(!decoder || !decoder->videoStream)
+        {
+            return 0;
+        }
+        return decoder->videoStream->framesPerSecond;
+    }
+
+    bool GetHaveAudio(Decoder* decoder)
+    {
+        if(!decoder || !decoder->audioStream)
+        {
+            return false;
+        }
+        return true;
+    }
+
+    bool GetHaveVideo(Decoder* decoder)
     {
         if(!decoder || !decoder->videoStream)
         {
@@ -1082,13 +2098,17 @@ namespace mediadecoder
 
         if(decoder->videoStream)
         {
-            sws_freeContext(decoder->videoStream->swsContext);
+            FreeScaleContexts(decoder->videoStream);
+            avcodec_free_context(&decoder->videoStream->pendingCodecContext);
+            workerpool::Destroy(decoder->videoStream->scalePool);
 
             avcodec_close(decoder->videoStream->codecContext);
             avcodec_free_context(&decoder->videoStream->codecContext);
         }
         if(decoder->audioStream)
         {
+            swr_free(&decoder->audioStream->swrContext);
+
             avcodec_close(decoder->audioStream->codecContext);
             avcodec_free_context(&decoder->audioStream->codecContext);
         }
@@ -1098,20 +2118,75 @@ namespace mediadecoder
         decoder = nullptr;
     }
 
-    bool ContinueDecoding(Producer* producer)
+    bool ContinueDecoding(Producer* producer, Stream* stream)
     {
-        const bool videoFull = producer->videoQueueSize >= producer->videoQueueCapacity && GetHaveVideo(producer->decoder);
-        const bool audioFull = producer->audioQueueSize >= producer->audioQueueCapacity && GetHaveAudio(producer->decoder);
+        const AVMediaType type = stream->codec->type;
+        const bool videoFull = type == AVMEDIA_TYPE_VIDEO && IsFull(producer, producer->videoQueueUsage, producer->videoQueueSize, producer->videoQueueCapacity);
+        const bool audioFull = type == AVMEDIA_TYPE_AUDIO && IsFull(producer, producer->audioQueueUsage, producer->audioQueueSize, producer->audioQueueCapacity);
         const bool continueDecoding = !(videoFull || audioFull);
 
         if(!continueDecoding)
         {
-            logger::Trace("ContinueDecoding queue full video %d audio %d", producer->videoQueueSize.load(),  producer->audioQueueSize.load());
+            logger::Trace("ContinueDecoding queue full video %d (%lu bytes) audio %d (%lu bytes)", 
+                          producer->videoQueueSize.load(), producer->videoQueueUsage.bytes.load(),
+                          producer->audioQueueSize.load(), producer->audioQueueUsage.bytes.load());
         }
 
         return continueDecoding;
     }
 
+    uint64_t GetPacketQueueBytes(Producer* producer)
+    {
+        uint64_t bytes = 0;
+        for(auto it = producer->streams.begin(); it != producer->streams.end(); ++it)
+        {
+            Stream* stream = *it;
+            if(stream && stream->packetQueue)
+            {
+                bytes += stream->packetQueueUsage.bytes;
+            }
+        }
+        return bytes;
+    }
+
+    bool ContinueDemuxing(Producer* producer)
+    {
+        // the scrub keyframe is all we need until the next seek
+        if(producer->scrubbing && producer->scrubKeyframeSent)
+        {
+            return false;
+        }
+
+        bool starving = false;
+        bool readAheadFull = GetPacketQueueBytes(producer) >= producer->readAheadBudget;
+
+        for(auto it = producer->streams.begin(); it != producer->streams.end(); ++it)
+        {
+            Stream* stream = *it;
+            if(!stream || !stream->packetQueue)
+            {
+                continue;
+            }
+
+            if(stream->packetQueueSize >= PACKET_QUEUE_SIZE)
+            {
+                logger::Trace("ContinueDemuxing packet queue full stream %d", stream->streamIndex);
+                return false;
+            }
+
+            starving |= stream->packetQueueSize == 0 && !stream->done;
+            readAheadFull |= GetDurationUs(stream->packetQueueUsage) >= producer->readAheadUs;
+        }
+
+        // keep reading past the read-ahead limits if a decoder has nothing to decode
+        if(readAheadFull && !starving)
+        {
+            logger::Trace("ContinueDemuxing read-ahead full %lu bytes", GetPacketQueueBytes(producer));
+            return false;
+        }
+        return true;
+    }
+
     void ProcessSrt(Producer* producer)
     {
         const uint32_t MAX_SUBTITLE_QUEUE_SIZE = 100;
@@ -1141,20 +2216,301 @@ namespace mediadecoder
                 sub->startTimeUs = d.startTimeUs;
                 sub->endTimeUs = d.endTimeUs;
 
-                producer->subtitleQueue->push(sub);
                 producer->subtitleQueueSize++;
+                if( !producer->subtitleQueue->push(sub) )
+                {
+                    // retried on the next call
+                    producer->subtitleQueueSize--;
+                    mediadecoder::Release(producer, sub);
+                    return;
+                }
                 srt.posIt++;
             }
         }
     }
 
-    void DecoderThread(Producer* producer)
+    bool IsDrained(Producer* producer)
+    {
+        for(auto it = producer->streams.begin(); it != producer->streams.end(); ++it)
+        {
+            Stream* stream = *it;
+            if(stream && stream->packetQueue && !stream->done)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void WaitDecodersPaused(Producer* producer)
+    {
+        for(auto it = producer->streams.begin(); it != producer->streams.end(); ++it)
+        {
+            Stream* stream = *it;
+            while(stream && stream->packetQueue && !stream->paused && !producer->quitting)
+            {
+                eventcount::Wait(&producer->packetConsumed, [producer, stream]() {
+                    return stream->paused || producer->quitting;
+                }, PACKET_QUEUE_WAIT_TIME_MS);
+            }
+        }
+    }
+
+    uint64_t GetPacketTimeUs(Stream* stream, AVPacket* packet)
+    {
+        // decoding order time stamp, presentation time stamps are reordered
+        const int64_t dts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+        if(dts == AV_NOPTS_VALUE || dts < 0)
+        {
+            return stream->packetQueueUsage.endTimeUs;
+        }
+
+        const AVRational& timeBase = stream->stream->time_base;
+        return static_cast<uint64_t>(av_rescale_q(dts, timeBase, AVRational{1, 1000000}));
+    }
+
+    bool PushPacket(Producer* producer, Stream* stream, AVPacket* packet)
+    {
+        const uint32_t queueSize = stream->packetQueueSize;
+        const uint64_t packetSize = packet ? packet->size : 0;
+        const uint64_t packetTimeUs = packet ? GetPacketTimeUs(stream, packet) : stream->packetQueueUsage.endTimeUs.load();
+
+        stream->packetQueueUsage.bytes += packetSize;
+        while( !stream->packetQueue->push(packet) )
+        {
+            if(producer->quitting || producer->seeking)
+            {
+                stream->packetQueueUsage.bytes -= packetSize;
+                av_packet_free(&packet);
+                return false;
+            }
+            eventcount::Wait(&producer->packetConsumed, [producer, stream]() {
+                return stream->packetQueueSize < PACKET_QUEUE_SIZE || producer->seeking || producer->quitting;
+            }, PACKET_QUEUE_WAIT_TIME_MS);
+        }
+        OnPush(stream->packetQueueUsage, queueSize, packetTimeUs);
+        stream->packetQueueSize++;
+        profiler::Set(profiler::GAUGE_PACKET_BYTES, GetPacketQueueBytes(producer));
+        eventcount::Notify(&stream->packetProduced);
+        return true;
+    }
+
+    // lowres is a codec open option, the current codec keeps decoding until the next keyframe
+    Result OpenPendingVideoCodec(VideoStream* videoStream, bool lowres)
+    {
+        AVCodecContext* newCodecContext = avcodec_alloc_context3(videoStream->codec);
+        avcodec_parameters_to_context(newCodecContext, videoStream->codecParameters);
+        newCodecContext->lowres = lowres ? 1 : 0;
+        SetThreadingPolicy(newCodecContext, videoStream->codec);
+
+        AVDictionary* opts = nullptr;
+        av_dict_set(&opts, "refcounted_frames", zeroCopyEnabled ? "1" : "0", 0);
+        int32_t outcome = avcodec_open2(newCodecContext, videoStream->codec, &opts);
+        av_dict_free(&opts);
+        if(outcome < 0)
+        {
+            std::string error = ErrorToString(outcome);
+            avcodec_free_context(&newCodecContext);
+            return Result(false, "avcodec_open2 error %s", error.c_str());
+        }
+
+        videoStream->pendingCodecContext = newCodecContext;
+        videoStream->pendingLowres = lowres;
+        return Result(true);
+    }
+
+    void ClosePendingVideoCodec(VideoStream* videoStream)
+    {
+        if( videoStream->pendingCodecContext )
+        {
+            avcodec_close(videoStream->pendingCodecContext);
+            avcodec_free_context(&videoStream->pendingCodecContext);
+        }
+    }
+
+    // frames held by the current codec are drained before the pending one replaces it on a keyframe
+    void SwitchVideoCodec(Producer* producer, VideoStream* videoStream, AVFrame* frame)
+    {
+        AVCodecContext* codecContext = videoStream->codecContext;
+
+        int32_t outcome = avcodec_send_packet(codecContext, nullptr);
+        while( outcome >= 0 && !producer->seeking )
+        {
+            outcome = avcodec_receive_frame(codecContext, frame);
+            if( outcome >= 0 )
+            {
+                videoStream->processCallback(videoStream, producer, frame, nullptr);
+            }
+        }
+
+        AVCodecContext* newCodecContext = videoStream->pendingCodecContext;
+        newCodecContext->skip_loop_filter = codecContext->skip_loop_filter;
+        newCodecContext->skip_frame = codecContext->skip_frame;
+
+        avcodec_close(codecContext);
+        avcodec_free_context(&codecContext);
+        videoStream->codecContext = newCodecContext;
+        videoStream->pendingCodecContext = nullptr;
+        videoStream->lowres = videoStream->pendingLowres;
+        logger::Info("Video decoding switched to %s", videoStream->lowres ? "lowres" : "full resolution");
+    }
+
+    void ApplyDegradation(Producer* producer, VideoStream* videoStream)
+    {
+        const degradation::Level level = producer->degradation;
+        if( level == videoStream->degradation )
+        {
+            return;
+        }
+
+        // a pending switch the other way is abandoned
+        const bool lowres = level >= degradation::LEVEL_LOWRES;
+        const bool targetLowres = videoStream->pendingCodecContext ? videoStream->pendingLowres : videoStream->lowres;
+        if( lowres != targetLowres )
+        {
+            ClosePendingVideoCodec(videoStream);
+            if( lowres != videoStream->lowres )
+            {
+                Result result = OpenPendingVideoCodec(videoStream, lowres);
+                if(!result)
+                {
+                    logger::Error("Cannot %s lowres decoding: %s", lowres ? "enable" : "disable", result.getError().c_str());
+                }
+            }
+        }
+
+        AVCodecContext* codecContext = videoStream->codecContext;
+        codecContext->skip_loop_filter = level >= degradation::LEVEL_SKIP_LOOP_FILTER ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+        codecContext->skip_frame = level >= degradation::LEVEL_SKIP_NONREF ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+
+        logger::Info("Video decoding degradation %s%s", degradation::GetLevelName(level), videoStream->pendingCodecContext ? " switching lowres" : "");
+        videoStream->degradation = level;
+    }
+
+    void DecoderThread(Producer* producer, Stream* stream)
     {
+        const AVMediaType type = stream->codec->type;
+        const profiler::Point profilePoint 
+                     = type == AVMEDIA_TYPE_VIDEO ? profiler::PROFILER_DECODE_VIDEO_FRAME
+                                                  : profiler::PROFILER_DECODE_AUDIO_FRAME;
+        AVFrame* frame = av_frame_alloc();
+
         while( !producer->quitting )
         {
-            while( !ContinueDecoding(producer) && !producer->quitting && !producer->seeking )
+            // demuxer seeks and flushes the codec while we are paused
+            if( producer->seeking )
+            {
+                stream->paused = true;
+                eventcount::Notify(&producer->packetConsumed);
+
+                while( producer->seeking && !producer->quitting )
+                {
+                    eventcount::Wait(&stream->packetProduced, [producer]() {
+                        return !producer->seeking || producer->quitting;
+                    }, PACKET_QUEUE_WAIT_TIME_MS);
+                }
+                stream->paused = false;
+                continue;
+            }
+
+            // drained, wait for a seek
+            if( stream->done )
+            {
+                eventcount::Wait(&stream->packetProduced, [producer]() {
+                    return producer->seeking || producer->quitting;
+                }, PACKET_QUEUE_WAIT_TIME_MS);
+                continue;
+            }
+
+            // wait for the consumer to free a frame slot
+            if( !ContinueDecoding(producer, stream) )
+            {
+                eventcount::Wait(&producer->frameConsumed, [producer, stream]() {
+                    return ContinueDecoding(producer, stream) || producer->seeking || producer->quitting;
+                }, QUEUE_FULL_WAIT_TIME_MS);
+                continue;
+            }
+
+            AVPacket* packet = nullptr;
+            if( !stream->packetQueue->pop(packet) )
+            {
+                eventcount::Wait(&stream->packetProduced, [producer, stream]() {
+                    return stream->packetQueueSize > 0 || producer->seeking || producer->quitting;
+                }, PACKET_QUEUE_WAIT_TIME_MS);
+                continue;
+            }
+            if(packet)
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(QUEUE_FULL_SLEEP_TIME_MS));
+                OnPop(stream->packetQueueUsage, packet->size, GetPacketTimeUs(stream, packet));
+            }
+            stream->packetQueueSize--;
+            eventcount::Notify(&producer->packetConsumed);
+
+            if( type == AVMEDIA_TYPE_VIDEO && !producer->scrubbing )
+            {
+                VideoStream* videoStream = static_cast<VideoStream*>(stream);
+                ApplyDegradation(producer, videoStream);
+
+                // the picture keeps moving with the current codec until a keyframe starts the new one
+                if( videoStream->pendingCodecContext && packet && (packet->flags & AV_PKT_FLAG_KEY) )
+                {
+                    SwitchVideoCodec(producer, videoStream, frame);
+                }
+            }
+
+            // a null packet is sent by the demuxer at eof to drain the decoder
+            profiler::StartBlock(profilePoint);
+
+            int32_t outcome = avcodec_send_packet(stream->codecContext, packet);
+            if(outcome < 0 )
+            {
+                std::string error = ErrorToString(outcome);
+                logger::Error("accodec_send_packet error %s", error.c_str());
+            }
+
+            // frames left in the codec by a superseded target are flushed by the seek
+            while( outcome >= 0 && !producer->seeking )
+            {
+                outcome = avcodec_receive_frame(stream->codecContext, frame);
+                
+                if (outcome == AVERROR(EAGAIN) || outcome == AVERROR_EOF)
+                {
+                    break;
+                }
+                else if(outcome < 0 )
+                {
+                     std::string error = ErrorToString(outcome);
+                     logger::Error("avcodec_receive_frame error %s", error.c_str());
+                     break;
+                }
+
+                profiler::StopBlock(profilePoint);
+                stream->processCallback(stream, producer, frame, packet);
+                profiler::StartBlock(profilePoint);
+            }
+            profiler::StopBlock(profilePoint);
+
+            if(!packet)
+            {
+                stream->done = true;
+                eventcount::Notify(&producer->packetConsumed);
+            }
+
+            av_packet_free(&packet);
+        }
+
+        av_frame_free(&frame);
+    }
+
+    void DemuxerThread(Producer* producer)
+    {
+        while( !producer->quitting )
+        {
+            while( !ContinueDemuxing(producer) && !producer->quitting && !producer->seeking )
+            {
+                eventcount::Wait(&producer->packetConsumed, [producer]() {
+                    return ContinueDemuxing(producer) || producer->seeking || producer->quitting;
+                }, PACKET_QUEUE_WAIT_TIME_MS);
             }
 
             if( producer->quitting )
@@ -1162,40 +2518,61 @@ namespace mediadecoder
                 break;
             }
 
-            if( producer->seeking )
+            while( producer->seeking && !producer->quitting )
             {
+                WaitDecodersPaused(producer);
                 ::Seek(producer);
             }
 
+            // wait for decoders to drain at eof
+            if( producer->demuxDone )
+            {
+                eventcount::Wait(&producer->packetConsumed, [producer]() {
+                    return IsDrained(producer) || producer->seeking || producer->quitting;
+                }, PACKET_QUEUE_WAIT_TIME_MS);
+
+                producer->done = IsDrained(producer);
+                eventcount::Notify(&producer->frameProduced);
+                continue;
+            }
+
             ProcessSrt(producer);
 
             AVPacket* packet = av_packet_alloc();
-            AVFrame* frame = av_frame_alloc();
-
-            av_init_packet(packet);
 
+            profiler::StartBlock(profiler::PROFILER_DEMUX_PACKET);
             int32_t outcome = av_read_frame(producer->decoder->avFormatContext, packet);
+            profiler::StopBlock(profiler::PROFILER_DEMUX_PACKET);
+
             if(outcome < 0 )
             {
+                av_packet_free(&packet);
+
                 if(outcome == AVERROR_EOF)
                 {
-                    producer->done = true;
-                    av_packet_free(&packet);
-                    av_frame_free(&frame);
-                    return;
+                    for(auto it = producer->streams.begin(); it != producer->streams.end(); ++it)
+                    {
+                        Stream* stream = *it;
+                        if(stream && stream->packetQueue)
+                        {
+                            PushPacket(producer, stream, nullptr);
+                        }
+                    }
+                    producer->demuxDone = true;
                 }
                 else
                 {
                     std::string error = ErrorToString(outcome);
                     logger::Error("av_read_frame error %s", error.c_str());
-                    continue;
                 }
+                continue;
             }
 
             Stream* stream = static_cast<size_t>(packet->stream_index) < producer->streams.size() ? 
                                                           producer->streams[packet->stream_index] : nullptr;
             if(!stream)
             {
+                av_packet_free(&packet);
                 continue;
             }
 
@@ -1203,50 +2580,44 @@ namespace mediadecoder
 
             if(type == AVMEDIA_TYPE_VIDEO || type == AVMEDIA_TYPE_AUDIO)
             {
-                const profiler::Point profilePoint 
-                             = type == AVMEDIA_TYPE_VIDEO ? profiler::PROFILER_DECODE_VIDEO_FRAME
-                                                          : profiler::PROFILER_DECODE_AUDIO_FRAME;
-                profiler::StartBlock(profilePoint);
-
-                outcome = avcodec_send_packet(stream->codecContext, packet);
-                if(outcome < 0 )
+                // decode times like the container index entries
+                if(type == AVMEDIA_TYPE_VIDEO && (packet->flags & AV_PKT_FLAG_KEY) && packet->dts != AV_NOPTS_VALUE)
                 {
-                    std::string error = ErrorToString(outcome);
-                    logger::Error("accodec_send_packet error %s", error.c_str());
+                    AddKeyframe(producer->decoder->keyframeIndex, ToMicroseconds(packet->dts, stream->stream->time_base));
                 }
 
-                while( outcome >= 0 )
+                if(producer->scrubbing)
                 {
-                    outcome = avcodec_receive_frame(stream->codecContext, frame);
-                    
-                    if (outcome == AVERROR(EAGAIN) || outcome == AVERROR_EOF)
+                    if(type != AVMEDIA_TYPE_VIDEO || !(packet->flags & AV_PKT_FLAG_KEY))
                     {
-                        break;
+                        av_packet_free(&packet);
+                        continue;
                     }
-                    else if(outcome < 0 )
+
+                    // drain right away, a frame threaded decoder would hold the frame until more packets arrive
+                    producer->scrubKeyframeSent = true;
+                    if(PushPacket(producer, stream, packet))
                     {
-                         profiler::StopBlock(profilePoint);
-                         std::string error = ErrorToString(outcome);
-                         logger::Error("avcodec_receive_frame error %s", error.c_str());
-                         return;
+                        PushPacket(producer, stream, nullptr);
                     }
-
-                    profiler::StopBlock(profilePoint);
-                    stream->processCallback(stream, producer, frame, packet);
+                    continue;
                 }
+
+                PushPacket(producer, stream, packet);
+                continue;
             }
             else if(type == AVMEDIA_TYPE_SUBTITLE)
             {
+                // subtitles are sparse and cheap to decode, keep them on the demuxer thread
                 int32_t subtitleStreamIndex = producer->decoder->subtitleIndexes[producer->decoder->subtitleIndex];
                 if(packet->stream_index == subtitleStreamIndex )
                 {
                     logger::Debug("Got subtitle decoder index %d index %d", producer->decoder->subtitleIndex, subtitleStreamIndex);
-                    stream->processCallback(stream, producer, frame, packet);
+                    stream->processCallback(stream, producer, nullptr, packet);
                 }
             }
 
             av_packet_free(&packet);
-            av_frame_free(&frame);
         }
 
     }
@@ -1255,12 +2626,6 @@ namespace mediadecoder
     {
         Result result;
 
-        const uint32_t nbSecondsPreBuffer = 10;
-
-        const uint32_t videoQueueSize =  nbSecondsPreBuffer * GetFramesPerSecond(decoder);
-        const uint32_t audioQueueSize = 32768u;
-        const uint32_t subtitleQueueSize = 32768u;
-
         assert(!decoder->producer);
 
         if( decoder->producer != nullptr )
@@ -1270,20 +2635,88 @@ namespace mediadecoder
 
         producer = new Producer();
         producer->decoder = decoder;
+        producer->preRollUs = preRollDurationUs;
+        producer->readAheadUs = readAheadDurationUs;
+        producer->readAheadBudget = readAheadBudget;
 
-        if(decoder->videoStream != nullptr)
-        {
-            producer->videoQueue = new VideoQueue(videoQueueSize);
-            producer->videoFramePool = new VideoQueue(videoQueueSize);
-            producer->videoQueueCapacity = videoQueueSize;
-        }
+        const double preRollSeconds = chrono::Seconds(preRollDurationUs);
+        uint64_t budget = queueBudget;
+
+        // audio frames are small, size the audio queue first from the pre-roll and the device format
         if(decoder->audioStream != nullptr)
         {
+            AudioStream* audioStream = decoder->audioStream;
+            const bool convert = audioStream->swrContext != nullptr;
+            const uint32_t frameSamples = audioStream->codecContext->frame_size > 0 ? audioStream->codecContext->frame_size : DEFAULT_AUDIO_FRAME_SAMPLES;
+            const uint32_t outputSampleRate = convert ? audioStream->outputSampleRate : audioStream->sampleRate;
+            const uint32_t channels = convert ? audioStream->outputChannels : audioStream->channels;
+            const uint32_t sampleSize = convert ? av_get_bytes_per_sample(SampleFormatToAVFormat(audioStream->outputSampleFormat))
+                                                : av_get_bytes_per_sample(audioStream->codecContext->sample_fmt);
+
+            // resampled frames size varies with the resampler delay
+            const uint32_t slotSamples = static_cast<uint32_t>(av_rescale_rnd(frameSamples, outputSampleRate, audioStream->sampleRate, AV_ROUND_UP)) 
+                                       + (convert ? AUDIO_ARENA_SAMPLES_MARGIN : 0);
+            const uint64_t slotSize = static_cast<uint64_t>(slotSamples) * sampleSize * channels;
+
+            // the pre-roll within a quarter of the budget, audio read ahead of video waits in its packet queue
+            const uint32_t preRollFrames = static_cast<uint32_t>(std::ceil(preRollSeconds * outputSampleRate / slotSamples));
+            const uint32_t budgetFrames = static_cast<uint32_t>(std::min<uint64_t>(budget / 4 / std::max<uint64_t>(slotSize, 1), UINT32_MAX));
+            const uint32_t audioQueueSize = std::max(std::min(preRollFrames, budgetFrames), MIN_AUDIO_QUEUE_SIZE);
+
+            producer->audioQueueUsage.budget = slotSize * audioQueueSize;
+            budget -= std::min(budget, producer->audioQueueUsage.budget);
+
             producer->audioQueue = new AudioQueue(audioQueueSize);
             producer->audioFramePool = new AudioQueue(audioQueueSize);
             producer->audioQueueCapacity = audioQueueSize;
+
+            result = framearena::Create(producer->audioArena, slotSize, audioQueueSize + AUDIO_ARENA_EXTRA_SLOTS, hugePagesEnabled);
+            if(!result)
+            {
+                Destroy(producer);
+                return result;
+            }
         }
 
+        // subtitles are sparse, their share bounds the entry count
+        const uint64_t subtitleBudget = queueBudget / SUBTITLE_QUEUE_BUDGET_SHARE;
+        const uint32_t subtitleQueueSize = static_cast<uint32_t>(std::max<uint64_t>(subtitleBudget / SUBTITLE_ENTRY_BYTES, MIN_SUBTITLE_QUEUE_SIZE));
+        budget -= std::min(budget, subtitleBudget);
+
+        // video queue gets the rest of the budget
+        if(decoder->videoStream != nullptr)
+        {
+            const FrameLayout& layout = decoder->videoStream->frameLayout;
+            const uint64_t frameSize = std::max<uint64_t>(layout.size, 1);
+            const uint32_t preRollFrames = static_cast<uint32_t>(preRollSeconds * GetFramesPerSecond(decoder));
+            const uint32_t budgetFrames = static_cast<uint32_t>(std::min<uint64_t>(budget / frameSize, UINT32_MAX));
+            const uint32_t videoQueueSize = std::max(std::min(preRollFrames, budgetFrames), MIN_VIDEO_QUEUE_SIZE);
+
+            producer->videoQueueUsage.budget = std::max(budget, frameSize * MIN_VIDEO_QUEUE_SIZE);
+
+            producer->videoQueue = new VideoQueue(videoQueueSize);
+            producer->videoFramePool = new VideoQueue(videoQueueSize);
+            producer->videoQueueCapacity = videoQueueSize;
+
+            // frame arena sized from the stream format, video frames are referenced when zero copy is on
+            if(!decoder->videoStream->zeroCopy)
+            {
+                producer->videoArenaSlots = videoQueueSize + VIDEO_ARENA_EXTRA_SLOTS;
+
+                result = framearena::Create(producer->videoArena, layout.size, producer->videoArenaSlots, hugePagesEnabled);
+                if(!result)
+                {
+                    Destroy(producer);
+                    return result;
+                }
+                producer->videoArenaLayout = layout;
+            }
+        }
+
+        logger::Info("Producer queues: video %d frames %lu MB, audio %d frames %lu KB, subtitle %d entries, pre-roll %f sec", 
+                     producer->videoQueueCapacity, producer->videoQueueUsage.budget / (1024 * 1024), 
+                     producer->audioQueueCapacity, producer->audioQueueUsage.budget / 1024, subtitleQueueSize, preRollSeconds);
+
         producer->subtitleQueue = new SubtitleQueue(subtitleQueueSize);
         producer->subtitleQueueCapacity = subtitleQueueSize;
         producer->streams.resize(decoder->avFormatContext->nb_streams);
@@ -1303,7 +2736,23 @@ namespace mediadecoder
         }
 
         producer->quitting = false;
-        producer->thread = std::thread(DecoderThread, producer);
+
+        // one decoder thread per audio & video stream fed by the demuxer thread
+        for(auto streamIt = producer->streams.begin(); streamIt != producer->streams.end(); ++streamIt)
+        {
+            Stream* stream = *streamIt;
+            if(stream && (stream == decoder->videoStream || stream == decoder->audioStream))
+            {
+                stream->packetQueue = new PacketQueue(PACKET_QUEUE_SIZE);
+                stream->packetQueueSize = 0;
+                ResetUsage(stream->packetQueueUsage);
+                stream->done = false;
+                stream->paused = false;
+                stream->thread = std::thread(DecoderThread, producer, stream);
+            }
+        }
+
+        producer->thread = std::thread(DemuxerThread, producer);
 
         return result;
     }
@@ -1316,7 +2765,25 @@ namespace mediadecoder
         }
 
         producer->quitting = true;
-        producer->thread.join();
+        NotifyAll(producer);
+        if(producer->thread.joinable())
+        {
+            producer->thread.join();
+        }
+
+        for(auto streamIt = producer->streams.begin(); streamIt != producer->streams.end(); ++streamIt)
+        {
+            Stream* stream = *streamIt;
+            if(stream && stream->packetQueue)
+            {
+                stream->thread.join();
+
+                Clear(stream->packetQueue);
+                delete stream->packetQueue;
+                stream->packetQueue = nullptr;
+                stream->packetQueueSize = 0;
+            }
+        }
 
         Clear(producer->videoQueue);
         Clear(producer->audioQueue);
@@ -1327,6 +2794,10 @@ namespace mediadecoder
         delete producer->audioQueue;
         delete producer->videoFramePool;
         delete producer->audioFramePool;
+
+        // frames still in flight hold their own arena reference
+        framearena::Release(producer->videoArena);
+        framearena::Release(producer->audioArena);
  
         delete producer;
         producer = nullptr;
@@ -1334,8 +2805,18 @@ namespace mediadecoder
 
     void Seek(Producer* producer, uint64_t timeUs)
     {
-        producer->seekTime = timeUs;
-        producer->seeking = true;
+        RequestSeek(producer, timeUs, false);
+    }
+
+    void Scrub(Producer* producer, uint64_t timeUs)
+    {
+        // no keyframe would ever end the scrub, every packet would be read and discarded
+        RequestSeek(producer, timeUs, producer->decoder->videoStream != nullptr);
+    }
+
+    uint64_t GetSeekLatency(Producer* producer)
+    {
+        return producer->seekLatencyUs;
     }
 
     bool IsSeeking(Producer* producer)
@@ -1343,6 +2824,16 @@ namespace mediadecoder
         return producer->seeking;
     }
 
+    void WaitSeekEnd(Producer* producer)
+    {
+        while( producer->seeking && !producer->quitting )
+        {
+            eventcount::Wait(&producer->frameProduced, [producer]() {
+                return !producer->seeking || producer->quitting;
+            }, WAIT_PLAYBACK_WAIT_TIME_MS);
+        }
+    }
+
     void Release(Producer* producer, VideoFrame* frame)
     {
         if(!frame)
@@ -1350,6 +2841,12 @@ namespace mediadecoder
             return;
         }
 
+        // drop decoder frame reference
+        if(frame->avFrame)
+        {
+            av_frame_unref(frame->avFrame);
+        }
+
         const bool outcome
                     = producer->videoFramePool->push(frame);
 
@@ -1366,12 +2863,17 @@ namespace mediadecoder
             return;
         }
 
+        // drop decoder frame reference
+        if(frame->avFrame)
+        {
+            av_frame_unref(frame->avFrame);
+        }
+
         const bool outcome
                     = producer->audioFramePool->push(frame);
         if(!outcome)
         {
-            delete [] frame->samples;
-            delete frame;
+            Delete(frame);
         }
     }
 
@@ -1381,17 +2883,37 @@ namespace mediadecoder
         delete subtitle;
     }
     
+    void SetDegradation(Producer* producer, degradation::Level level)
+    {
+        producer->degradation = level;
+    }
+
+    bool CanUseLowres(Decoder* decoder)
+    {
+        if(!decoder || !decoder->videoStream)
+        {
+            return false;
+        }
+
+        // lowres frames go through the conversion at their decoded size
+        const VideoStream* videoStream = decoder->videoStream;
+        return videoStream->codec->max_lowres > 0 && !videoStream->zeroCopy && !decoder->background;
+    }
+
     bool Consume(Producer* producer, VideoFrame*& videoFrame)
     {
         videoFrame = nullptr;
-        if(!GetHaveVideo(producer->decoder))
+        if(!GetHaveVideo(producer->decoder) || producer->seeking)
         {
             return false;
         }
 
         if( producer->videoQueue->pop(videoFrame) )
         {
+            OnPop(producer->videoQueueUsage, videoFrame->size, videoFrame->timeUs);
+            profiler::Set(profiler::GAUGE_QUEUE_BYTES, GetQueuedBytes(producer));
             producer->videoQueueSize--;
+            eventcount::Notify(&producer->frameConsumed);
         }
         return videoFrame != nullptr;
     }
@@ -1399,14 +2921,17 @@ namespace mediadecoder
     bool Consume(Producer* producer,AudioFrame*& audioFrame)
     {
         audioFrame = nullptr;
-        if(!GetHaveAudio(producer->decoder))
+        if(!GetHaveAudio(producer->decoder) || producer->seeking)
         {
             return false;
         }
 
         if( producer->audioQueue->pop(audioFrame) )
         {
+            OnPop(producer->audioQueueUsage, GetSize(audioFrame), audioFrame->timeUs);
+            profiler::Set(profiler::GAUGE_QUEUE_BYTES, GetQueuedBytes(producer));
             producer->audioQueueSize--;
+            eventcount::Notify(&producer->frameConsumed);
             return true;
         }
         return false;
@@ -1423,6 +2948,36 @@ namespace mediadecoder
          return subtitle != nullptr;
     }
 
+    void GetQueueStats(Producer* producer, QueueStats& stats)
+    {
+        stats.videoFrames = producer->videoQueueSize;
+        stats.audioFrames = producer->audioQueueSize;
+        stats.videoBytes = producer->videoQueueUsage.bytes;
+        stats.audioBytes = producer->audioQueueUsage.bytes;
+        stats.videoDurationUs = GetDurationUs(producer->videoQueueUsage);
+        stats.audioDurationUs = GetDurationUs(producer->audioQueueUsage);
+        stats.peakBytes = producer->peakQueueBytes;
+
+        stats.packets = 0;
+        stats.packetBytes = 0;
+        stats.packetDurationUs = 0;
+        for(auto it = producer->streams.begin(); it != producer->streams.end(); ++it)
+        {
+            Stream* stream = *it;
+            if(stream && stream->packetQueue)
+            {
+                stats.packets += stream->packetQueueSize;
+                stats.packetBytes += stream->packetQueueUsage.bytes;
+                stats.packetDurationUs = std::max(stats.packetDurationUs, GetDurationUs(stream->packetQueueUsage));
+            }
+        }
+    }
+
+    uint64_t GetQueuedBytes(Producer* producer)
+    {
+        return producer->videoQueueUsage.bytes + producer->audioQueueUsage.bytes;
+    }
+
     void WaitForPlayback(Producer* producer)
     {
         if(!GetHaveVideo(producer->decoder))
@@ -1430,14 +2985,15 @@ namespace mediadecoder
             return;
         }
 
-        // Wait for half a second playback before starting to play
-        const uint32_t nbBufferForPlayback = GetFramesPerSecond(producer->decoder) / 2;
+        // Wait for half a second playback before starting to play, the queue may be limited to less by its budget
+        const uint32_t nbBufferForPlayback = std::min(GetFramesPerSecond(producer->decoder) / 2, producer->videoQueueCapacity / 2);
         bool haveVideo = producer->videoQueueSize > nbBufferForPlayback;
 
-        while( !haveVideo )
+        while( !haveVideo && !producer->done )
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(WAIT_PLAYBACK_SLEEP_TIME_MS));
-            haveVideo = producer->videoQueueSize > nbBufferForPlayback;
+            haveVideo = eventcount::Wait(&producer->frameProduced, [producer, nbBufferForPlayback]() {
+                return producer->videoQueueSize > nbBufferForPlayback;
+            }, WAIT_PLAYBACK_WAIT_TIME_MS);
         }
 
         logger::Info("Playback ready %d buffers", producer->videoQueueSize.load());
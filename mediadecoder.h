@@ -5,11 +5,17 @@
 #include "curl.h"
 #include "result.h"
 #include "subtitle.h"
+#include "eventcount.h"
+#include "interleave.h"
+#include "workerpool.h"
+#include "framearena.h"
+#include "degradation.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
+#include <libswresample/swresample.h>
 #include <libavutil/imgutils.h>
 }
 
@@ -29,12 +35,53 @@ extern "C" {
 #include <string>
 #include <vector>
 #include <thread>
+#include <mutex>
+#include <atomic>
 
 namespace mediadecoder
 {
     static const uint32_t NUM_FRAME_DATA_POINTERS = 4;
     static const uint32_t DEFAULT_SUBTITLE_DURATION_SEC = 4;
     static const uint32_t MAX_FRAME_RATE = 120;
+    // compressed packets read-ahead is limited by duration & bytes, the count is a hard limit per stream
+    static const uint32_t PACKET_QUEUE_SIZE = 16384;
+    static const uint64_t DEFAULT_READ_AHEAD_US = 60000000;
+    static const uint64_t DEFAULT_READ_AHEAD_BYTES = 256ULL * 1024ULL * 1024ULL;
+
+    // decoded frame queues are limited by a memory budget and a pre-roll duration
+    static const uint64_t DEFAULT_QUEUE_BUDGET_BYTES = 512ULL * 1024ULL * 1024ULL;
+    static const uint64_t DEFAULT_PRE_ROLL_US = 10000000;
+    static const uint32_t MIN_VIDEO_QUEUE_SIZE = 4;
+    static const uint32_t MIN_AUDIO_QUEUE_SIZE = 16;
+
+    // subtitles take a small share of the queue budget, an entry is estimated with its text and dialogue
+    static const uint64_t SUBTITLE_QUEUE_BUDGET_SHARE = 256;
+    static const uint64_t SUBTITLE_ENTRY_BYTES = 1024;
+    static const uint32_t MIN_SUBTITLE_QUEUE_SIZE = 64;
+
+    // automatic decoder thread count limit, libavcodec frame threading does not scale further
+    static const uint32_t MAX_AUTO_DECODER_THREADS = 16;
+
+    // frame arenas: frames held by the renderer and audio frame size when the codec has no fixed frame size
+    static const uint32_t VIDEO_ARENA_EXTRA_SLOTS = 4;
+    static const uint32_t AUDIO_ARENA_EXTRA_SLOTS = 4;
+    static const uint32_t DEFAULT_AUDIO_FRAME_SAMPLES = 4096;
+    static const uint32_t AUDIO_ARENA_SAMPLES_MARGIN = 256;
+
+    // sliced conversion, the automatic thread count is capped as conversion is memory bound
+    // and runs next to the decoder threads
+    static const uint32_t MIN_SCALE_SLICE_HEIGHT = 64;
+    static const uint32_t MAX_AUTO_SCALE_THREADS = 4;
+    static const uint32_t SCALE_SLICE_ALIGNMENT = 16;
+
+    // codec threading
+    enum ThreadType
+    {
+        THREAD_TYPE_AUTO,
+        THREAD_TYPE_FRAME,
+        THREAD_TYPE_SLICE,
+        THREAD_TYPE_INVALID
+    };
 
     // forward declaration
     struct Stream;
@@ -43,6 +90,30 @@ namespace mediadecoder
     // types
     typedef boost::function<void (Stream*, Producer*, AVFrame*, AVPacket*)> DecoderCallback;
 
+    template<typename T>
+    using FrameQueue = boost::lockfree::queue<T, boost::lockfree::fixed_sized<true> >;
+    typedef FrameQueue<AVPacket*> PacketQueue;
+
+    // queue memory & duration
+    struct QueueUsage
+    {
+        std::atomic<uint64_t> bytes = 0;
+        std::atomic<uint64_t> startTimeUs = 0;
+        std::atomic<uint64_t> endTimeUs = 0;
+        uint64_t budget = 0;
+    };
+
+    // video frame buffers layout carved from a single block
+    struct FrameLayout
+    {
+        AVPixelFormat format = AV_PIX_FMT_NONE;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        int32_t lineSize[NUM_FRAME_DATA_POINTERS] = { 0, 0, 0, 0 };
+        size_t offsets[NUM_FRAME_DATA_POINTERS] = { 0, 0, 0, 0 };
+        size_t size = 0;
+    };
+
     struct Stream
     {
         AVCodecParameters* codecParameters = nullptr;
@@ -53,6 +124,19 @@ namespace mediadecoder
 
         // processing
         DecoderCallback processCallback;
+
+        // compressed packets fed by the demuxer to the stream decoder thread
+        PacketQueue* packetQueue = nullptr;
+        std::atomic<uint32_t> packetQueueSize = 0;
+        QueueUsage packetQueueUsage;
+        eventcount::EventCount packetProduced;
+
+        std::thread thread;
+        std::atomic<bool> paused = false;
+        std::atomic<bool> done = false;
+
+        // frames before this time are decoded but not converted nor queued after a seek
+        std::atomic<uint64_t> skipUntilUs = 0;
     };
 
     struct VideoStream : public Stream
@@ -69,10 +153,31 @@ namespace mediadecoder
         // reformat buffer size if reformat is required
         uint32_t reformatBufferSize = 0;
 
-        uint32_t width = 0;
-        uint32_t height = 0;
+        // sliced sws_scale, one context per horizontal slice run on the scale pool
+        std::vector<SwsContext*> swsSliceContexts;
+        std::vector<uint32_t> sliceRows;
+        std::vector<uint64_t> sliceTimeUs;
+        workerpool::Pool* scalePool = nullptr;
+
+        // reference decoder frames instead of copying them
+        bool zeroCopy = false;
+
+        // output frame buffers layout
+        FrameLayout frameLayout;
+
+        // written by the decoder thread on a resolution change, frames carry their own size
+        std::atomic<uint32_t> width = 0;
+        std::atomic<uint32_t> height = 0;
 
         uint32_t framesPerSecond = 0;
+
+        // degradation level in effect, applied by the decoder thread between packets
+        degradation::Level degradation = degradation::LEVEL_NONE;
+
+        // lowres frames keep their decoded size, a codec reopened with the other setting takes over at the next keyframe
+        bool lowres = false;
+        bool pendingLowres = false;
+        AVCodecContext* pendingCodecContext = nullptr;
     };
 
     struct AudioStream : public Stream
@@ -83,6 +188,22 @@ namespace mediadecoder
 
         AudioChannelList channelMapping;
         std::map<uint32_t, uint32_t> channelInputToOutputMapping;
+
+        // dense input to output mapping & kernel used to interleave decoded frames
+        std::vector<uint32_t> channelPermutation;
+        interleave::Function interleaveFunction = nullptr;
+
+        // queue decoder frames, the consumer interleaves them straight into the device buffer
+        bool deferInterleave = false;
+
+        // swr_convert context converting to the audio device format in one pass
+        SwrContext* swrContext = nullptr;
+        std::vector<int> swrChannelMap;
+
+        // audio device format
+        uint32_t outputChannels = 0;
+        uint32_t outputSampleRate = 0;
+        SampleFormat outputSampleFormat = SF_FMT_INVALID;
     };
 
     struct SubtitleStream : public Stream
@@ -103,6 +224,16 @@ namespace mediadecoder
         uint32_t width = 0;
         uint32_t height = 0;
         uint64_t timeUs = 0;
+
+        AVPixelFormat format = AV_PIX_FMT_NONE;
+        uint32_t size = 0;
+
+        // decoder frame reference when zero copy is enabled
+        AVFrame* avFrame = nullptr;
+
+        // buffers are either in an arena slot or in a heap block
+        framearena::Arena* arena = nullptr;
+        uint8_t* memory = nullptr;
     };
 
     struct AudioFrame
@@ -111,8 +242,18 @@ namespace mediadecoder
         uint32_t sampleSize = 0;
         uint32_t nbSamples = 0;
         uint32_t channels = 0;
+        uint32_t bufferSize = 0;
         uint64_t timeUs = 0;
         std::atomic<bool> inUse = false;
+
+        // samples arena slot, samples are on the heap if null
+        framearena::Arena* arena = nullptr;
+
+        // deferred interleave, samples are read from the decoder frame by Interleave
+        AVFrame* avFrame = nullptr;
+        interleave::Function interleaveFunction = nullptr;
+        const uint32_t* permutation = nullptr;
+        std::vector<const uint8_t*> planes;
     };
 
     struct Subtitle
@@ -131,12 +272,34 @@ namespace mediadecoder
         glm::vec3 color = {1.0f, 1.0f, 1.0f};
     };
 
-    template<typename T>
-    using FrameQueue = boost::lockfree::queue<T, boost::lockfree::fixed_sized<true> >;
+    struct QueueStats
+    {
+        uint32_t videoFrames = 0;
+        uint32_t audioFrames = 0;
+        uint64_t videoBytes = 0;
+        uint64_t audioBytes = 0;
+        uint64_t videoDurationUs = 0;
+        uint64_t audioDurationUs = 0;
+        uint64_t peakBytes = 0;
+
+        // compressed packets read ahead
+        uint32_t packets = 0;
+        uint64_t packetBytes = 0;
+        uint64_t packetDurationUs = 0;
+    };
+
     typedef FrameQueue<AudioFrame*> AudioQueue;
     typedef FrameQueue<VideoFrame*> VideoQueue;
     typedef FrameQueue<Subtitle*>   SubtitleQueue;
 
+    // Video keyframe decode times built from the container index on first seek and completed while
+    // demuxing. They are in the av_seek_frame timestamp domain, a seek lands on the entry itself.
+    struct KeyframeIndex
+    {
+        std::vector<uint64_t> timesUs;
+        bool built = false;
+    };
+
     struct Decoder
     {
         AVFormatContext* avFormatContext = nullptr;
@@ -153,6 +316,12 @@ namespace mediadecoder
         
         Producer* producer = nullptr;
         curl::Session* curl = nullptr;
+
+        // demuxer thread only
+        KeyframeIndex keyframeIndex;
+
+        // set before Open. Background decoders open the video stream only, single threaded and without conversion.
+        bool background = false;
     };
 
     struct Producer
@@ -171,31 +340,82 @@ namespace mediadecoder
         uint32_t audioQueueCapacity = 0;
         uint32_t subtitleQueueCapacity = 0;
 
+        // decoding is throttled on the first limit reached: capacity, budget or pre-roll
+        QueueUsage videoQueueUsage;
+        QueueUsage audioQueueUsage;
+        uint64_t preRollUs = 0;
+        std::atomic<uint64_t> peakQueueBytes = 0;
+
+        // demuxing is throttled when read-ahead reaches its duration or its budget
+        uint64_t readAheadUs = 0;
+        uint64_t readAheadBudget = 0;
+
+        // queue events
+        eventcount::EventCount frameProduced;
+        eventcount::EventCount frameConsumed;
+        eventcount::EventCount packetConsumed;
+
         // frame pools
         VideoQueue* videoFramePool = nullptr;
         AudioQueue* audioFramePool = nullptr;
 
+        // frame pools buffers, allocated by the decoder threads
+        framearena::Arena* videoArena = nullptr;
+        framearena::Arena* audioArena = nullptr;
+        FrameLayout videoArenaLayout;
+        uint32_t videoArenaSlots = 0;
+
         // subtitle
         SubtitleQueue* subtitleQueue = nullptr;
 
         // media streams owned by the decoder
         std::vector<Stream*> streams;
 
+        // demuxer thread, each audio & video stream has its own decoder thread
         std::thread thread;
         std::atomic<bool> quitting = false;
 
-        uint64_t currentDecodingTimeUs = 0;
+        std::atomic<uint64_t> currentDecodingTimeUs = 0;
 
-        // seeking
+        // seeking, a request replaces the pending one and the demuxer serves the newest
+        std::mutex seekMutex;
         std::atomic<bool> seeking;
         uint64_t seekTime = 0;
+        bool seekKeyframeOnly = false;
+        uint64_t seekRequests = 0;
+        uint64_t seekServedRequests = 0;
+
+        // scrub preview, only the keyframe preceding the seek time is decoded
+        std::atomic<bool> scrubbing = false;
+        std::atomic<bool> scrubKeyframeSent = false;
+
+        // seek latency from request to first queued frame
+        std::atomic<uint64_t> seekStartTimeUs = 0;
+        std::atomic<bool> seekFirstFramePending = false;
+        std::atomic<uint64_t> seekLatencyUs = 0;
+
+        // requested video decoding degradation
+        std::atomic<degradation::Level> degradation = degradation::LEVEL_NONE;
 
         // eof
+        std::atomic<bool> demuxDone = false;
         std::atomic<bool> done = false;;
     };
 
     Result   Init();
     void     SetOutputFormat(const VideoFormatList&);
+    void     SetZeroCopy(bool);
+    void     SetScaleThreads(uint32_t);
+    void     SetHugePages(bool);
+    void     SetQueueBudget(uint64_t bytes);
+    void     SetPreRollDuration(uint64_t timeUs);
+    void     SetReadAheadDuration(uint64_t timeUs);
+    void     SetReadAheadBudget(uint64_t bytes);
+
+    // video decoder threading policy applied before the codec is opened. 0 threads is one per core.
+    void       SetDecoderThreads(uint32_t);
+    void       SetDecoderThreadType(ThreadType);
+    ThreadType GetThreadTypeFromString(const std::string&);
 
     // decoder
     Result   Create(Decoder*& decoder);
@@ -212,6 +432,13 @@ namespace mediadecoder
     uint32_t    GetAudioSampleRate(Decoder*);
     SampleFormat GetAudioSampleFormat(Decoder*);
 
+    // convert decoded audio to the format negotiated with the audio device
+    Result      SetAudioOutputFormat(Decoder*, uint32_t channels, uint32_t sampleRate, SampleFormat sampleFormat);
+
+    // Queue decoder frames needing no conversion and interleave them when consumed.
+    // Used when the device maps its buffer so samples are copied once.
+    void        SetAudioDeferredInterleave(Decoder*, bool);
+
     uint64_t GetDuration(Decoder* decoder);
 
     bool GetHaveAudio(Decoder* decoder);
@@ -227,16 +454,33 @@ namespace mediadecoder
     Result Create(Producer*& producer, Decoder*);
     void   Destroy(Producer*&);
 
+    // non blocking, a newer request supersedes a pending one and in flight decoding is abandoned
     void   Seek(Producer*,uint64_t timeUs);
+    // seek showing only the keyframe preceding timeUs, audio is not decoded until the next Seek.
+    // A plain seek without video stream
+    void   Scrub(Producer*,uint64_t timeUs);
     bool   IsSeeking(Producer*);
+    void   WaitSeekEnd(Producer*);
+    uint64_t GetSeekLatency(Producer*);
+    // video decoding shortcuts taken when presentation falls behind, applied from the next packet
+    void   SetDegradation(Producer*, degradation::Level);
+    bool   CanUseLowres(Decoder*);
     bool   Consume(Producer*, VideoFrame*& frame);
     bool   Consume(Producer*, AudioFrame*& frame);
     bool   Consume(Producer*, Subtitle*& sub);
 
     void   Release(Producer*,VideoFrame*);
     void   Release(Producer*,AudioFrame*);
+
+    // interleave samples [offset, offset + nbSamples) of a frame to output, copied from samples
+    // or converted from the decoder frame of a deferred interleave
+    void   Interleave(AudioFrame*, uint32_t offset, uint32_t nbSamples, uint8_t* output);
     void   Release(Producer*,Subtitle*);
 
     void   WaitForPlayback(Producer*);
+
+    // decoded bytes in flight
+    void     GetQueueStats(Producer*, QueueStats&);
+    uint64_t GetQueuedBytes(Producer*);
 };
 
@@ -0,0 +1,433 @@
+#include "precomp.h"
+#include "netbench.h"
+#include "curl.h"
+#include "chrono.h"
+#include "logger.h"
+
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace {
+
+#ifdef WIN32
+    typedef SOCKET Socket;
+    const Socket INVALID_SOCKET_VALUE = INVALID_SOCKET;
+    const int SEND_FLAGS = 0;
+
+    void CloseSocket(Socket socket)
+    {
+        closesocket(socket);
+    }
+#else
+    typedef int Socket;
+    const Socket INVALID_SOCKET_VALUE = -1;
+
+    // a connection closed by the client fails the send instead of raising SIGPIPE
+#ifdef MSG_NOSIGNAL
+    const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+    const int SEND_FLAGS = 0;
+#endif
+
+    void CloseSocket(Socket socket)
+    {
+        close(socket);
+    }
+#endif
+
+    // a resource served slower per connection than the aggregate link
+    const uint64_t RESOURCE_SIZE = 32 * 1024 * 1024;
+    const uint64_t CONNECTION_BYTES_PER_SECOND = 4 * 1024 * 1024;
+    const size_t SEND_SIZE = 16 * 1024;
+
+    // demuxer io context sized reads, seeks like a seek bar jump
+    const size_t READ_SIZE = 32 * 1024;
+    const uint32_t NB_SEEKS = 8;
+    const size_t SEEK_READ_SIZE = 256 * 1024;
+
+    // compared to one connection when the session is configured for one
+    const uint32_t DEFAULT_PARALLEL_CONNECTIONS = 4;
+
+    // upper bound of a socket wait, the server stop is picked up on timeout
+    const int socketWaitTimeMs = 100;
+
+    uint8_t Pattern(uint64_t offset)
+    {
+        return static_cast<uint8_t>((offset >> 12) * 131 + offset * 7);
+    }
+
+    // HTTP/1.1 keep-alive server of the pattern on the loopback, one thread per connection
+    struct StandIn
+    {
+        Socket listener = INVALID_SOCKET_VALUE;
+        uint16_t port = 0;
+        std::atomic<bool> stop = false;
+        std::thread thread;
+
+        std::mutex mutex;
+        std::vector<std::thread> connections;
+    };
+
+    bool WaitReadable(Socket socket, const std::atomic<bool>& stop)
+    {
+        while( !stop )
+        {
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(socket, &readable);
+            timeval timeout = { 0, socketWaitTimeMs * 1000 };
+
+            const int ready = select(static_cast<int>(socket + 1), &readable, nullptr, nullptr, &timeout);
+            if( ready != 0 )
+            {
+                return ready > 0;
+            }
+        }
+        return false;
+    }
+
+    bool SendAll(Socket socket, const char* data, size_t size)
+    {
+        while( size > 0 )
+        {
+            const int sent = send(socket, data, static_cast<int>(size), SEND_FLAGS);
+            if( sent <= 0 )
+            {
+                return false;
+            }
+            data += sent;
+            size -= static_cast<size_t>(sent);
+        }
+        return true;
+    }
+
+    // the body is paced at CONNECTION_BYTES_PER_SECOND from the start of the response
+    bool SendBody(Socket socket, uint64_t first, uint64_t length, const std::atomic<bool>& stop)
+    {
+        std::vector<char> block(SEND_SIZE);
+        const uint64_t startTimeUs = chrono::RealNow();
+        uint64_t sent = 0;
+
+        while( sent < length )
+        {
+            if( stop )
+            {
+                return false;
+            }
+
+            const uint64_t dueTimeUs = sent * 1000000 / CONNECTION_BYTES_PER_SECOND;
+            const uint64_t elapsedTimeUs = chrono::RealNow() - startTimeUs;
+            if( dueTimeUs > elapsedTimeUs )
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(dueTimeUs - elapsedTimeUs));
+            }
+
+            const size_t size = static_cast<size_t>(std::min<uint64_t>(SEND_SIZE, length - sent));
+            for(size_t i = 0; i < size; i++)
+            {
+                block[i] = static_cast<char>(Pattern(first + sent + i));
+            }
+            if( !SendAll(socket, block.data(), size) )
+            {
+                return false;
+            }
+            sent += size;
+        }
+        return true;
+    }
+
+    void Serve(Socket socket, const std::atomic<bool>* stop)
+    {
+        std::string pending;
+        char input[4096];
+
+        for(;;)
+        {
+            size_t headerEnd = std::string::npos;
+            while( (headerEnd = pending.find("\r\n\r\n")) == std::string::npos )
+            {
+                const int received = WaitReadable(socket, *stop) ? recv(socket, input, sizeof(input), 0) : 0;
+                if( received <= 0 )
+                {
+                    CloseSocket(socket);
+                    return;
+                }
+                pending.append(input, static_cast<size_t>(received));
+            }
+
+            std::string header = pending.substr(0, headerEnd);
+            pending.erase(0, headerEnd + 4);
+            std::transform(header.begin(), header.end(), header.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+
+            // Range: bytes=first-[last]
+            const std::string rangeHeader = "range: bytes=";
+            const size_t range = header.find(rangeHeader);
+            uint64_t first = 0;
+            uint64_t last = RESOURCE_SIZE - 1;
+            if( range != std::string::npos )
+            {
+                char* end = nullptr;
+                first = strtoull(header.c_str() + range + rangeHeader.size(), &end, 10);
+                if( *end == '-' && isdigit(static_cast<unsigned char>(end[1])) )
+                {
+                    last = std::min(last, static_cast<uint64_t>(strtoull(end + 1, nullptr, 10)));
+                }
+            }
+
+            std::string response;
+            if( range != std::string::npos && (first >= RESOURCE_SIZE || first > last) )
+            {
+                response = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" + std::to_string(RESOURCE_SIZE) + "\r\nContent-Length: 0\r\n\r\n";
+                if( !SendAll(socket, response.c_str(), response.size()) )
+                {
+                    break;
+                }
+                continue;
+            }
+
+            const uint64_t length = last - first + 1;
+            if( range != std::string::npos )
+            {
+                response = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(RESOURCE_SIZE) + "\r\n";
+            }
+            else
+            {
+                response = "HTTP/1.1 200 OK\r\n";
+            }
+            response += "Accept-Ranges: bytes\r\nContent-Length: " + std::to_string(length) + "\r\nConnection: keep-alive\r\n\r\n";
+
+            if( !SendAll(socket, response.c_str(), response.size()) || !SendBody(socket, first, length, *stop) )
+            {
+                break;
+            }
+        }
+        CloseSocket(socket);
+    }
+
+    void Accept(StandIn* standIn)
+    {
+        while( WaitReadable(standIn->listener, standIn->stop) )
+        {
+            const Socket socket = accept(standIn->listener, nullptr, nullptr);
+            if( socket == INVALID_SOCKET_VALUE )
+            {
+                continue;
+            }
+
+            std::scoped_lock<std::mutex> guard(standIn->mutex);
+            standIn->connections.emplace_back(Serve, socket, &standIn->stop);
+        }
+    }
+
+    Result Start(StandIn& standIn)
+    {
+#ifdef WIN32
+        WSADATA data;
+        if( WSAStartup(MAKEWORD(2, 2), &data) != 0 )
+        {
+            return Result(false, "Cannot initialize winsock");
+        }
+#endif
+        standIn.listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if( standIn.listener == INVALID_SOCKET_VALUE )
+        {
+            return Result(false, "Cannot create stand-in server socket");
+        }
+
+        // any free loopback port
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        socklen_t addressSize = sizeof(address);
+
+        if( bind(standIn.listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || listen(standIn.listener, SOMAXCONN) != 0
+            || getsockname(standIn.listener, reinterpret_cast<sockaddr*>(&address), &addressSize) != 0 )
+        {
+            CloseSocket(standIn.listener);
+            return Result(false, "Cannot listen on the loopback");
+        }
+
+        standIn.port = ntohs(address.sin_port);
+        standIn.thread = std::thread(Accept, &standIn);
+        return Result(true);
+    }
+
+    void Stop(StandIn& standIn)
+    {
+        standIn.stop = true;
+        if( standIn.thread.joinable() )
+        {
+            standIn.thread.join();
+        }
+        for(auto it = standIn.connections.begin(); it != standIn.connections.end(); ++it)
+        {
+            it->join();
+        }
+        standIn.connections.clear();
+        CloseSocket(standIn.listener);
+#ifdef WIN32
+        WSACleanup();
+#endif
+    }
+
+    struct Stats
+    {
+        uint64_t bytes = 0;
+        uint64_t timeUs = 0;
+        uint32_t requests = 0;
+        uint32_t connects = 0;
+    };
+
+    Result Verify(const uint8_t* data, size_t size, uint64_t offset)
+    {
+        for(size_t i = 0; i < size; i++)
+        {
+            if( data[i] != Pattern(offset + i) )
+            {
+                return Result(false, "Byte at %lu is %d instead of %d", offset + i, data[i], Pattern(offset + i));
+            }
+        }
+        return Result(true);
+    }
+
+    // read until size bytes or the end of the resource, returns the bytes read
+    size_t ReadFully(curl::Session* session, uint8_t* data, size_t size)
+    {
+        size_t read = 0;
+        while( read < size && !session->cancel )
+        {
+            const bool done = session->done;
+            const size_t bytes = curl::Read(session, data + read, size - read);
+            if( bytes == 0 )
+            {
+                if( done )
+                {
+                    break;
+                }
+                std::this_thread::yield();
+            }
+            read += bytes;
+        }
+        return read;
+    }
+
+    Result Fetch(const std::string& url, uint32_t connections, bool verify, Stats& stats)
+    {
+        curl::SetConnections(connections);
+
+        curl::Session* session = nullptr;
+        Result result = curl::Create(session, url, 0);
+        if( !result )
+        {
+            return result;
+        }
+
+        std::vector<uint8_t> data(std::max(READ_SIZE, SEEK_READ_SIZE));
+        const uint64_t startTimeUs = chrono::RealNow();
+        for(;;)
+        {
+            const size_t read = ReadFully(session, data.data(), READ_SIZE);
+            if( verify && result )
+            {
+                result = Verify(data.data(), read, stats.bytes);
+            }
+            stats.bytes += read;
+            if( read < READ_SIZE )
+            {
+                break;
+            }
+        }
+        stats.timeUs = chrono::RealNow() - startTimeUs;
+
+        // jumps around the resource, each one a new set of range requests
+        std::mt19937_64 random(0);
+        for(uint32_t i = 0; verify && result && i < NB_SEEKS && stats.bytes > SEEK_READ_SIZE; i++)
+        {
+            const uint64_t offset = random() % (stats.bytes - SEEK_READ_SIZE);
+            curl::Seek(session, offset);
+            const size_t read = ReadFully(session, data.data(), SEEK_READ_SIZE);
+            result = read == SEEK_READ_SIZE ? Verify(data.data(), read, offset) : Result(false, "Read %lu bytes instead of %lu after seeking to %lu", read, SEEK_READ_SIZE, offset);
+        }
+
+        {
+            std::scoped_lock<std::mutex> guard(session->mutex);
+            stats.requests = session->requests;
+            stats.connects = session->connects;
+            if( result && session->result != CURLE_OK )
+            {
+                result = Result(false, "Download failed %s", curl_easy_strerror(session->result));
+            }
+        }
+        curl::Destroy(session);
+
+        if( result && verify && stats.bytes != RESOURCE_SIZE )
+        {
+            result = Result(false, "Read %lu bytes instead of %lu", stats.bytes, RESOURCE_SIZE);
+        }
+        return result;
+    }
+}
+
+namespace netbench
+{
+    Result Run(const std::string& url)
+    {
+        StandIn standIn;
+        std::string target = url;
+        if( url.empty() )
+        {
+            Result result = Start(standIn);
+            if( !result )
+            {
+                return result;
+            }
+            target = "http://127.0.0.1:" + std::to_string(standIn.port) + "/standin.bin";
+            logger::Info("Stand-in server %s %lu bytes at %lu bytes/s per connection", target.c_str(), RESOURCE_SIZE, CONNECTION_BYTES_PER_SECOND);
+        }
+
+        const uint32_t configured = curl::GetConnections();
+        const uint32_t connections[] = { 1, configured > 1 ? configured : DEFAULT_PARALLEL_CONNECTIONS };
+
+        Result result(true);
+        Stats stats[2];
+        for(size_t i = 0; i < 2 && result; i++)
+        {
+            result = Fetch(target, connections[i], url.empty(), stats[i]);
+            if( result )
+            {
+                const double megabytes = static_cast<double>(stats[i].bytes) / (1024.0 * 1024.0);
+                logger::Info("Network fetch %u connections %f MB in %f ms %f MB/s %u requests %u connects",
+                             connections[i], megabytes, chrono::Milliseconds(stats[i].timeUs),
+                             megabytes / chrono::Seconds(std::max<uint64_t>(stats[i].timeUs, 1)), stats[i].requests, stats[i].connects);
+            }
+        }
+
+        curl::SetConnections(configured);
+        if( url.empty() )
+        {
+            Stop(standIn);
+        }
+
+        if( result )
+        {
+            logger::Info("Network fetch speedup %fx", static_cast<double>(stats[0].timeUs) / static_cast<double>(std::max<uint64_t>(stats[1].timeUs, 1)));
+        }
+        return result;
+    }
+}
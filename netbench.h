@@ -0,0 +1,14 @@
+#pragma once
+
+#include "result.h"
+
+#include <string>
+
+namespace netbench
+{
+    // Download url through a network session on one connection then on parallel range
+    // requests and report the throughput of each. Without url, a loopback stand-in server
+    // with range support and per connection throttling is started and every byte read,
+    // sequentially and after seeks, is verified against the served pattern.
+    Result Run(const std::string& url);
+}
@@ -0,0 +1,151 @@
+#include "precomp.h"
+#include "playbench.h"
+#include "player.h"
+#include "chrono.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+    // presentations off by more than a frame duration and dropped frames, as a fraction of the frames
+    const double MAX_LATE_FRACTION = 0.01;
+    const double MAX_DROPPED_FRACTION = 0.01;
+
+    // audio clock minus presentation clock, the player slews anything above the sync threshold
+    const double MAX_AVERAGE_AV_OFFSET_US = static_cast<double>(avsync::SYNC_THRESHOLD_US);
+    const int64_t MAX_AV_OFFSET_US = avsync::RESYNC_THRESHOLD_US;
+
+    struct Presentation
+    {
+        uint64_t frames = 0;
+        uint64_t lateFrames = 0;
+        uint64_t backwardFrames = 0;
+        uint64_t lastTimeUs = 0;
+        int64_t  maxErrorUs = 0;
+    };
+
+    // check the frame drawn by the last Present against the presentation clock
+    void OnPresent(player::Player* player, uint64_t frameDurationUs, Presentation& presentation)
+    {
+        videodevice::FrameStats stats;
+        videodevice::GetFrameStats(player->videoDevice, stats);
+        if( stats.frames == presentation.frames )
+        {
+            return;
+        }
+        presentation.frames = stats.frames;
+
+        const uint64_t timeUs = player->currentTimeUs;
+        if( timeUs < presentation.lastTimeUs )
+        {
+            presentation.backwardFrames++;
+        }
+        presentation.lastTimeUs = timeUs;
+
+        const int64_t errorUs = std::abs(chrono::Wait(player->playbackStartTimeUs, timeUs));
+        presentation.maxErrorUs = std::max(presentation.maxErrorUs, errorUs);
+        if( errorUs > static_cast<int64_t>(frameDurationUs) )
+        {
+            presentation.lateFrames++;
+        }
+    }
+}
+
+namespace playbench
+{
+    Result Run(const std::string& filename)
+    {
+        if( filename.empty() )
+        {
+            return Result(false, "Playback check requires a media path");
+        }
+
+        audiodevice::SetBackend(audiodevice::BACKEND_NULL);
+        videodevice::SetBackend(videodevice::BACKEND_NULL);
+        chrono::SetVirtualClock();
+
+        player::Player* player = nullptr;
+        Result result = player::Init( [](){} );
+        if(result)
+        {
+            result = player::Create(player);
+        }
+        if(result)
+        {
+            result = player::Open(player, filename);
+        }
+        if(!result)
+        {
+            if(player)
+            {
+                player::Destroy(player);
+            }
+            chrono::SetRealClock();
+            return result;
+        }
+
+        const uint64_t frameDurationUs = 1000000 / std::max(mediadecoder::GetFramesPerSecond(player->decoder), 1U);
+        const uint64_t durationUs = player::GetDuration(player);
+        const uint64_t startTimeUs = chrono::RealNow();
+
+        Presentation presentation;
+
+        player::Play(player);
+        while( !player::IsEndOfStream(player) )
+        {
+            player::Present(player);
+            if( player->videoDevice )
+            {
+                OnPresent(player, frameDurationUs, presentation);
+            }
+        }
+
+        const uint64_t realTimeUs = chrono::RealNow() - startTimeUs;
+
+        avsync::Stats syncStats;
+        player::GetAvSyncStats(player, syncStats);
+
+        audiodevice::SinkStats sinkStats;
+        audiodevice::GetSinkStats(player->audioDevice, sinkStats);
+
+        player::Destroy(player);
+        chrono::SetRealClock();
+
+        const double averageOffsetUs = syncStats.updates != 0 ? syncStats.absOffsetSumUs / static_cast<double>(syncStats.updates) : 0.0;
+        const int64_t maxOffsetUs = std::max(std::abs(syncStats.minOffsetUs), std::abs(syncStats.maxOffsetUs));
+        const double frames = static_cast<double>(std::max<uint64_t>(presentation.frames + syncStats.droppedFrames, 1));
+
+        logger::Info("Playback check: %f s of media in %f s (x%f)", chrono::Seconds(durationUs), chrono::Seconds(realTimeUs),
+                     static_cast<double>(durationUs) / static_cast<double>(std::max<uint64_t>(realTimeUs, 1)));
+        logger::Info("Playback check: %lu frames presented, %lu late, %lu out of order, max error %f ms, %lu dropped",
+                     presentation.frames, presentation.lateFrames, presentation.backwardFrames,
+                     chrono::Milliseconds(presentation.maxErrorUs), syncStats.droppedFrames);
+        logger::Info("Playback check: A/V offset avg %f ms max %f ms, %lu resyncs, %d audio underruns",
+                     chrono::Milliseconds(averageOffsetUs), chrono::Milliseconds(maxOffsetUs), syncStats.resyncs, sinkStats.underruns);
+
+        std::string failures;
+        if( presentation.backwardFrames != 0 )
+        {
+            failures += " presentation timestamps went back;";
+        }
+        if( static_cast<double>(presentation.lateFrames) > MAX_LATE_FRACTION * frames )
+        {
+            failures += " frames presented off time;";
+        }
+        if( static_cast<double>(syncStats.droppedFrames) > MAX_DROPPED_FRACTION * frames )
+        {
+            failures += " frames dropped;";
+        }
+        if( averageOffsetUs > MAX_AVERAGE_AV_OFFSET_US || maxOffsetUs >= MAX_AV_OFFSET_US )
+        {
+            failures += " audio and video drifted;";
+        }
+
+        if( !failures.empty() )
+        {
+            return Result(false, "Playback check failed:%s", failures.c_str());
+        }
+        return Result(true);
+    }
+}
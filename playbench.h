@@ -0,0 +1,13 @@
+#pragma once
+
+#include "result.h"
+
+#include <string>
+
+namespace playbench
+{
+    // Play filename to the end through the null audio and video devices on a virtual clock,
+    // faster than real time, and fail when presentation timestamps go back or miss their
+    // time, when frames are dropped or when audio and video drift apart.
+    Result Run(const std::string& filename);
+}
@@ -7,18 +7,28 @@
 
 #include <boost/bind.hpp>
 
+#include <algorithm>
+#include <optional>
+
 namespace {
     const int64_t queueFullSleepTimeMs = 100;
-    const int64_t pauseSleepTimeMs = 500;
+    // ui events are polled between presents, short enough for the seek bar preview to follow the cursor
+    const int64_t pauseSleepTimeMs = 40;
     const int64_t doneSleepTimeMs = 2000;
+    const int64_t seekPollSleepTimeMs = 5;
+    const uint32_t audioWaitTimeMs = 100;
+    const uint32_t videoWaitTimeMs = 10;
+
+    const float previewMargin = 40.0f;
+
+    // extract seek bar thumbnails when a file is opened
+    bool thumbnailsEnabled = true;
     
     const int64_t sleepThresholdUs = 10000;
     const int64_t sleepThresholdLogUs = 1000000;
     const int64_t millisecondUs = 1000;
     const int64_t logDeltaThresholdUs = 1000;
 
-    const double seekFrameSkipThresholdSec = 30.0;
-
     player::SwapBufferCallback swapBufferCallback;
 }
 
@@ -34,6 +44,13 @@ namespace {
         }
         else
         {
+            // a virtual clock only moves for sleepers, it lands on the presentation time
+            if( chrono::IsVirtualClock() )
+            {
+                chrono::Sleep(waitTime);
+                return true;
+            }
+
             if( waitTime >= sleepThresholdUs )
             {
                 if(waitTime >= sleepThresholdLogUs)
@@ -41,7 +58,7 @@ namespace {
                     logger::Warn("WaitForPlayback. %s Got frame to soon %f seconds. Sleeping.", name, chrono::Seconds(waitTime));
                 }
 
-                std::this_thread::sleep_for(std::chrono::microseconds(waitTime-millisecondUs));
+                chrono::Sleep(waitTime-millisecondUs);
                 waitTime = chrono::Wait(startTimeUs, timeUs);
 
                 if( waitTime <= 0 )
@@ -71,14 +88,6 @@ namespace {
         return true;
     }
 
-    void WaitSeekEnd(player::Player* player)
-    {
-        while( mediadecoder::IsSeeking(player->producer) )
-        {
-            std::this_thread::yield();
-        }
-    }
-
     void AudioPlaybackThread(player::Player* player)
     {
         mediadecoder::AudioFrame* audioFrame = nullptr;
@@ -102,16 +111,33 @@ namespace {
                 if( !player->buffering && waitTime >= audiodevice::ENQUEUE_SAMPLES_US)
                 {
                     logger::Debug("AudioPlayThread sleeping. Wait Time %f", chrono::Seconds(waitTime) );
-                    std::this_thread::sleep_for(std::chrono::milliseconds(queueFullSleepTimeMs));
+                    chrono::Sleep(queueFullSleepTimeMs * millisecondUs);
                     continue;
                 }
                
                 profiler::ScopeProfiler profiler(profiler::PROFILER_AUDIO_WRITE);
-                result = audiodevice::WriteInterleaved( player->audioDevice, audioFrame->samples, audioFrame->nbSamples, audioFrame->inUse );
+                if( audiodevice::GetMmap(player->audioDevice) )
+                {
+                    // converted in place into the device buffer
+                    result = audiodevice::Write( player->audioDevice, audioFrame->nbSamples, [audioFrame](uint8_t* output, uint32_t offset, uint32_t frames) {
+                        mediadecoder::Interleave(audioFrame, offset, frames, output);
+                    });
+                }
+                else
+                {
+                    result = audiodevice::WriteInterleaved( player->audioDevice, audioFrame->samples, audioFrame->nbSamples, audioFrame->inUse );
+                }
                 if(!result)
                 {
                     logger::Error("AudioDeviceWriteInterleaved failed %s", result.getError().c_str());
                 }
+                else
+                {
+                    // the delay right after a write locates the played position for the master clock
+                    uint64_t delayFrames = 0;
+                    audiodevice::GetDelay(player->audioDevice, delayFrames);
+                    avsync::OnAudioWritten(player->sync, audioFrame->timeUs, audioFrame->nbSamples, delayFrames, chrono::Now());
+                }
                 mediadecoder::Release(player->producer, audioFrame);
                 audioFrame = nullptr;
             }
@@ -119,6 +145,26 @@ namespace {
             {
                 nbNoFrame += 1;
                 logger::Trace("No audio frame count:%d", nbNoFrame);
+
+                // sleep until the decoder queues audio, stopping the thread wakes it
+                mediadecoder::Producer* producer = player->producer;
+                std::optional<chrono::HoldClock> hold;
+                if( !producer->done )
+                {
+                    hold.emplace();
+                }
+                else
+                {
+                    // the tail of the stream may be shorter than the device start threshold
+                    result = audiodevice::Start(player->audioDevice);
+                    if(!result)
+                    {
+                        logger::Error("Audio device start failed %s", result.getError().c_str());
+                    }
+                }
+                eventcount::Wait(&producer->frameProduced, [player, producer]() {
+                    return (producer->audioQueueSize > 0 && !producer->seeking) || !player->queueAudio;
+                }, audioWaitTimeMs);
             }
         }
     }
@@ -159,15 +205,237 @@ namespace {
         }
 
         player->queueAudio = false;
+        if( player->producer )
+        {
+            eventcount::Notify(&player->producer->frameProduced);
+        }
 
+        // a write blocked on the buffer of a paused device would never return
+        audiodevice::Interrupt(player->audioDevice, true);
         if( player->audioThread.joinable() )
         {
             player->audioThread.join();
         }
+        audiodevice::Interrupt(player->audioDevice, false);
 
         if( drop )
         {
             audiodevice::Flush(player->audioDevice);
+            avsync::Reset(player->sync, player->audioDevice->sampleRate);
+        }
+    }
+
+    // tile under the seek bar cursor, only copied when it changes
+    bool GetPreviewTile(player::Player* player)
+    {
+        if(!player->previewVisible || !player->thumbnails)
+        {
+            return false;
+        }
+
+        const uint64_t timeUs = static_cast<uint64_t>(player->previewPercent * static_cast<double>(mediadecoder::GetDuration(player->decoder)));
+        return thumbnail::Get(player->thumbnails, timeUs, player->previewTile);
+    }
+
+    void DrawPreview(player::Player* player)
+    {
+        player->shownPreviewPercent = -1.0;
+        player->shownPreviewTimeUs = thumbnail::INVALID_TIME;
+        if(!GetPreviewTile(player))
+        {
+            return;
+        }
+
+        const thumbnail::Tile& tile = player->previewTile;
+
+        uint32_t width = 0;
+        uint32_t height = 0;
+        videodevice::GetWindowSize(player->videoDevice, width, height);
+
+        // centered on the cursor, kept inside the window
+        const float maxx = std::max(0.0f, static_cast<float>(width) - static_cast<float>(tile.width));
+        const float x = std::min(std::max(static_cast<float>(player->previewPercent * width) - tile.width / 2.0f, 0.0f), maxx);
+
+        videodevice::DrawImage(player->videoDevice, tile.rgb.data(), tile.width, tile.height, x, previewMargin);
+
+        player->shownPreviewPercent = player->previewPercent;
+        player->shownPreviewTimeUs = tile.timeUs;
+    }
+
+    void DrawVideoFrame(player::Player* player, mediadecoder::VideoFrame* frame)
+    {
+        // create fb based on VideoFrame
+        videodevice::FrameBuffer fb;
+        fb.width = frame->width;
+        fb.height = frame->height;
+        for(uint32_t i = 0; i < videodevice::NUM_FRAME_DATA_POINTERS; i++)
+        {
+            fb.frameData[i] = frame->buffers[i];
+            fb.lineSize[i] = frame->lineSize[i];
+        }
+
+        // a mid-stream resolution change reaches the renderer with its first frame
+        if(fb.width != player->videoDevice->width || fb.height != player->videoDevice->height)
+        {
+            Result result = videodevice::SetTextureSize(player->videoDevice, fb.width, fb.height);
+            if(!result)
+            {
+                logger::Error("Cannot resize video texture: %s", result.getError().c_str());
+                return;
+            }
+        }
+
+        // draw frame
+        videodevice::DrawFrame(player->videoDevice, &fb);
+    }
+
+    // the drawn frame replaces the one on screen
+    void ShowVideoFrame(player::Player* player)
+    {
+        mediadecoder::Release(player->producer, player->shownFrame);
+        player->shownFrame = player->videoFrame;
+        player->videoFrame = nullptr;
+    }
+
+    // show the scrub keyframe as soon as it is decoded
+    void CompleteScrub(player::Player* player)
+    {
+        if(player->videoFrame)
+        {
+            profiler::ScopeProfiler profiler(profiler::PROFILER_VIDEO_DRAW);
+
+            player->currentTimeUs = player->videoFrame->timeUs;
+            DrawVideoFrame(player, player->videoFrame);
+            DrawPreview(player);
+            swapBufferCallback();
+
+            ShowVideoFrame(player);
+        }
+
+        logger::Debug("Scrub preview at %f ms after %f ms", chrono::Milliseconds(player->currentTimeUs), 
+                      chrono::Milliseconds(chrono::RealNow() - player->seekRequestTimeUs));
+        player->seekPending = false;
+    }
+
+    void UpdateDegradation(player::Player* player, int64_t latenessUs)
+    {
+        mediadecoder::Producer* producer = player->producer;
+        const bool changed = degradation::Update(player->degradation, latenessUs, producer->videoQueueSize, 
+                                                 producer->videoQueueCapacity, chrono::Now());
+        if(changed)
+        {
+            profiler::Set(profiler::GAUGE_DEGRADATION_LEVEL, player->degradation.level);
+            mediadecoder::SetDegradation(producer, player->degradation.level);
+        }
+    }
+
+    int64_t GetFrameDurationUs(player::Player* player)
+    {
+        const uint32_t framesPerSecond = std::max(mediadecoder::GetFramesPerSecond(player->decoder), 1U);
+        return 1000000 / framesPerSecond;
+    }
+
+    // A late frame is dropped only when a newer one is already decoded.
+    // Frames behind the audio master clock are dropped to catch up, others only once decoding is degraded.
+    bool ShouldDropFrame(player::Player* player, int64_t latenessUs)
+    {
+        const bool audioMaster = mediadecoder::GetHaveAudio(player->decoder);
+        if( (!audioMaster && player->degradation.level < degradation::LEVEL_DROP_LATE_FRAMES) || player->producer->videoQueueSize == 0 )
+        {
+            return false;
+        }
+
+        return latenessUs > std::max(GetFrameDurationUs(player), degradation::LATE_THRESHOLD_US);
+    }
+
+    // restart playback at the seek target once the decoder got there, false while still seeking
+    bool CompleteSeek(player::Player* player)
+    {
+        if( mediadecoder::IsSeeking(player->producer) )
+        {
+            return false;
+        }
+
+        // the decoder only queues frames from the seek time, wait for the first one
+        if( mediadecoder::GetHaveVideo(player->decoder) )
+        {
+            if(!player->videoFrame)
+            {
+                mediadecoder::Consume(player->producer, player->videoFrame);
+            }
+
+            if(!player->videoFrame && !player->producer->done)
+            {
+                return false;
+            }
+        }
+
+        if( player->scrubbing )
+        {
+            CompleteScrub(player);
+            return true;
+        }
+
+        logger::Info("Seek end at %f ms. First frame after %f ms", chrono::Milliseconds(player->seekTimeUs), 
+                     chrono::Milliseconds(chrono::RealNow() - player->seekRequestTimeUs));
+
+        player->seekPending = false;
+        player->currentTimeUs = player->seekTimeUs;
+
+        if( player->playing )
+        {
+            scopeguard::SetValue bufferingGuard(player->buffering, true, false);
+
+            Result result = StartAudioPlayback(player);
+            if(!result)
+            {
+                logger::Error("Cannot start audio %s", result.getError().c_str());
+            }
+        }
+        else
+        {
+            // audio was stopped by the seek, Play starts it again
+            player->pause = false;
+        }
+
+        // reset playback start time
+        player->playbackStartTimeUs = static_cast<int64_t>(chrono::Now()) - static_cast<int64_t>(player->seekTimeUs);
+
+        // frames presented while seeking say nothing about decoding speed
+        degradation::Reset(player->degradation);
+        return true;
+    }
+
+    void RequestSeek(player::Player* player, uint64_t timeUs, bool scrub)
+    {
+        if(!player->producer)
+        {
+            return;
+        }
+
+        logger::Info("%s request at %f ms", scrub ? "Scrub" : "Seek", chrono::Milliseconds(timeUs));
+
+        // audio is stopped once for a burst of requests, later ones only move the target
+        if( !player->seekPending && !player->scrubbing )
+        {
+            StopAudio(player, true);
+        }
+
+        mediadecoder::Release(player->producer, player->videoFrame);
+        player->videoFrame = nullptr;
+
+        player->seekTimeUs = timeUs;
+        player->seekRequestTimeUs = chrono::RealNow();
+        player->seekPending = true;
+        player->scrubbing = scrub;
+
+        if( scrub )
+        {
+            mediadecoder::Scrub(player->producer, timeUs);
+        }
+        else
+        {
+            mediadecoder::Seek(player->producer, timeUs);
         }
     }
 
@@ -176,6 +444,7 @@ namespace {
         if(mediadecoder::GetHaveAudio(player->decoder))
         {
             audiodevice::Pause(player->audioDevice);
+            avsync::Pause(player->sync, chrono::Now());
         }
     }
 
@@ -184,9 +453,37 @@ namespace {
         if(mediadecoder::GetHaveAudio(player->decoder))
         {
             audiodevice::Resume(player->audioDevice);
+            avsync::Resume(player->sync, chrono::Now());
         }
     }
 
+    void DrawSubtitleText(player::Player* player, mediadecoder::Subtitle* sub)
+    {
+         uint32_t width = 0;
+         uint32_t height = 0;
+
+         videodevice::GetWindowSize(player->videoDevice, width, height);
+
+         // ass header
+         subtitle::GetTextSizeCb textSizeCb = boost::bind(videodevice::GetTextSize, player->videoDevice, _1, _2, _3, _4, _5);
+         subtitle::SubLineList lines;
+
+         Result result = subtitle::GetDisplayInfo(sub->text, textSizeCb, width, height, 
+                                                  sub->header, sub->dialogue, sub->startTimeUs, sub->endTimeUs, 
+                                                  sub->fontName, sub->fontSize, sub->color, lines);
+
+         if(!result)
+         {
+            logger::Error("Error getting subtitle display info: %s", result.getError().c_str());
+            return;
+         }
+
+         for(auto it = lines.begin(); it != lines.end(); ++it)
+         {
+            videodevice::DrawText(player->videoDevice, (*it).text, sub->fontName, sub->fontSize, (*it).x, (*it).y, 1, sub->color);
+         }
+    }
+
     void DrawSubtitle(player::Player* player)
     {
          if(!player->subtitle)
@@ -209,31 +506,7 @@ namespace {
 
              if(inSubtitleTime)
              {
-                 mediadecoder::Subtitle* sub = player->subtitle;
-
-                 uint32_t width = 0;
-                 uint32_t height = 0;
-
-                 videodevice::GetWindowSize(player->videoDevice, width, height);
-
-                 // ass header
-                 subtitle::GetTextSizeCb textSizeCb = boost::bind(videodevice::GetTextSize, player->videoDevice, _1, _2, _3, _4, _5);
-                 subtitle::SubLineList lines;
-                 
-                 Result result = subtitle::GetDisplayInfo(sub->text, textSizeCb, width, height, 
-                                                          sub->header, sub->dialogue, sub->startTimeUs, sub->endTimeUs, 
-                                                          sub->fontName, sub->fontSize, sub->color, lines);
-
-                 if(!result)
-                 {
-                    logger::Error("Error getting subtitle display info: %s", result.getError().c_str());
-                    return;
-                 }
-
-                 for(auto it = lines.begin(); it != lines.end(); ++it)
-                 {
-                    videodevice::DrawText(player->videoDevice, (*it).text, sub->fontName, sub->fontSize, (*it).x, (*it).y, 1, sub->color);
-                 }
+                 DrawSubtitleText(player, player->subtitle);
              }
 
              if(subtitleWait < -subtitleDuration)
@@ -265,6 +538,37 @@ namespace {
              }
          }
     }
+
+    // while the video is stopped the frame on screen is drawn again when its seek bar preview changes
+    void RedrawPreview(player::Player* player)
+    {
+        if(!player->shownFrame)
+        {
+            return;
+        }
+
+        const bool preview = GetPreviewTile(player);
+        const double percent = preview ? player->previewPercent : -1.0;
+        const uint64_t timeUs = preview ? player->previewTile.timeUs : thumbnail::INVALID_TIME;
+        if(percent == player->shownPreviewPercent && timeUs == player->shownPreviewTimeUs)
+        {
+            return;
+        }
+
+        profiler::ScopeProfiler profiler(profiler::PROFILER_VIDEO_DRAW);
+
+        DrawVideoFrame(player, player->shownFrame);
+
+        // the subtitle queue is not consumed, the clock does not move while paused
+        mediadecoder::Subtitle* sub = player->subtitle;
+        if(sub && sub->startTimeUs <= player->currentTimeUs && player->currentTimeUs <= sub->endTimeUs)
+        {
+            DrawSubtitleText(player, sub);
+        }
+
+        DrawPreview(player);
+        swapBufferCallback();
+    }
 }
 
 namespace player
@@ -276,6 +580,11 @@ namespace player
         return result;
     }
 
+    void SetThumbnails(bool enable)
+    {
+        thumbnailsEnabled = enable;
+    }
+
     Result Create(Player*& player)
     {
         Result result;
@@ -316,6 +625,29 @@ namespace player
             }
         }
 
+        // negotiate the device format before decoding starts so audio is converted once
+        if(mediadecoder::GetHaveAudio(player->decoder))
+        {
+            uint32_t channels = mediadecoder::GetAudioNumChannels(player->decoder);
+            uint32_t sampleRate = mediadecoder::GetAudioSampleRate(player->decoder);
+            SampleFormat sampleFormat = mediadecoder::GetAudioSampleFormat(player->decoder);
+
+            result = audiodevice::SetInputFormat(player->audioDevice,channels,sampleRate,sampleFormat);
+            if(!result)
+            {
+                return result;
+            }
+
+            result = mediadecoder::SetAudioOutputFormat(player->decoder, channels, sampleRate, sampleFormat);
+            if(!result)
+            {
+                return result;
+            }
+
+            mediadecoder::SetAudioDeferredInterleave(player->decoder, audiodevice::GetMmap(player->audioDevice));
+            avsync::Reset(player->sync, sampleRate);
+        }
+
         player->path = filename;
 
         result = mediadecoder::Create(player->producer, player->decoder);
@@ -337,18 +669,23 @@ namespace player
             SetWindowSize(player, 
                           mediadecoder::GetVideoWidth(player->decoder),
                           mediadecoder::GetVideoHeight(player->decoder));
-        }
 
-        if(mediadecoder::GetHaveAudio(player->decoder))
-        {
-            const uint32_t channels = mediadecoder::GetAudioNumChannels(player->decoder);
-            const uint32_t sampleRate = mediadecoder::GetAudioSampleRate(player->decoder);
-            const SampleFormat sampleFormat = mediadecoder::GetAudioSampleFormat(player->decoder);
+            const degradation::Level maxLevel = mediadecoder::CanUseLowres(player->decoder) ? degradation::LEVEL_LOWRES 
+                                                                                           : degradation::LEVEL_SKIP_NONREF;
+            degradation::Init(player->degradation, maxLevel);
+            profiler::Set(profiler::GAUGE_DEGRADATION_LEVEL, degradation::LEVEL_NONE);
 
-            result = audiodevice::SetInputFormat(player->audioDevice,channels,sampleRate,sampleFormat);
-            if(!result)
+            // local files only, network streams would be downloaded twice
+            if(thumbnailsEnabled && !player->decoder->curl)
             {
-                return result;
+                Result thumbnailResult = thumbnail::Create(player->thumbnails, filename,
+                                                           mediadecoder::GetVideoWidth(player->decoder),
+                                                           mediadecoder::GetVideoHeight(player->decoder),
+                                                           mediadecoder::GetDuration(player->decoder));
+                if(!thumbnailResult)
+                {
+                    logger::Warn("No seek bar thumbnails: %s", thumbnailResult.getError().c_str());
+                }
             }
         }
 
@@ -425,78 +762,18 @@ namespace player
 
     void Seek(Player* player, uint64_t timeUs)
     {
-        if( mediadecoder::IsSeeking(player->producer) )
-        {
-            logger::Warn("Player seek failed. Already seeking.");
-            return;
-        }
-
-        logger::Info("Seek start at %f ms", chrono::Milliseconds(timeUs));
-        mediadecoder::Seek(player->producer, timeUs);
-
-        // stop audio playback
-        StopAudio(player, true);
-
-        // wait for seek
-        WaitSeekEnd(player);
-
-        // start buffering
-        assert(!player->buffering);
-        scopeguard::SetValue bufferingGuard(player->buffering, true, false);
-
-        mediadecoder::Release(player->producer, player->videoFrame);
-        mediadecoder::WaitForPlayback(player->producer);
-
-        int64_t sleepTime = 0;
-
-        // skip old frames from decoder
-        do
-        {
-            if(!player->videoFrame)
-            {
-                mediadecoder::Consume(player->producer, player->videoFrame);
-            }
-
-            if(!player->videoFrame)
-            {
-                break;
-            }
-
-            int64_t deltaUs = player->videoFrame->timeUs - timeUs;
-            double deltaSec = chrono::Seconds(deltaUs);
-            if(deltaSec < seekFrameSkipThresholdSec && deltaSec > 0.0)
-            {
-                logger::Warn("Seek sleeping for %f", chrono::Seconds(deltaUs));
-                sleepTime = deltaUs;
-                break;
-            }
-
-            logger::Warn("Player: Seek skipping frame %f frame %ld time %ld", chrono::Seconds(deltaUs), player->videoFrame->timeUs, timeUs);
-
-            mediadecoder::Release(player->producer, player->videoFrame);
-            player->videoFrame = nullptr;
-
-
-        } while(true);
-
-
-        Result result = StartAudioPlayback(player);
-        if(!result)
-        {
-            logger::Error("Cannot start audio %s", result.getError().c_str());
-            return;
-        }
+        RequestSeek(player, timeUs, false);
+    }
 
-        // reset playback start time
-        player->playbackStartTimeUs = static_cast<int64_t>(chrono::Now()) - static_cast<int64_t>(timeUs);
+    void Scrub(Player* player, uint64_t timeUs)
+    {
+        RequestSeek(player, timeUs, true);
+    }
 
-        // we got video frame in the future, sleep until we can play them
-        if(sleepTime != 0)
-        {
-            std::this_thread::sleep_for(std::chrono::microseconds(sleepTime));
-        }
-        
-        logger::Info("Seek end");
+    void SetPreview(Player* player, double percent, bool visible)
+    {
+        player->previewPercent = percent;
+        player->previewVisible = visible;
     }
 
     void Pause(Player* player)
@@ -517,6 +794,17 @@ namespace player
         return player->playing;
     }
 
+    bool IsEndOfStream(Player* player)
+    {
+        mediadecoder::Producer* producer = player->producer;
+        return producer && producer->done && !player->videoFrame && producer->videoQueueSize == 0 && producer->audioQueueSize == 0;
+    }
+
+    void GetAvSyncStats(Player* player, avsync::Stats& stats)
+    {
+        avsync::GetStats(player->sync, stats);
+    }
+
     uint64_t GetDuration(Player* player)
     {
         if(!player || !player->decoder)
@@ -545,9 +833,19 @@ namespace player
 
     void Present(Player* player)
     {
+         // keep the ui responsive while the decoder reaches the seek target
+         // the scrub preview stays on screen until the seek bar is released
+         if((player->seekPending && !CompleteSeek(player)) || player->scrubbing)
+         {
+             RedrawPreview(player);
+             chrono::Sleep(seekPollSleepTimeMs * millisecondUs);
+             return;
+         }
+
          if(!player->playing)
          {
-             std::this_thread::sleep_for(std::chrono::milliseconds(pauseSleepTimeMs));
+             RedrawPreview(player);
+             chrono::Sleep(pauseSleepTimeMs * millisecondUs);
              return;
          }
 
@@ -560,34 +858,47 @@ namespace player
          {
              player->currentTimeUs = player->videoFrame->timeUs;
              const uint64_t waitThresholdUs = 25;
-             const bool drawFrame 
+
+             // presentation follows the audio clock, a frame ahead of it keeps the previous one on screen
+             avsync::Update(player->sync, player->playbackStartTimeUs, chrono::Now());
+
+             const int64_t earlyUs = chrono::Wait(player->playbackStartTimeUs, player->videoFrame->timeUs);
+             const int64_t frameDurationUs = GetFrameDurationUs(player);
+             if( earlyUs > frameDurationUs )
+             {
+                 avsync::OnFrameRepeated(player->sync, earlyUs / frameDurationUs);
+             }
+
+             bool drawFrame 
                        = WaitForPlayback("video", player->playbackStartTimeUs, player->videoFrame->timeUs, waitThresholdUs);
 
+             // presentation behind the clock, degrade decoding and skip frames that are already a frame late
+             const int64_t latenessUs = -chrono::Wait(player->playbackStartTimeUs, player->videoFrame->timeUs);
+             UpdateDegradation(player, latenessUs);
+
+             if( drawFrame && ShouldDropFrame(player, latenessUs) )
+             {
+                 profiler::Count(profiler::COUNTER_FRAMES_DROPPED, 1);
+                 avsync::OnFrameDropped(player->sync);
+                 drawFrame = false;
+             }
+
              if( drawFrame && player->videoFrame )
              {
                  profiler::ScopeProfiler profiler(profiler::PROFILER_VIDEO_DRAW);
 
-                 // create fb based on VideoFrame
-                 videodevice::FrameBuffer fb;
-                 fb.width = player->videoFrame->width;
-                 fb.height = player->videoFrame->height;
-                 for(uint32_t i = 0; i < videodevice::NUM_FRAME_DATA_POINTERS; i++)
-                 {
-                     fb.frameData[i] = player->videoFrame->buffers[i];
-                     fb.lineSize[i] = player->videoFrame->lineSize[i];
-                 }
-
-                 // draw frame
-                 videodevice::DrawFrame(player->videoDevice, &fb);
+                 DrawVideoFrame(player, player->videoFrame);
 
                  // draw subtitle
                  DrawSubtitle(player);
 
+                 // draw seek bar thumbnail
+                 DrawPreview(player);
+
                  // swap buffer
                  swapBufferCallback();
 
-                 mediadecoder::Release(player->producer, player->videoFrame);
-                 player->videoFrame = nullptr;
+                 ShowVideoFrame(player);
              }
              else if(player->videoFrame)
              {
@@ -597,7 +908,21 @@ namespace player
          }
          else if(player->producer->done)
          {
-             std::this_thread::sleep_for(std::chrono::milliseconds(doneSleepTimeMs));
+             chrono::Sleep(doneSleepTimeMs * millisecondUs);
+         }
+         else if(!mediadecoder::GetHaveVideo(player->decoder))
+         {
+             // nothing to present, the audio thread plays the file
+             chrono::Sleep(pauseSleepTimeMs * millisecondUs);
+         }
+         else
+         {
+             // sleep until the decoder queues a frame, bounded so the ui keeps polling events
+             mediadecoder::Producer* producer = player->producer;
+             chrono::HoldClock hold;
+             eventcount::Wait(&producer->frameProduced, [producer]() {
+                 return producer->videoQueueSize > 0 || producer->done;
+             }, videoWaitTimeMs);
          }
     }
 
@@ -605,8 +930,22 @@ namespace player
     {
         StopAudio(player, true);
 
+        thumbnail::Destroy(player->thumbnails);
+        player->previewVisible = false;
+        player->previewTile = thumbnail::Tile();
+        player->shownPreviewPercent = -1.0;
+        player->shownPreviewTimeUs = thumbnail::INVALID_TIME;
+
+        if(player->producer)
+        {
+            mediadecoder::Release(player->producer, player->shownFrame);
+        }
+        player->shownFrame = nullptr;
+
         player->playbackStartTimeUs = 0;
         player->currentTimeUs = 0;
+        player->seekPending = false;
+        player->scrubbing = false;
         player->playing = false;
         player->pause = false;
 
@@ -4,6 +4,9 @@
 #include "videodevice.h"
 #include "audiodevice.h"
 #include "mediadecoder.h"
+#include "thumbnail.h"
+#include "degradation.h"
+#include "avsync.h"
 
 #ifdef WIN32
 #pragma warning( push )
@@ -28,13 +31,17 @@ namespace player
         
         mediadecoder::Producer* producer = nullptr;
         mediadecoder::VideoFrame* videoFrame = nullptr;
+        // kept on screen so the seek bar preview can be drawn over it while paused
+        mediadecoder::VideoFrame* shownFrame = nullptr;
         mediadecoder::Subtitle* subtitle = nullptr;
         mediadecoder::Subtitle* nextSubtitle = nullptr;
 
         audiodevice::Device* audioDevice = nullptr;
         videodevice::Device* videoDevice = nullptr;
 
-        uint64_t playbackStartTimeUs = 0;
+        // presentation time base, slaved to the audio clock when there is audio
+        std::atomic<uint64_t> playbackStartTimeUs = 0;
+        avsync::Clock sync;
         uint64_t currentTimeUs = 0;
 
         std::atomic<bool> playing = false;
@@ -43,9 +50,31 @@ namespace player
 
         std::atomic<bool> queueAudio = false;;
         std::thread audioThread;
+
+        // seek requested by the ui, completed by Present once the decoder reached the newest target
+        bool seekPending = false;
+        uint64_t seekTimeUs = 0;
+        uint64_t seekRequestTimeUs = 0;
+
+        // keyframe previews are shown instead of playing until the next Seek
+        bool scrubbing = false;
+
+        // seek bar thumbnails extracted in the background
+        thumbnail::Extractor* thumbnails = nullptr;
+        bool previewVisible = false;
+        double previewPercent = 0.0;
+        thumbnail::Tile previewTile;
+
+        // preview drawn with the shown frame, a negative percent when there is none
+        double shownPreviewPercent = -1.0;
+        uint64_t shownPreviewTimeUs = thumbnail::INVALID_TIME;
+
+        // decoding shortcuts taken when frames are presented late
+        degradation::Controller degradation;
     };
 
     Result   Init(SwapBufferCallback);
+    void     SetThumbnails(bool);
     Result   Create(Player*& player);
     Result   Open(Player*, const std::string& filename);
     void     SetWindowSize(Player*,uint32_t, uint32_t);
@@ -53,10 +82,20 @@ namespace player
     void     AddSubtitleTrack(Player*, std::shared_ptr<subtitle::SubRip> srt);
 
     void     Play(Player*);
+    // non blocking, the newest request replaces a pending one
     void     Seek(Player*, uint64_t timeUs);
+    // show the keyframe preceding timeUs while the seek bar is dragged, Seek resumes playback
+    void     Scrub(Player*, uint64_t timeUs);
+    // thumbnail drawn over the video at percent of the duration
+    void     SetPreview(Player*, double percent, bool visible);
     void     Pause(Player*);
 
     bool     IsPlaying(Player*);
+    // every decoded frame was presented
+    bool     IsEndOfStream(Player*);
+
+    // audio clock offset and drift corrections
+    void     GetAvSyncStats(Player*, avsync::Stats&);
 
     uint64_t GetDuration(Player*);
     uint64_t GetCurrentTime(Player*);
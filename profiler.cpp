@@ -11,6 +11,8 @@
 namespace {
 
     profiler::Profiler profilers[profiler::PROFILER_NB];
+    profiler::Counter counters[profiler::COUNTER_NB];
+    std::atomic<uint64_t> gauges[profiler::GAUGE_NB];
     bool enable = false;
 
     double Average(uint64_t totalTime, uint64_t count)
@@ -28,6 +30,20 @@ namespace profiler
         {
             profilers[i].minTime = std::numeric_limits<uint64_t>::max();
         }
+
+        for(uint32_t i = 0; i < COUNTER_NB; i++)
+        {
+            Counter& c = counters[i];
+            c.value = 0;
+            c.lastValue = 0;
+            c.lastTime = chrono::RealNow();
+            c.rate = 0;
+        }
+
+        for(uint32_t i = 0; i < GAUGE_NB; i++)
+        {
+            gauges[i] = 0;
+        }
     }
 
     void Enable(bool e)
@@ -57,11 +73,56 @@ namespace profiler
             case PROFILER_PROCESS_AUDIO_FRAME:
                 name = "aproc";
                 break;
+            case PROFILER_DEMUX_PACKET:
+                name = "demux";
+                break;
+            case PROFILER_SCALE_SLICE:
+                name = "vslice";
+                break;
             case PROFILER_NB:
                 break;
         }
     }
 
+    void GetCounterName(CounterPoint counter, std::string& name)
+    {
+        switch(counter)
+        {
+            case COUNTER_VIDEO_BYTES_COPIED:
+                name = "vcopy";
+                break;
+            case COUNTER_FRAME_ALLOCATIONS:
+                name = "falloc";
+                break;
+            case COUNTER_FRAMES_DROPPED:
+                name = "fdrop";
+                break;
+            case COUNTER_NB:
+                break;
+        }
+    }
+
+    void GetGaugeName(GaugePoint gauge, std::string& name)
+    {
+        switch(gauge)
+        {
+            case GAUGE_QUEUE_BYTES:
+                name = "qbytes";
+                break;
+            case GAUGE_PACKET_BYTES:
+                name = "pbytes";
+                break;
+            case GAUGE_DEGRADATION_LEVEL:
+                name = "degrade";
+                break;
+            case GAUGE_AV_OFFSET:
+                name = "avoffus";
+                break;
+            case GAUGE_NB:
+                break;
+        }
+    }
+
     void StartBlock(Point profiler)
     {
         if( !enable )
@@ -69,7 +130,7 @@ namespace profiler
             return;
         }
 
-        uint64_t currentTime = chrono::Now();
+        uint64_t currentTime = chrono::RealNow();
         Profiler& p = profilers[profiler];
         p.startTime = currentTime;
         p.count++;
@@ -83,13 +144,48 @@ namespace profiler
         }
 
         Profiler& p = profilers[profiler];
-        p.endTime = chrono::Now();
+        p.endTime = chrono::RealNow();
         p.currentTime = p.endTime - p.startTime;
         p.totalTime += p.currentTime;
         p.minTime = std::min(p.minTime,p.currentTime);
         p.maxTime = std::max(p.maxTime,p.currentTime);
     }
 
+    void AddBlock(Point profiler, uint64_t timeUs)
+    {
+        if( !enable )
+        {
+            return;
+        }
+
+        Profiler& p = profilers[profiler];
+        p.count++;
+        p.currentTime = timeUs;
+        p.totalTime += p.currentTime;
+        p.minTime = std::min(p.minTime,p.currentTime);
+        p.maxTime = std::max(p.maxTime,p.currentTime);
+    }
+
+    void Count(CounterPoint counter, uint64_t value)
+    {
+        if( !enable )
+        {
+            return;
+        }
+
+        counters[counter].value += value;
+    }
+
+    void Set(GaugePoint gauge, uint64_t value)
+    {
+        if( !enable )
+        {
+            return;
+        }
+
+        gauges[gauge] = value;
+    }
+
     void Print()
     {
         if( !enable )
@@ -114,8 +210,55 @@ namespace profiler
 
             out << name << " (" << currentTime << "," << averageTime << ") ";
         }
+
+        // counters rate is updated at most once per second
+        const uint64_t now = chrono::RealNow();
+        out << "(per sec) ";
+
+        for(uint32_t i = 0; i < COUNTER_NB; i++)
+        {
+            Counter& c = counters[i];
+
+            const uint64_t elapsedUs = now - c.lastTime;
+            if( elapsedUs >= 1000000 )
+            {
+                const uint64_t value = c.value.load();
+                c.rate = static_cast<uint64_t>(static_cast<double>(value - c.lastValue) / chrono::Seconds(elapsedUs));
+                c.lastValue = value;
+                c.lastTime = now;
+            }
+
+            std::string name;
+            GetCounterName(static_cast<CounterPoint>(i), name);
+
+            out << name << " (" << c.rate << ") ";
+        }
+
+        out << "(curr) ";
+        for(uint32_t i = 0; i < GAUGE_NB; i++)
+        {
+            std::string name;
+            GetGaugeName(static_cast<GaugePoint>(i), name);
+
+            out << name << " (" << gauges[i].load() << ") ";
+        }
         out << std::endl;
 
         std::cerr << out.str();
     }
+
+    void GetStats(Point point, Profiler& stats)
+    {
+        stats = profilers[point];
+    }
+
+    uint64_t GetCount(CounterPoint counter)
+    {
+        return counters[counter].value.load();
+    }
+
+    uint64_t GetGauge(GaugePoint gauge)
+    {
+        return gauges[gauge].load();
+    }
 }
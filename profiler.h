@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <atomic>
 #include <stdint.h>
 
 namespace profiler
@@ -13,8 +14,27 @@ namespace profiler
         PROFILER_DECODE_AUDIO_FRAME,
         PROFILER_PROCESS_VIDEO_FRAME,
         PROFILER_PROCESS_AUDIO_FRAME,
+        PROFILER_DEMUX_PACKET,
+        PROFILER_SCALE_SLICE,
         PROFILER_NB
     };
+
+    enum GaugePoint
+    {
+        GAUGE_QUEUE_BYTES = 0,
+        GAUGE_PACKET_BYTES,
+        GAUGE_DEGRADATION_LEVEL,
+        GAUGE_AV_OFFSET,
+        GAUGE_NB
+    };
+
+    enum CounterPoint
+    {
+        COUNTER_VIDEO_BYTES_COPIED = 0,
+        COUNTER_FRAME_ALLOCATIONS,
+        COUNTER_FRAMES_DROPPED,
+        COUNTER_NB
+    };
     
     // simple flat profiler that keeps track
     // of average time for a given profile point
@@ -29,18 +49,44 @@ namespace profiler
          uint64_t maxTime = 0;
     };
 
+    // simple counter that keeps track
+    // of a value rate per second
+    struct Counter
+    {
+        std::atomic<uint64_t> value = 0;
+        uint64_t lastValue = 0;
+        uint64_t lastTime = 0;
+        uint64_t rate = 0;
+    };
+
     void Init();
     void Enable(bool);
 
     void GetPointName(Point, std::string&);
+    void GetCounterName(CounterPoint, std::string&);
+    void GetGaugeName(GaugePoint, std::string&);
 
     // Start a profiler block
     void StartBlock(Point profiler);
     void StopBlock(Point profiler);
 
+    // Add a block timed on another thread
+    void AddBlock(Point profiler, uint64_t timeUs);
+
+    // Add value to a counter
+    void Count(CounterPoint counter, uint64_t value);
+
+    // Set a gauge current value
+    void Set(GaugePoint gauge, uint64_t value);
+
     // Print profiler point stats
     void Print();
 
+    // stats since Init, for reports
+    void     GetStats(Point, Profiler&);
+    uint64_t GetCount(CounterPoint);
+    uint64_t GetGauge(GaugePoint);
+
     class ScopeProfiler
     {
     public:
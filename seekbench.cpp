@@ -0,0 +1,152 @@
+#include "precomp.h"
+#include "seekbench.h"
+#include "mediadecoder.h"
+#include "eventcount.h"
+#include "chrono.h"
+#include "logger.h"
+
+#include <random>
+#include <vector>
+#include <algorithm>
+
+namespace {
+    const uint32_t NB_STORMS = 50;
+    const uint32_t REQUESTS_PER_STORM = 10;
+
+    // one request per displayed frame while dragging
+    const uint32_t REQUEST_INTERVAL_MS = 16;
+    const uint32_t FIRST_FRAME_TIMEOUT_MS = 10000;
+    const uint32_t FIRST_FRAME_WAIT_TIME_MS = 10;
+
+    bool HaveFrame(mediadecoder::Producer* producer, bool video)
+    {
+        const uint32_t queueSize = video ? producer->videoQueueSize : producer->audioQueueSize;
+        return (!producer->seeking && queueSize > 0) || producer->done;
+    }
+
+    // consume the first frame of the newest target, false on timeout
+    bool WaitFirstFrame(mediadecoder::Producer* producer, bool video)
+    {
+        const uint64_t startTimeUs = chrono::RealNow();
+
+        while( chrono::RealNow() - startTimeUs < FIRST_FRAME_TIMEOUT_MS * 1000ULL )
+        {
+            eventcount::Wait(&producer->frameProduced, [producer, video]() {
+                return HaveFrame(producer, video);
+            }, FIRST_FRAME_WAIT_TIME_MS);
+
+            if( video )
+            {
+                mediadecoder::VideoFrame* frame = nullptr;
+                if( mediadecoder::Consume(producer, frame) )
+                {
+                    mediadecoder::Release(producer, frame);
+                    return true;
+                }
+            }
+            else
+            {
+                mediadecoder::AudioFrame* frame = nullptr;
+                if( mediadecoder::Consume(producer, frame) )
+                {
+                    mediadecoder::Release(producer, frame);
+                    return true;
+                }
+            }
+
+            // seeked past the last frame
+            if( !producer->seeking && producer->done )
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint64_t Percentile(const std::vector<uint64_t>& sorted, double percentile)
+    {
+        const size_t index = static_cast<size_t>(percentile * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    void Report(const char* name, std::vector<uint64_t>& timesUs)
+    {
+        std::sort(timesUs.begin(), timesUs.end());
+        logger::Info("Seek storm %s: p50 %f ms p99 %f ms max %f ms", name,
+                     chrono::Milliseconds(Percentile(timesUs, 0.50)),
+                     chrono::Milliseconds(Percentile(timesUs, 0.99)),
+                     chrono::Milliseconds(timesUs.back()));
+    }
+}
+
+namespace seekbench
+{
+    Result Run(const std::string& filename)
+    {
+        mediadecoder::Decoder* decoder = nullptr;
+        mediadecoder::Producer* producer = nullptr;
+
+        Result result = mediadecoder::Create(decoder);
+        if(result)
+        {
+            result = mediadecoder::Open(decoder, filename);
+        }
+        if(result)
+        {
+            result = mediadecoder::Create(producer, decoder);
+        }
+        if(!result)
+        {
+            mediadecoder::Destroy(producer);
+            mediadecoder::Destroy(decoder);
+            return result;
+        }
+
+        const bool video = mediadecoder::GetHaveVideo(decoder);
+        const uint64_t duration = mediadecoder::GetDuration(decoder);
+
+        // fixed seed, runs are comparable
+        std::mt19937_64 generator(0);
+        std::uniform_int_distribution<uint64_t> position(0, duration - duration / 20);
+
+        std::vector<uint64_t> firstFrameTimesUs;
+        std::vector<uint64_t> queuedTimesUs;
+
+        for(uint32_t storm = 0; storm < NB_STORMS && result; storm++)
+        {
+            uint64_t requestTimeUs = 0;
+            for(uint32_t request = 0; request < REQUESTS_PER_STORM; request++)
+            {
+                if(request != 0)
+                {
+                    chrono::Sleep(REQUEST_INTERVAL_MS * 1000ULL);
+                }
+                requestTimeUs = chrono::RealNow();
+                mediadecoder::Seek(producer, position(generator));
+            }
+
+            if( !WaitFirstFrame(producer, video) )
+            {
+                result = Result(false, "No frame %d ms after seek", FIRST_FRAME_TIMEOUT_MS);
+                break;
+            }
+
+            firstFrameTimesUs.push_back(chrono::RealNow() - requestTimeUs);
+            queuedTimesUs.push_back(mediadecoder::GetSeekLatency(producer));
+        }
+
+        mediadecoder::Destroy(producer);
+        mediadecoder::Destroy(decoder);
+
+        if(!result)
+        {
+            return result;
+        }
+
+        logger::Info("Seek storm %d bursts of %d requests every %d ms", NB_STORMS, REQUESTS_PER_STORM, REQUEST_INTERVAL_MS);
+        Report("time to first frame", firstFrameTimesUs);
+        Report("time to first queued frame", queuedTimesUs);
+
+        return result;
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "result.h"
+
+#include <string>
+
+namespace seekbench
+{
+    // Issue bursts of seek requests like a dragged seek bar and report the
+    // time from the last request of a burst to its first decoded frame.
+    Result Run(const std::string& filename);
+}
@@ -0,0 +1,656 @@
+#include "precomp.h"
+#include "thumbnail.h"
+#include "mediadecoder.h"
+#include "chrono.h"
+#include "logger.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+
+#ifndef WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+namespace {
+    const char CACHE_MAGIC[8] = {'G', 'R', 'U', 'M', 'P', 'T', 'H', '1'};
+    const char* CACHE_EXT = ".thumbs";
+    const char* CACHE_DIRECTORY = "grumpyplayer-thumbnails";
+
+    // least recently opened cache files are removed above this size
+    const uintmax_t MAX_CACHE_DIRECTORY_SIZE = 256 * 1024 * 1024;
+
+    // a finished extractor still loads evicted tiles back from disk
+    const uint64_t REQUEST_WAIT_US = 1000000;
+
+    // thumbnails cache directory, the temporary directory when empty
+    std::string cacheDirectory;
+
+    // fraction of one core the extractor may use
+    double cpuBudget = thumbnail::DEFAULT_CPU_BUDGET;
+
+    // in memory tiles budget per extractor
+    size_t memoryBudget = thumbnail::DEFAULT_MEMORY_BUDGET;
+
+    struct CacheHeader
+    {
+        char magic[8];
+        uint32_t tileWidth;
+        uint32_t tileHeight;
+        uint32_t nbSlots;
+        uint32_t reserved;
+        uint64_t intervalUs;
+    };
+
+    uint64_t Hash(const std::string& s)
+    {
+        // fnv-1a, stable between runs
+        uint64_t hash = 14695981039346656037ULL;
+        for(auto it = s.begin(); it != s.end(); ++it)
+        {
+            hash ^= static_cast<uint8_t>(*it);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    size_t GetTileSize(const thumbnail::Extractor* extractor)
+    {
+        return static_cast<size_t>(extractor->tileWidth) * extractor->tileHeight * 3;
+    }
+
+    std::streamoff GetSlotTimeOffset(uint32_t slot)
+    {
+        return static_cast<std::streamoff>(sizeof(CacheHeader) + sizeof(uint64_t) * slot);
+    }
+
+    std::streamoff GetTileOffset(const thumbnail::Extractor* extractor, uint32_t slot)
+    {
+        return static_cast<std::streamoff>(sizeof(CacheHeader) + sizeof(uint64_t) * extractor->nbSlots + GetTileSize(extractor) * slot);
+    }
+
+    // remove the least recently opened cache files until the directory fits its budget
+    void PruneCacheDirectory(const boost::filesystem::path& directory, const boost::filesystem::path& current)
+    {
+        struct CacheFile
+        {
+            std::time_t modificationTime;
+            uintmax_t size;
+            boost::filesystem::path path;
+        };
+
+        boost::system::error_code error;
+        std::vector<CacheFile> files;
+        uintmax_t totalSize = 0;
+
+        for(boost::filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error))
+        {
+            const boost::filesystem::path& path = it->path();
+            if(path.extension() != CACHE_EXT || !boost::filesystem::is_regular_file(path, error))
+            {
+                continue;
+            }
+
+            CacheFile file = { boost::filesystem::last_write_time(path, error), boost::filesystem::file_size(path, error), path };
+            if(error)
+            {
+                error.clear();
+                continue;
+            }
+
+            totalSize += file.size;
+            if(path != current)
+            {
+                files.push_back(file);
+            }
+        }
+
+        std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) { return a.modificationTime < b.modificationTime; });
+
+        for(auto it = files.begin(); it != files.end() && totalSize > MAX_CACHE_DIRECTORY_SIZE; ++it)
+        {
+            // a file still open by another player is kept on platforms that lock it
+            if(boost::filesystem::remove(it->path, error))
+            {
+                logger::Debug("Thumbnail cache %s removed", it->path.string().c_str());
+                totalSize -= it->size;
+            }
+        }
+    }
+
+    // key the cache file by path, modification time and tile geometry
+    Result GetCachePath(thumbnail::Extractor* extractor, std::string& cachePath)
+    {
+        boost::system::error_code error;
+
+        const boost::filesystem::path media = boost::filesystem::canonical(extractor->path, error);
+        if(error)
+        {
+            return Result(false, "Cannot resolve %s: %s", extractor->path.c_str(), error.message().c_str());
+        }
+
+        const std::time_t modificationTime = boost::filesystem::last_write_time(media, error);
+        if(error)
+        {
+            return Result(false, "Cannot get %s modification time: %s", extractor->path.c_str(), error.message().c_str());
+        }
+
+        boost::filesystem::path directory = cacheDirectory.empty() ? boost::filesystem::temp_directory_path(error) / CACHE_DIRECTORY
+                                                                   : boost::filesystem::path(cacheDirectory);
+        boost::filesystem::create_directories(directory, error);
+        if(error)
+        {
+            return Result(false, "Cannot create thumbnail cache directory %s: %s", directory.string().c_str(), error.message().c_str());
+        }
+
+        const std::string key = media.string() + "\n" + std::to_string(modificationTime) + "\n" +
+                                std::to_string(extractor->tileWidth) + "x" + std::to_string(extractor->tileHeight);
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(Hash(key)));
+
+        cachePath = (directory / (std::string(name) + CACHE_EXT)).string();
+        PruneCacheDirectory(directory, cachePath);
+        return Result(true);
+    }
+
+    // open the cache file and load its slot table, an invalid file is created again
+    Result OpenCache(thumbnail::Extractor* extractor, std::vector<uint64_t>& slotTimesUs)
+    {
+        Result result = GetCachePath(extractor, extractor->cachePath);
+        if(!result)
+        {
+            return result;
+        }
+
+        CacheHeader expected = {};
+        std::copy(CACHE_MAGIC, CACHE_MAGIC + sizeof(CACHE_MAGIC), expected.magic);
+        expected.tileWidth = extractor->tileWidth;
+        expected.tileHeight = extractor->tileHeight;
+        expected.nbSlots = extractor->nbSlots;
+        expected.intervalUs = extractor->intervalUs;
+
+        std::fstream& cache = extractor->cache;
+        cache.open(extractor->cachePath, std::ios::in | std::ios::out | std::ios::binary);
+        if(cache.is_open())
+        {
+            CacheHeader header = {};
+            cache.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+            const bool valid = cache && std::equal(CACHE_MAGIC, CACHE_MAGIC + sizeof(CACHE_MAGIC), header.magic) &&
+                               header.tileWidth == expected.tileWidth && header.tileHeight == expected.tileHeight &&
+                               header.nbSlots == expected.nbSlots && header.intervalUs == expected.intervalUs;
+            if(valid)
+            {
+                cache.read(reinterpret_cast<char*>(slotTimesUs.data()), sizeof(uint64_t) * extractor->nbSlots);
+                if(cache)
+                {
+                    // reopened files are the last ones pruned
+                    boost::system::error_code error;
+                    boost::filesystem::last_write_time(extractor->cachePath, std::time(nullptr), error);
+
+                    const size_t cached = extractor->nbSlots - std::count(slotTimesUs.begin(), slotTimesUs.end(), thumbnail::INVALID_TIME);
+                    logger::Info("Thumbnail cache %s has %zu/%d tiles", extractor->cachePath.c_str(), cached, extractor->nbSlots);
+                    return result;
+                }
+                std::fill(slotTimesUs.begin(), slotTimesUs.end(), thumbnail::INVALID_TIME);
+            }
+            cache.close();
+        }
+
+        cache.open(extractor->cachePath, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        cache.write(reinterpret_cast<const char*>(&expected), sizeof(expected));
+        cache.write(reinterpret_cast<const char*>(slotTimesUs.data()), sizeof(uint64_t) * extractor->nbSlots);
+        cache.flush();
+        if(!cache)
+        {
+            cache.close();
+            return Result(false, "Cannot create thumbnail cache %s", extractor->cachePath.c_str());
+        }
+
+        logger::Info("Thumbnail cache %s created", extractor->cachePath.c_str());
+        return result;
+    }
+
+    // tile data is written before the slot time so an interrupted write is never read back
+    void WriteTile(thumbnail::Extractor* extractor, uint32_t slot, const thumbnail::Tile& tile)
+    {
+        std::fstream& cache = extractor->cache;
+        if(!cache.is_open())
+        {
+            return;
+        }
+
+        cache.seekp(GetTileOffset(extractor, slot));
+        cache.write(reinterpret_cast<const char*>(tile.rgb.data()), tile.rgb.size());
+        cache.seekp(GetSlotTimeOffset(slot));
+        cache.write(reinterpret_cast<const char*>(&tile.timeUs), sizeof(tile.timeUs));
+        cache.flush();
+
+        if(!cache)
+        {
+            logger::Warn("Thumbnail cache write failed, disabling %s", extractor->cachePath.c_str());
+            cache.close();
+        }
+    }
+
+    bool ReadTile(thumbnail::Extractor* extractor, uint32_t slot, uint64_t timeUs, thumbnail::Tile& tile)
+    {
+        std::fstream& cache = extractor->cache;
+        if(!cache.is_open())
+        {
+            return false;
+        }
+
+        tile.timeUs = timeUs;
+        tile.width = extractor->tileWidth;
+        tile.height = extractor->tileHeight;
+        tile.rgb.resize(GetTileSize(extractor));
+
+        cache.seekg(GetTileOffset(extractor, slot));
+        cache.read(reinterpret_cast<char*>(tile.rgb.data()), tile.rgb.size());
+        if(!cache)
+        {
+            logger::Warn("Thumbnail cache read failed, disabling %s", extractor->cachePath.c_str());
+            cache.close();
+            return false;
+        }
+        return true;
+    }
+
+    // add to the front of the memory LRU, least recently used tiles are evicted. Lock must be held.
+    void Insert(thumbnail::Extractor* extractor, uint32_t slot, thumbnail::Tile&& tile)
+    {
+        auto it = extractor->tiles.find(slot);
+        if(it != extractor->tiles.end())
+        {
+            extractor->memoryBytes -= it->second.first.rgb.size();
+            extractor->lru.erase(it->second.second);
+            extractor->tiles.erase(it);
+        }
+
+        extractor->lru.push_front(slot);
+        auto& entry = extractor->tiles[slot];
+        entry.first = std::move(tile);
+        entry.second = extractor->lru.begin();
+        extractor->memoryBytes += entry.first.rgb.size();
+
+        while(extractor->memoryBytes > memoryBudget && extractor->lru.size() > 1)
+        {
+            const uint32_t evicted = extractor->lru.back();
+            auto evictedIt = extractor->tiles.find(evicted);
+
+            extractor->memoryBytes -= evictedIt->second.first.rgb.size();
+            extractor->tiles.erase(evictedIt);
+            extractor->lru.pop_back();
+
+            // without a disk cache the tile is gone
+            if(!extractor->cache.is_open())
+            {
+                extractor->slotTimesUs[evicted] = thumbnail::INVALID_TIME;
+            }
+        }
+    }
+
+    void SetLowPriority()
+    {
+#ifdef WIN32
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#else
+        // only runs when a core has nothing else to do, fall back to the lowest nice value
+        sched_param param = {};
+        if(pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+        {
+            setpriority(PRIO_PROCESS, 0, 19);
+        }
+#endif
+    }
+
+    // extract coarse to fine, the whole duration is covered early
+    void GetExtractionOrder(uint32_t nbSlots, std::vector<uint32_t>& order)
+    {
+        std::vector<bool> queued(nbSlots, false);
+
+        uint32_t step = 1;
+        while(step * 2 <= nbSlots)
+        {
+            step *= 2;
+        }
+
+        for(; step >= 1; step /= 2)
+        {
+            for(uint32_t slot = 0; slot < nbSlots; slot += step)
+            {
+                if(!queued[slot])
+                {
+                    queued[slot] = true;
+                    order.push_back(slot);
+                }
+            }
+        }
+    }
+
+    // decode the keyframe preceding timeUs
+    bool DecodeKeyframe(mediadecoder::Decoder* decoder, uint64_t timeUs, AVPacket* packet, AVFrame* frame)
+    {
+        mediadecoder::VideoStream* videoStream = decoder->videoStream;
+        AVCodecContext* codecContext = videoStream->codecContext;
+
+        const int64_t timestamp = av_rescale_q(static_cast<int64_t>(timeUs), AVRational{1, 1000000}, videoStream->stream->time_base);
+        if(av_seek_frame(decoder->avFormatContext, videoStream->streamIndex, timestamp, AVSEEK_FLAG_BACKWARD) < 0)
+        {
+            return false;
+        }
+        avcodec_flush_buffers(codecContext);
+
+        while(av_read_frame(decoder->avFormatContext, packet) >= 0)
+        {
+            const bool keyframe = packet->stream_index == videoStream->streamIndex && (packet->flags & AV_PKT_FLAG_KEY);
+            if(!keyframe)
+            {
+                av_packet_unref(packet);
+                continue;
+            }
+
+            int outcome = avcodec_send_packet(codecContext, packet);
+            av_packet_unref(packet);
+            if(outcome < 0)
+            {
+                return false;
+            }
+
+            // drain, the keyframe is the only frame we need
+            avcodec_send_packet(codecContext, nullptr);
+            return avcodec_receive_frame(codecContext, frame) == 0;
+        }
+        return false;
+    }
+
+    bool ExtractTile(thumbnail::Extractor* extractor, mediadecoder::Decoder* decoder, uint32_t slot,
+                     AVPacket* packet, AVFrame* frame, SwsContext*& swsContext, thumbnail::Tile& tile)
+    {
+        // the middle of the slot, its keyframe is usually inside the slot
+        const uint64_t timeUs = slot * extractor->intervalUs + extractor->intervalUs / 2;
+        if(!DecodeKeyframe(decoder, timeUs, packet, frame))
+        {
+            return false;
+        }
+
+        swsContext = sws_getCachedContext(swsContext, frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+                                          extractor->tileWidth, extractor->tileHeight, AV_PIX_FMT_RGB24,
+                                          SWS_AREA, nullptr, nullptr, nullptr);
+        if(!swsContext)
+        {
+            av_frame_unref(frame);
+            return false;
+        }
+
+        tile.width = extractor->tileWidth;
+        tile.height = extractor->tileHeight;
+        tile.rgb.resize(GetTileSize(extractor));
+
+        const AVRational& timeBase = decoder->videoStream->stream->time_base;
+        const int64_t pts = frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : frame->pts;
+        const double timeSeconds = static_cast<double>(pts) * static_cast<double>(timeBase.num) / static_cast<double>(timeBase.den);
+        tile.timeUs = pts != AV_NOPTS_VALUE && pts >= 0 ? chrono::Microseconds(timeSeconds) : timeUs;
+
+        uint8_t* dst[4] = {tile.rgb.data(), nullptr, nullptr, nullptr};
+        int dstLineSize[4] = {static_cast<int>(extractor->tileWidth * 3), 0, 0, 0};
+        sws_scale(swsContext, frame->data, frame->linesize, 0, frame->height, dst, dstLineSize);
+
+        av_frame_unref(frame);
+        return true;
+    }
+
+    // wait up to timeoutUs, loading requested tiles back from the disk cache meanwhile. False when quitting
+    bool Idle(thumbnail::Extractor* extractor, uint64_t timeoutUs)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutUs);
+
+        std::unique_lock<std::mutex> lock(extractor->mutex);
+        while(extractor->wake.wait_until(lock, deadline, [extractor]{ return extractor->quitting || extractor->requestedSlot != thumbnail::INVALID_SLOT; }))
+        {
+            if(extractor->quitting)
+            {
+                return false;
+            }
+
+            const uint32_t slot = extractor->requestedSlot;
+            const uint64_t timeUs = extractor->slotTimesUs[slot];
+            extractor->requestedSlot = thumbnail::INVALID_SLOT;
+            if(timeUs == thumbnail::INVALID_TIME || extractor->tiles.count(slot))
+            {
+                continue;
+            }
+
+            // the render thread keeps reading memory tiles while the disk is read
+            lock.unlock();
+            thumbnail::Tile tile;
+            const bool read = ReadTile(extractor, slot, timeUs, tile);
+            lock.lock();
+
+            if(read)
+            {
+                Insert(extractor, slot, std::move(tile));
+            }
+        }
+        return !extractor->quitting;
+    }
+
+    // decode the missing tiles within the cpu budget
+    void Extract(thumbnail::Extractor* extractor)
+    {
+        mediadecoder::Decoder* decoder = nullptr;
+        Result result = mediadecoder::Create(decoder);
+        if(result)
+        {
+            decoder->background = true;
+            result = mediadecoder::Open(decoder, extractor->path);
+        }
+        if(result && !decoder->videoStream)
+        {
+            result = Result(false, "No video stream");
+        }
+        if(!result)
+        {
+            logger::Warn("Thumbnail extractor cannot open %s: %s", extractor->path.c_str(), result.getError().c_str());
+            mediadecoder::Destroy(decoder);
+            return;
+        }
+
+        // only keyframes of the video stream are read
+        decoder->videoStream->codecContext->skip_frame = AVDISCARD_NONKEY;
+        for(uint32_t index = 0; index < decoder->avFormatContext->nb_streams; index++)
+        {
+            if(static_cast<int32_t>(index) != decoder->videoStream->streamIndex)
+            {
+                decoder->avFormatContext->streams[index]->discard = AVDISCARD_ALL;
+            }
+        }
+
+        std::vector<uint32_t> order;
+        GetExtractionOrder(extractor->nbSlots, order);
+
+        AVPacket* packet = av_packet_alloc();
+        AVFrame* frame = av_frame_alloc();
+        SwsContext* swsContext = nullptr;
+        uint32_t nbExtracted = 0;
+
+        for(auto it = order.begin(); it != order.end(); ++it)
+        {
+            const uint32_t slot = *it;
+            {
+                std::scoped_lock<std::mutex> lock(extractor->mutex);
+                if(extractor->quitting)
+                {
+                    break;
+                }
+                if(extractor->slotTimesUs[slot] != thumbnail::INVALID_TIME)
+                {
+                    continue;
+                }
+            }
+
+            const uint64_t startTimeUs = chrono::RealNow();
+
+            thumbnail::Tile tile;
+            if(ExtractTile(extractor, decoder, slot, packet, frame, swsContext, tile))
+            {
+                WriteTile(extractor, slot, tile);
+
+                std::scoped_lock<std::mutex> lock(extractor->mutex);
+                extractor->slotTimesUs[slot] = tile.timeUs;
+                Insert(extractor, slot, std::move(tile));
+                nbExtracted++;
+            }
+
+            // stay within the cpu budget, idle for the time it took scaled by the budget
+            const uint64_t busyTimeUs = chrono::RealNow() - startTimeUs;
+            const uint64_t idleTimeUs = static_cast<uint64_t>(static_cast<double>(busyTimeUs) * (1.0 - cpuBudget) / cpuBudget);
+            if(!Idle(extractor, idleTimeUs))
+            {
+                break;
+            }
+        }
+
+        logger::Info("Thumbnail extractor done, %d tiles extracted", nbExtracted);
+
+        sws_freeContext(swsContext);
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+        mediadecoder::Destroy(decoder);
+    }
+
+    void ExtractorThread(thumbnail::Extractor* extractor)
+    {
+        SetLowPriority();
+
+        std::vector<uint64_t> slotTimesUs(extractor->nbSlots, thumbnail::INVALID_TIME);
+        Result result = OpenCache(extractor, slotTimesUs);
+        if(result)
+        {
+            std::scoped_lock<std::mutex> lock(extractor->mutex);
+            extractor->slotTimesUs = slotTimesUs;
+        }
+        else
+        {
+            logger::Warn("Thumbnails are not cached on disk: %s", result.getError().c_str());
+        }
+
+        Extract(extractor);
+        extractor->done = true;
+
+        // without a disk cache evicted tiles are extracted again by the next extractor
+        while(extractor->cache.is_open() && Idle(extractor, REQUEST_WAIT_US))
+        {
+        }
+    }
+}
+
+namespace thumbnail
+{
+    void SetCacheDirectory(const std::string& path)
+    {
+        cacheDirectory = path;
+    }
+
+    void SetCpuBudget(double fraction)
+    {
+        cpuBudget = std::min(std::max(fraction, 0.01), 1.0);
+    }
+
+    void SetMemoryBudget(size_t bytes)
+    {
+        memoryBudget = bytes;
+    }
+
+    Result Create(Extractor*& extractor, const std::string& filename, uint32_t videoWidth, uint32_t videoHeight, uint64_t durationUs)
+    {
+        Result result;
+
+        if(videoWidth == 0 || videoHeight == 0 || durationUs == 0)
+        {
+            return Result(false, "Cannot extract thumbnails without video or duration");
+        }
+
+        extractor = new Extractor();
+        extractor->path = filename;
+        extractor->durationUs = durationUs;
+        extractor->intervalUs = std::max(MIN_TILE_INTERVAL_US, (durationUs + MAX_TILES - 1) / MAX_TILES);
+        extractor->nbSlots = static_cast<uint32_t>((durationUs + extractor->intervalUs - 1) / extractor->intervalUs);
+        extractor->tileWidth = TILE_WIDTH;
+        extractor->tileHeight = std::max(2U, (TILE_WIDTH * videoHeight / videoWidth) & ~1U);
+        extractor->slotTimesUs.resize(extractor->nbSlots, INVALID_TIME);
+
+        // the disk cache is opened by the extractor thread
+        extractor->thread = std::thread(ExtractorThread, extractor);
+
+        return result;
+    }
+
+    void Destroy(Extractor*& extractor)
+    {
+        if(!extractor)
+        {
+            return;
+        }
+
+        {
+            std::scoped_lock<std::mutex> lock(extractor->mutex);
+            extractor->quitting = true;
+        }
+        extractor->wake.notify_all();
+
+        if(extractor->thread.joinable())
+        {
+            extractor->thread.join();
+        }
+
+        delete extractor;
+        extractor = nullptr;
+    }
+
+    bool Get(Extractor* extractor, uint64_t timeUs, Tile& tile)
+    {
+        std::scoped_lock<std::mutex> lock(extractor->mutex);
+
+        const uint32_t nbSlots = extractor->nbSlots;
+        const uint32_t slot = static_cast<uint32_t>(std::min<uint64_t>(timeUs / extractor->intervalUs, nbSlots - 1));
+
+        // nearest slot in memory, the nearest extracted one is loaded from disk for the next call
+        bool requested = false;
+        for(uint32_t distance = 0; distance < nbSlots; distance++)
+        {
+            const uint32_t candidates[2] = { slot >= distance ? slot - distance : nbSlots, slot + distance };
+            for(uint32_t candidate : candidates)
+            {
+                if(candidate >= nbSlots || extractor->slotTimesUs[candidate] == INVALID_TIME)
+                {
+                    continue;
+                }
+
+                auto it = extractor->tiles.find(candidate);
+                if(it == extractor->tiles.end())
+                {
+                    if(!requested)
+                    {
+                        requested = true;
+                        extractor->requestedSlot = candidate;
+                        extractor->wake.notify_one();
+                    }
+                    continue;
+                }
+
+                extractor->lru.splice(extractor->lru.begin(), extractor->lru, it->second.second);
+                if(tile.timeUs != it->second.first.timeUs)
+                {
+                    tile = it->second.first;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "result.h"
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <unordered_map>
+#include <condition_variable>
+
+#include <stdint.h>
+
+namespace thumbnail
+{
+    static const uint32_t TILE_WIDTH = 160;
+    static const uint32_t MAX_TILES = 256;
+    static const uint64_t MIN_TILE_INTERVAL_US = 2000000;
+    static const uint64_t INVALID_TIME = UINT64_MAX;
+    static const uint32_t INVALID_SLOT = UINT32_MAX;
+
+    static const size_t   DEFAULT_MEMORY_BUDGET = 16 * 1024 * 1024;
+    static const double   DEFAULT_CPU_BUDGET = 0.1;
+
+    // keyframe downsampled to packed rgb24 rows
+    struct Tile
+    {
+        uint64_t timeUs = INVALID_TIME;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> rgb;
+    };
+
+    // Seek bar previews, one tile per time slot.
+    //
+    // A background thread decodes the keyframe of each slot with its own decoder.
+    // Tiles are kept in a memory LRU and in a disk cache file keyed by path and mtime
+    // so a file opened again has its previews right away. The cache file is only
+    // touched by the background thread, tiles evicted from memory are read back
+    // when Get asks for them.
+    struct Extractor
+    {
+        std::string path;
+        uint64_t durationUs = 0;
+        uint64_t intervalUs = 0;
+        uint32_t nbSlots = 0;
+        uint32_t tileWidth = 0;
+        uint32_t tileHeight = 0;
+
+        std::mutex mutex;
+
+        // tile time per slot, INVALID_TIME until extracted
+        std::vector<uint64_t> slotTimesUs;
+
+        // disk cache, disabled when the file cannot be written. Extractor thread only
+        std::string cachePath;
+        std::fstream cache;
+
+        // memory LRU, most recently used first
+        std::list<uint32_t> lru;
+        std::unordered_map<uint32_t, std::pair<Tile, std::list<uint32_t>::iterator>> tiles;
+        size_t memoryBytes = 0;
+
+        // cached slot to load back into memory
+        uint32_t requestedSlot = INVALID_SLOT;
+
+        std::thread thread;
+        std::condition_variable wake;
+        bool quitting = false;
+        std::atomic<bool> done = false;
+    };
+
+    void   SetCacheDirectory(const std::string& path);
+    void   SetCpuBudget(double fraction);
+    void   SetMemoryBudget(size_t bytes);
+
+    // start extracting, the video size and duration are the ones of the playing decoder
+    Result Create(Extractor*& extractor, const std::string& filename, uint32_t videoWidth, uint32_t videoHeight, uint64_t durationUs);
+    void   Destroy(Extractor*& extractor);
+
+    // tile of the slot holding timeUs or the nearest one in memory, false if there is none yet.
+    // Never waits on disk and tile is left as is when it already holds the result.
+    bool   Get(Extractor* extractor, uint64_t timeUs, Tile& tile);
+}
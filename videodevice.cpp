@@ -3,6 +3,7 @@
 #include "result.h"
 #include "numeric.h"
 #include "logger.h"
+#include "chrono.h"
 #include "filesystem.h"
 #include "stringext.h"
 
@@ -60,6 +61,7 @@ namespace {
     PFNGLACTIVETEXTUREPROC glActiveTexture;
 
     videodevice::Device* currentDevice = nullptr;
+    videodevice::Backend backend = videodevice::BACKEND_OPENGL;
 
     void CheckOpenGLError(const char* stmt, const char* fname, int line)
     {
@@ -1065,6 +1067,237 @@ namespace {
         TextFont defaultFont;
     };
     // text renderer end
+
+    // image renderer
+    class Rgb24ImageRenderer : public videodevice::ImageRenderer
+    {
+    public:
+        Rgb24ImageRenderer()
+        {
+        }
+
+        virtual ~Rgb24ImageRenderer()
+        {
+            GL_CHECK(glDeleteVertexArrays(1, &imageVertexArray));
+            GL_CHECK(glDeleteBuffers(1, &imageVertexBuffer));
+            GL_CHECK(glDeleteTextures(1, &imageTexture));
+        }
+
+        virtual Result Create()
+        {
+            Result result;
+
+            const std::string vertexShaderSource = 
+            "#version 330 core\n"
+            "layout (location = 0) in vec4 vertex; // <vec2 pos, vec2 tex>\n"
+            "out vec2 TexCoords;\n"
+            "\n"
+            "uniform mat4 projection;\n"
+            "\n"
+            "void main()\n"
+            "{\n"
+            "    gl_Position = projection * vec4(vertex.xy, 0.0, 1.0);\n"
+            "    TexCoords = vertex.zw;\n"
+            "}\n";
+
+            const std::string fragmentShaderSource =
+            "#version 330 core\n"
+            "in vec2 TexCoords;\n"
+            "out vec4 color;\n"
+            "\n" 
+            "uniform sampler2D image;\n"
+            "\n"
+            "void main()\n"
+            "{\n"    
+            "    color = vec4(texture(image, TexCoords).rgb, 1.0);\n"
+            "}\n";          
+
+            result = BuildProgram(vertexShaderSource, fragmentShaderSource, imageProgram);
+            if(!result)
+            {
+                return result;
+            }
+
+            GL_CHECK(glUseProgram(imageProgram));
+
+            GL_CHECK(glGenVertexArrays(1, &imageVertexArray));
+            GL_CHECK(glGenBuffers(1, &imageVertexBuffer));
+            GL_CHECK(glBindVertexArray(imageVertexArray));
+            GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, imageVertexBuffer));
+            GL_CHECK(glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * 4, nullptr, GL_DYNAMIC_DRAW));
+            GL_CHECK(glEnableVertexAttribArray(0));
+            GL_CHECK(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0));
+            GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, 0));
+            GL_CHECK(glBindVertexArray(0));
+
+            GL_CHECK(glGenTextures(1, &imageTexture));
+            GL_CHECK(glBindTexture(GL_TEXTURE_2D, imageTexture));
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+            GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+
+            GL_CHECK(imageUniformProjection = glGetUniformLocation(imageProgram, "projection"));
+            GL_CHECK(glUniform1i(glGetUniformLocation(imageProgram, "image"), 11));
+
+            return result;
+        }
+
+        virtual Result SetWindowSize(uint32_t width, uint32_t height)
+        {
+            Result result;
+            GL_CHECK(glUseProgram(imageProgram));
+            glm::mat4 projection = glm::ortho(0.0f, static_cast<GLfloat>(width), 0.0f, static_cast<GLfloat>(height));
+            GL_CHECK(glUniformMatrix4fv(imageUniformProjection, 1, GL_FALSE, glm::value_ptr(projection)));
+            return result;
+        }
+
+        virtual Result Render(const uint8_t* rgb, uint32_t width, uint32_t height, float x, float y)
+        {
+            Result result;
+
+            GL_CHECK(glUseProgram(imageProgram));
+            GL_CHECK(::glActiveTexture(GL_TEXTURE11));
+            GL_CHECK(glBindTexture(GL_TEXTURE_2D, imageTexture));
+
+            // rows are tightly packed
+            GL_CHECK(glPixelStorei(GL_UNPACK_ALIGNMENT, 1)); 
+            GL_CHECK(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
+
+            if(width != textureWidth || height != textureHeight)
+            {
+                GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, rgb));
+                textureWidth = width;
+                textureHeight = height;
+            }
+            else
+            {
+                GL_CHECK(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rgb));
+            }
+
+            const GLfloat w = static_cast<GLfloat>(width);
+            const GLfloat h = static_cast<GLfloat>(height);
+            GLfloat vertices[6][4] = {
+                { x,     y + h,   0.0, 0.0 },            
+                { x,     y,       0.0, 1.0 },
+                { x + w, y,       1.0, 1.0 },
+
+                { x,     y + h,   0.0, 0.0 },
+                { x + w, y,       1.0, 1.0 },
+                { x + w, y + h,   1.0, 0.0 }           
+            };
+
+            GL_CHECK(glBindVertexArray(imageVertexArray));
+            GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, imageVertexBuffer));
+            GL_CHECK(glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices)); 
+            GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, 0));
+            GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, 6));
+            GL_CHECK(glBindVertexArray(0));
+            GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+            GL_CHECK(::glActiveTexture(GL_TEXTURE0));
+
+            return result;
+        }
+
+    private:
+        GLuint imageProgram = 0;
+        GLuint imageVertexBuffer = 0;
+        GLuint imageVertexArray = 0;
+        GLuint imageTexture = 0;
+        GLuint imageUniformProjection = 0;
+
+        uint32_t textureWidth = 0;
+        uint32_t textureHeight = 0;
+    };
+    // image renderer end
+
+    // null renderers, nothing is drawn
+    class NullFrameRenderer : public videodevice::FrameRenderer
+    {
+    public:
+        virtual Result Create()
+        {
+            logger::Info("Creating Null Renderer");
+            return Result(true);
+        }
+
+        virtual Result SetWindowSize(uint32_t, uint32_t)
+        {
+            return Result(true);
+        }
+
+        virtual Result Render(videodevice::FrameBuffer*)
+        {
+            return Result(true);
+        }
+
+        virtual Result SetTextureSize(uint32_t, uint32_t)
+        {
+            return Result(true);
+        }
+    };
+
+    class NullTextRenderer : public videodevice::TextRenderer
+    {
+    public:
+        virtual Result Create()
+        {
+            return Result(true);
+        }
+
+        virtual Result SetWindowSize(uint32_t, uint32_t)
+        {
+            return Result(true);
+        }
+
+        virtual Result Render(const std::string&, const std::string&, uint32_t, float, float, float, glm::vec3)
+        {
+            return Result(true);
+        }
+
+        // fixed advance so subtitle layout stays deterministic
+        virtual Result GetSize(const std::string& text, const std::string&, uint32_t fontSize, float& w, float& h)
+        {
+            w = static_cast<float>(text.size() * fontSize) / 2.0f;
+            h = static_cast<float>(fontSize);
+            return Result(true);
+        }
+    };
+
+    class NullImageRenderer : public videodevice::ImageRenderer
+    {
+    public:
+        virtual Result Create()
+        {
+            return Result(true);
+        }
+
+        virtual Result SetWindowSize(uint32_t, uint32_t)
+        {
+            return Result(true);
+        }
+
+        virtual Result Render(const uint8_t*, uint32_t, uint32_t, float, float)
+        {
+            return Result(true);
+        }
+    };
+    // null renderers end
+
+    void UpdateFrameStats(videodevice::FrameStats& stats, uint64_t timeUs)
+    {
+        if( stats.frames != 0 )
+        {
+            const uint64_t intervalUs = timeUs - stats.lastTimeUs;
+            stats.totalIntervalUs += intervalUs;
+            stats.minIntervalUs = std::min(stats.minIntervalUs, intervalUs);
+            stats.maxIntervalUs = std::max(stats.maxIntervalUs, intervalUs);
+            stats.intervalSquaresUs += static_cast<double>(intervalUs) * static_cast<double>(intervalUs);
+        }
+        stats.frames++;
+        stats.lastTimeUs = timeUs;
+    }
 }
 
 namespace videodevice
@@ -1081,6 +1314,29 @@ namespace videodevice
         l.push_back(VF_YUV420P);
     }
 
+    void SetBackend(Backend b)
+    {
+        backend = b;
+    }
+
+    Backend GetBackend()
+    {
+        return backend;
+    }
+
+    Backend GetBackendFromString(const std::string& name)
+    {
+        if( name == "opengl" )
+        {
+            return BACKEND_OPENGL;
+        }
+        else if( name == "null" )
+        {
+            return BACKEND_NULL;
+        }
+        return BACKEND_INVALID;
+    }
+
     Result Create(Device*& device, VideoFormat outputFormat)
     {
         Result result;
@@ -1090,6 +1346,17 @@ namespace videodevice
             return Result(false, "Video device already exist. Cannot create more than one device.");
         }
 
+        if( backend == BACKEND_NULL )
+        {
+            device = new Device();
+            device->backend = BACKEND_NULL;
+            device->renderer = new NullFrameRenderer();
+            device->text = new NullTextRenderer();
+            device->image = new NullImageRenderer();
+            currentDevice = device;
+            return device->renderer->Create();
+        }
+
         // must be done after context creation on windows
         InitGLext();
 
@@ -1129,11 +1396,21 @@ namespace videodevice
             return result;
         }
 
+        // create image renderer
+        device->image = new Rgb24ImageRenderer();
+
+        result = device->image->Create();
+        if(!result)
+        {
+            return result;
+        }
+
         return result;
     }
 
     Result DrawFrame(Device* device, FrameBuffer* fb)
     {
+        UpdateFrameStats(device->frameStats, chrono::Now());
         return device->renderer->Render(fb);
     }
 
@@ -1147,6 +1424,11 @@ namespace videodevice
         return device->text->GetSize(text, fontName, fontSize, w, h);
     }
 
+    Result DrawImage(Device* device, const uint8_t* rgb, uint32_t width, uint32_t height, float x, float y)
+    {
+        return device->image->Render(rgb, width, height, x, y);
+    }
+
     Result SetTextureSize(Device* device, uint32_t width, uint32_t height)
     {
         Result result;
@@ -1176,6 +1458,11 @@ namespace videodevice
         {
             return result;
         }
+        result = device->image->SetWindowSize(width,height);
+        if(!result)
+        {
+            return result;
+        }
 
     
         return result;
@@ -1194,12 +1481,18 @@ namespace videodevice
         return result;
     }
 
+    void GetFrameStats(Device* device, FrameStats& stats)
+    {
+        stats = device->frameStats;
+    }
+
     void Destroy(Device*& device)
     {
         if(device)
         {
             delete device->renderer;
             delete device->text;
+            delete device->image;
             delete device;
             device = nullptr;
             currentDevice = nullptr;
@@ -42,8 +42,36 @@ namespace videodevice
         virtual Result GetSize(const std::string& text, const std::string& fontName, uint32_t fontSize, float& w, float& h) = 0;
     };
 
+    // packed rgb24 image drawn over the video at window coordinates
+    struct ImageRenderer : public Renderer
+    {
+        virtual Result Render(const uint8_t* rgb, uint32_t width, uint32_t height, float x, float y) = 0;
+    };
+
+    enum Backend
+    {
+        BACKEND_OPENGL,
+        BACKEND_NULL,
+        BACKEND_INVALID
+    };
+
+    // presentation times of drawn frames
+    struct FrameStats
+    {
+        uint64_t frames = 0;
+        uint64_t lastTimeUs = 0;
+        uint64_t totalIntervalUs = 0;
+        uint64_t minIntervalUs = UINT64_MAX;
+        uint64_t maxIntervalUs = 0;
+        double   intervalSquaresUs = 0.0;
+    };
+
     struct Device
     {
+        Backend backend = BACKEND_OPENGL;
+
+        FrameStats frameStats;
+
         // texture size
         GLuint width = 0;
         GLuint height = 0;
@@ -57,11 +85,19 @@ namespace videodevice
 
         // text renderer
         TextRenderer* text = nullptr;
+
+        // image renderer
+        ImageRenderer* image = nullptr;
     };
 
     Result Init();
     void   GetSupportedFormat(VideoFormatList&) ;
 
+    // backend of the next created device, the null backend draws nothing and needs no GL context
+    void    SetBackend(Backend);
+    Backend GetBackend();
+    Backend GetBackendFromString(const std::string&);
+
     Result Create(Device*& device, VideoFormat outputFormat);
 
     Result DrawFrame(Device* device, FrameBuffer*);
@@ -69,9 +105,13 @@ namespace videodevice
     Result DrawText(Device* device, const std::string& text, const std::string& fontName, uint32_t fontSize, float x, float y, float scale, glm::vec3 color);
     Result GetTextSize(Device* device, const std::string& text, const std::string& fontName, uint32_t fontSize, float& w, float& h);
 
+    Result DrawImage(Device* device, const uint8_t* rgb, uint32_t width, uint32_t height, float x, float y);
+
     Result SetTextureSize(Device* device, uint32_t width, uint32_t height);
     Result SetWindowSize(Device* device, uint32_t width, uint32_t height);
     Result GetWindowSize(Device* device, uint32_t& width, uint32_t& height);
+
+    void   GetFrameStats(Device* device, FrameStats& stats);
     
     void   Destroy(Device*& device);
 }
@@ -0,0 +1,113 @@
+#include "precomp.h"
+#include "workerpool.h"
+
+#include <algorithm>
+
+#include <assert.h>
+
+namespace {
+
+    // run tasks of the current batch until there are none left. Lock must be held.
+    void RunTasks(workerpool::Pool* pool, std::unique_lock<std::mutex>& lock)
+    {
+        while( pool->nextTask < pool->taskCount )
+        {
+            const uint32_t index = pool->nextTask++;
+            const workerpool::Task& task = *pool->task;
+
+            lock.unlock();
+            task(index);
+            lock.lock();
+
+            if( --pool->pendingTasks == 0 )
+            {
+                pool->batchDone.notify_all();
+            }
+        }
+    }
+
+    void WorkerThread(workerpool::Pool* pool)
+    {
+        std::unique_lock<std::mutex> lock(pool->mutex);
+        uint64_t batch = 0;
+
+        while( !pool->quitting )
+        {
+            pool->taskAvailable.wait(lock, [pool, &batch]{ return pool->quitting || pool->batch != batch; });
+            batch = pool->batch;
+
+            RunTasks(pool, lock);
+        }
+    }
+}
+
+namespace workerpool
+{
+    Result Create(Pool*& pool, uint32_t threads)
+    {
+        Result result;
+
+        if( threads == 0 )
+        {
+            threads = std::max(1U, std::thread::hardware_concurrency());
+        }
+
+        pool = new Pool();
+
+        // the calling thread runs tasks as well
+        for(uint32_t i = 1; i < threads; i++)
+        {
+            pool->threads.push_back(std::thread(WorkerThread, pool));
+        }
+
+        return result;
+    }
+
+    void Destroy(Pool*& pool)
+    {
+        if( !pool )
+        {
+            return;
+        }
+
+        {
+            std::scoped_lock<std::mutex> lock(pool->mutex);
+            pool->quitting = true;
+        }
+        pool->taskAvailable.notify_all();
+
+        for(auto it = pool->threads.begin(); it != pool->threads.end(); ++it)
+        {
+            it->join();
+        }
+
+        delete pool;
+        pool = nullptr;
+    }
+
+    uint32_t GetNumThreads(Pool* pool)
+    {
+        return static_cast<uint32_t>(pool->threads.size()) + 1;
+    }
+
+    void Run(Pool* pool, uint32_t count, const Task& task)
+    {
+        assert(pool);
+
+        std::unique_lock<std::mutex> lock(pool->mutex);
+        assert(pool->pendingTasks == 0);
+
+        pool->task = &task;
+        pool->taskCount = count;
+        pool->nextTask = 0;
+        pool->pendingTasks = count;
+        pool->batch++;
+        pool->taskAvailable.notify_all();
+
+        RunTasks(pool, lock);
+        pool->batchDone.wait(lock, [pool]{ return pool->pendingTasks == 0; });
+
+        pool->task = nullptr;
+        pool->taskCount = 0;
+    }
+}
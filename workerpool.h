@@ -0,0 +1,45 @@
+#pragma once
+
+#include "result.h"
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include <stdint.h>
+
+namespace workerpool
+{
+    typedef std::function<void (uint32_t)> Task;
+
+    // Fixed set of threads running the tasks of a single batch at a time.
+    // The thread calling Run takes part in the batch and returns when every task is done.
+    struct Pool
+    {
+        std::vector<std::thread> threads;
+
+        std::mutex mutex;
+        std::condition_variable taskAvailable;
+        std::condition_variable batchDone;
+
+        // current batch
+        const Task* task = nullptr;
+        uint32_t taskCount = 0;
+        uint32_t nextTask = 0;
+        uint32_t pendingTasks = 0;
+        uint64_t batch = 0;
+
+        bool quitting = false;
+    };
+
+    // threads == 0 uses one thread per core
+    Result Create(Pool*& pool, uint32_t threads);
+    void   Destroy(Pool*& pool);
+
+    uint32_t GetNumThreads(Pool* pool);
+
+    // run task(0) .. task(count - 1) on the pool and wait for completion
+    void Run(Pool* pool, uint32_t count, const Task& task);
+}